@@ -0,0 +1,194 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "brush.h"
+#include "voxel.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+static void add_span(float lo, float hi, bool & found, float & z1,
+                     float & z2)
+{
+    if (lo > hi)
+        return;
+    if (!found) {
+        z1 = lo;
+        z2 = hi;
+        found = true;
+        return;
+    }
+    z1 = std::min(z1, lo);
+    z2 = std::max(z2, hi);
+}
+
+static void add_sphere_span(const vec3 & center, float r, float x, float y,
+                            bool & found, float & z1, float & z2)
+{
+    float dx = x - center.x;
+    float dy = y - center.y;
+    float t = r * r - dx * dx - dy * dy;
+    if (t < 0.0f)
+        return;
+    float h = sqrtf(t);
+    add_span(center.z - h, center.z + h, found, z1, z2);
+}
+
+// the part of the column at x, y within r of the segment a-b. a capsule is
+// convex, so its end spheres and the cylinder between them join into one
+// range.
+static bool get_capsule_span(const vec3 & a, const vec3 & b, float r,
+                             float x, float y, float & z1, float & z2)
+{
+    bool found = false;
+    add_sphere_span(a, r, x, y, found, z1, z2);
+    add_sphere_span(b, r, x, y, found, z1, z2);
+    vec3 d = b - a;
+    float len2 = glm::dot(d, d);
+    if (len2 == 0.0f)
+        return found;
+
+    // the column is q + z * (0, 0, 1). its distance to the axis is within r
+    // where |w|^2 - (w.d)^2 / len2 <= r^2, a quadratic in z.
+    vec3 q = vec3(x, y, 0.0f) - a;
+    float qd = glm::dot(q, d);
+    float qa = 1.0f - d.z * d.z / len2;
+    float qb = 2.0f * (q.z - qd * d.z / len2);
+    float qc = glm::dot(q, q) - qd * qd / len2 - r * r;
+    float lo, hi;
+    if (qa < 1e-6f) {
+        // the column runs along the axis
+        if (qc > 0.0f)
+            return found;
+        lo = -FLT_MAX;
+        hi = FLT_MAX;
+    } else {
+        float disc = qb * qb - 4.0f * qa * qc;
+        if (disc < 0.0f)
+            return found;
+        float s = sqrtf(disc);
+        lo = (-qb - s) / (2.0f * qa);
+        hi = (-qb + s) / (2.0f * qa);
+    }
+
+    // and between the ends, 0 <= w.d <= len2
+    if (d.z == 0.0f) {
+        if (qd < 0.0f || qd > len2)
+            return found;
+    } else {
+        float t1 = -qd / d.z;
+        float t2 = (len2 - qd) / d.z;
+        lo = std::max(lo, std::min(t1, t2));
+        hi = std::min(hi, std::max(t1, t2));
+    }
+    add_span(lo, hi, found, z1, z2);
+    return found;
+}
+
+// VoxelBrush
+
+VoxelBrush::VoxelBrush()
+: shape(SPHERE_BRUSH), radius(2)
+{
+}
+
+// box of the columns the brush may touch. only lines use end.
+void VoxelBrush::get_bounds(const ivec3 & start, const ivec3 & end,
+                            ivec3 & min, ivec3 & max)
+{
+    if (shape == LINE_BRUSH) {
+        ivec3 r(radius.x);
+        min = glm::min(start, end) - r;
+        max = glm::max(start, end) + r + 1;
+        return;
+    }
+    min = start - radius;
+    max = start + radius + 1;
+}
+
+// the range along z that the brush covers in the column at x, y. voxels
+// are inside if their center is, with half a voxel added to the radius so
+// a radius of 0 is a single voxel.
+bool VoxelBrush::get_span(const vec3 & start, const vec3 & end, int x,
+                          int y, float & z1, float & z2)
+{
+    vec3 r = vec3(radius) + 0.5f;
+    if (shape == LINE_BRUSH)
+        return get_capsule_span(start, end, r.x, float(x), float(y), z1,
+                                z2);
+    float t = 1.0f;
+    if (shape != BOX_BRUSH) {
+        float dx = (x - start.x) / r.x;
+        float dy = (y - start.y) / r.y;
+        t -= dx * dx + dy * dy;
+        if (t < 0.0f)
+            return false;
+    }
+    float h = r.z;
+    if (shape == SPHERE_BRUSH)
+        h *= sqrtf(t);
+    z1 = start.z - h;
+    z2 = start.z + h;
+    return true;
+}
+
+// writes v into the brush placed at start, or stretched from start to end
+// for lines. min and max get the single box that was written to, clipped
+// to the model. returns false if the brush missed the model.
+bool VoxelBrush::apply(VoxelFile * file, const ivec3 & start,
+                       const ivec3 & end, unsigned char v, ivec3 & min,
+                       ivec3 & max)
+{
+    ivec3 box_min, box_max;
+    get_bounds(start, end, box_min, box_max);
+    box_min = glm::max(box_min, ivec3(0));
+    box_max = glm::min(box_max, ivec3(file->x_size, file->y_size,
+                                      file->z_size));
+    vec3 a(start);
+    vec3 b(end);
+    bool found = false;
+    for (int x = box_min.x; x < box_max.x; x++)
+    for (int y = box_min.y; y < box_max.y; y++) {
+        float z1, z2;
+        if (!get_span(a, b, x, y, z1, z2))
+            continue;
+        if (z1 >= float(box_max.z) || z2 < float(box_min.z))
+            continue;
+        int n1 = std::max(box_min.z, int(ceilf(z1)));
+        int n2 = std::min(box_max.z, int(floorf(z2)) + 1);
+        if (n1 >= n2)
+            continue;
+        file->fill_row(x, y, n1, n2 - n1, v);
+        ivec3 p1(x, y, n1);
+        ivec3 p2(x + 1, y + 1, n2);
+        if (found) {
+            min = glm::min(min, p1);
+            max = glm::max(max, p2);
+        } else {
+            min = p1;
+            max = p2;
+            found = true;
+        }
+    }
+    return found;
+}
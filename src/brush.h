@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_BRUSH_H
+#define VOXIE_BRUSH_H
+
+#include "glm.h"
+
+class VoxelFile;
+
+// shapes of VoxelBrush
+#define SPHERE_BRUSH 0
+#define BOX_BRUSH 1
+#define CYLINDER_BRUSH 2
+#define LINE_BRUSH 3
+
+// a parametric brush, written one run along z per column. the radius is
+// per axis, so spheres stretch into ellipsoids. cylinders stand along z
+// and lines between two points are radius.x thick.
+class VoxelBrush
+{
+public:
+    int shape;
+    ivec3 radius;
+
+    VoxelBrush();
+    bool apply(VoxelFile * file, const ivec3 & start, const ivec3 & end,
+               unsigned char v, ivec3 & min, ivec3 & max);
+    void get_bounds(const ivec3 & start, const ivec3 & end, ivec3 & min,
+                    ivec3 & max);
+    bool get_span(const vec3 & start, const vec3 & end, int x, int y,
+                  float & z1, float & z2);
+};
+
+#endif // VOXIE_BRUSH_H
@@ -25,6 +25,9 @@ THE SOFTWARE.
 
 #include "glm.h"
 
+#include <algorithm>
+#include <limits>
+
 inline void test_ray_plane(const vec3 & pos1, const vec3 & dir,
                            const vec3 & pos2, const vec3 & normal,
                            float & t)
@@ -57,6 +60,29 @@ inline bool intersects(const vec3 & min1, const vec3 & max1,
     return true;
 }
 
+// slab test of a ray against a box. t_near is the distance at which the
+// ray enters the box, through a face perpendicular to axis.
+inline bool test_ray_aabb(const vec3 & pos, const vec3 & inv_dir,
+                          const vec3 & min, const vec3 & max,
+                          float & t_near, float & t_far, int & axis)
+{
+    t_near = -std::numeric_limits<float>::infinity();
+    t_far = std::numeric_limits<float>::infinity();
+    axis = 0;
+    for (int i = 0; i < 3; i++) {
+        float t1 = (min[i] - pos[i]) * inv_dir[i];
+        float t2 = (max[i] - pos[i]) * inv_dir[i];
+        if (t1 > t2)
+            std::swap(t1, t2);
+        if (t1 > t_near) {
+            t_near = t1;
+            axis = i;
+        }
+        t_far = std::min(t_far, t2);
+    }
+    return t_near <= t_far && t_far >= 0.0f;
+}
+
 inline bool test_aabb_frustum(const vec3 & min, const vec3 & max,
                               vec4 * planes)
 {
@@ -75,4 +101,35 @@ inline bool test_aabb_frustum(const vec3 & min, const vec3 & max,
     return true;
 }
 
+#define FRUSTUM_OUTSIDE 0
+#define FRUSTUM_PARTIAL 1
+#define FRUSTUM_INSIDE 2
+
+// like test_aabb_frustum(), but also tells boxes that lie entirely inside
+// apart from those that cross a plane
+inline int classify_aabb_frustum(const vec3 & min, const vec3 & max,
+                                 vec4 * planes)
+{
+    int ret = FRUSTUM_INSIDE;
+    for (int i = 0; i < 6; ++i) {
+        vec4 & plane = planes[i];
+        vec3 normal(plane.x, plane.y, plane.z);
+        vec3 pv(
+            plane.x < 0 ? max.x : min.x,
+            plane.y < 0 ? max.y : min.y,
+            plane.z < 0 ? max.z : min.z
+        );
+        vec3 nv(
+            plane.x < 0 ? min.x : max.x,
+            plane.y < 0 ? min.y : max.y,
+            plane.z < 0 ? min.z : max.z
+        );
+        if (glm::dot(pv, normal) + plane.w > 0)
+            return FRUSTUM_OUTSIDE;
+        if (glm::dot(nv, normal) + plane.w > 0)
+            ret = FRUSTUM_PARTIAL;
+    }
+    return ret;
+}
+
 #endif // VOXIE_COLLISION_H
@@ -0,0 +1,489 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "components.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdlib.h>
+
+static quint32 find_root(std::vector<quint32> & parents, quint32 i)
+{
+    quint32 root = i;
+    while (parents[root] != root)
+        root = parents[root];
+    while (parents[i] != root) {
+        quint32 next = parents[i];
+        parents[i] = root;
+        i = next;
+    }
+    return root;
+}
+
+// the lower label becomes the root, so every set is named after its first
+// label no matter in which order they are joined
+static void join_roots(std::vector<quint32> & parents, quint32 a, quint32 b)
+{
+    a = find_root(parents, a);
+    b = find_root(parents, b);
+    if (a < b)
+        parents[b] = a;
+    else if (b < a)
+        parents[a] = b;
+}
+
+// whether the runs [a1, a2) and [b1, b2) of two rows that are 'apart' steps
+// away in x and y touch
+static inline bool is_connected(int a1, int a2, int b1, int b2, int apart,
+                                bool diagonal)
+{
+    if (diagonal)
+        return b1 <= a2 && a1 <= b2;
+    if (apart == 0)
+        return b1 == a2 || a1 == b2;
+    return apart == 1 && b1 < a2 && a1 < b2;
+}
+
+// the runs of a row. uniform bricks get their single run from tmp.
+static const ComponentRun * get_runs(const ComponentBrick & brick,
+                                     const ivec3 & size, int x, int y,
+                                     ComponentRun & tmp, int & count)
+{
+    count = 0;
+    if (brick.count == 0)
+        return NULL;
+    if (brick.uniform) {
+        if (x >= size.x || y >= size.y)
+            return NULL;
+        tmp.z1 = 0;
+        tmp.z2 = (unsigned char)size.z;
+        tmp.label = 0;
+        count = 1;
+        return &tmp;
+    }
+    int row = y | (x << BRICK_SHIFT);
+    int start = brick.rows[row];
+    count = brick.rows[row + 1] - start;
+    if (count == 0)
+        return NULL;
+    return &brick.runs[start];
+}
+
+// ComponentBrick
+
+ComponentBrick::ComponentBrick()
+: first(0), count(0), uniform(false)
+{
+}
+
+// labels the runs of one brick column per job piece
+class LabelJob : public ParallelJob
+{
+public:
+    VoxelComponents * components;
+    VoxelFile * file;
+
+    LabelJob(VoxelComponents * components)
+    : components(components), file(components->file)
+    {
+    }
+
+    void run(int i)
+    {
+        int x = i / file->y_bricks;
+        int y = i % file->y_bricks;
+        std::vector<quint32> parents;
+        for (int z = 0; z < file->z_bricks; z++) {
+            size_t index = file->get_slot_index(x, y, z);
+            label_brick(components->bricks[index], file->bricks[index],
+                        parents);
+        }
+    }
+
+    void label_brick(ComponentBrick & out, BrickSlot & slot,
+                     std::vector<quint32> & parents)
+    {
+        if (slot.is_empty())
+            return;
+        VoxelBrick * brick = file->get_brick(slot);
+        if (brick == NULL) {
+            if (slot.fill == VOXEL_AIR)
+                return;
+            out.uniform = true;
+            out.count = 1;
+            return;
+        }
+        const int row_count = BRICK_SIZE * BRICK_SIZE;
+        out.rows.resize(row_count + 1);
+        for (int row = 0; row < row_count; row++) {
+            out.rows[row] = quint16(out.runs.size());
+            unsigned int mask = brick->solid[row];
+            while (mask != 0) {
+                ComponentRun run;
+                int z1 = count_trailing_zeros(mask);
+                unsigned int rest = ~mask & ~((1u << z1) - 1);
+                int z2 = count_trailing_zeros(rest);
+                run.z1 = (unsigned char)z1;
+                run.z2 = (unsigned char)z2;
+                out.runs.push_back(run);
+                mask &= ~((1u << z2) - 1);
+            }
+        }
+        out.rows[row_count] = quint16(out.runs.size());
+
+        // join with the rows before, which have been visited already
+        parents.resize(out.runs.size());
+        for (size_t i = 0; i < parents.size(); i++)
+            parents[i] = quint32(i);
+        bool diagonal = components->diagonal;
+        for (int x = 0; x < BRICK_SIZE; x++)
+        for (int y = 0; y < BRICK_SIZE; y++) {
+            join_row(out, parents, x, y, x, y - 1, 1);
+            join_row(out, parents, x, y, x - 1, y, 1);
+            if (!diagonal)
+                continue;
+            join_row(out, parents, x, y, x - 1, y - 1, 2);
+            join_row(out, parents, x, y, x - 1, y + 1, 2);
+        }
+
+        // roots come before the rest of their set
+        quint32 count = 0;
+        for (size_t i = 0; i < out.runs.size(); i++) {
+            quint32 root = find_root(parents, quint32(i));
+            if (root == i)
+                out.runs[i].label = quint16(count++);
+            else
+                out.runs[i].label = out.runs[root].label;
+        }
+        out.count = count;
+    }
+
+    void join_row(ComponentBrick & brick, std::vector<quint32> & parents,
+                  int x1, int y1, int x2, int y2, int apart)
+    {
+        if (x2 < 0 || y2 < 0 || y2 >= BRICK_SIZE)
+            return;
+        int row1 = y1 | (x1 << BRICK_SHIFT);
+        int row2 = y2 | (x2 << BRICK_SHIFT);
+        bool diagonal = components->diagonal;
+        for (int a = brick.rows[row1]; a < brick.rows[row1 + 1]; a++)
+        for (int b = brick.rows[row2]; b < brick.rows[row2 + 1]; b++) {
+            const ComponentRun & ra = brick.runs[a];
+            const ComponentRun & rb = brick.runs[b];
+            if (is_connected(ra.z1, ra.z2, rb.z1, rb.z2, apart, diagonal))
+                join_roots(parents, a, b);
+        }
+    }
+};
+
+// VoxelComponents
+
+VoxelComponents::VoxelComponents()
+: file(NULL), diagonal(false)
+{
+}
+
+// joins the labels of brick a with those of its neighbour b at a + d
+static void join_bricks(VoxelComponents * c, std::vector<quint32> & parents,
+                        const ivec3 & a, const ivec3 & d)
+{
+    VoxelFile * file = c->file;
+    ivec3 b = a + d;
+    const ComponentBrick & brick_a = c->bricks[
+        file->get_slot_index(a.x, a.y, a.z)];
+    const ComponentBrick & brick_b = c->bricks[
+        file->get_slot_index(b.x, b.y, b.z)];
+    if (brick_b.count == 0)
+        return;
+    ivec3 min, max;
+    file->get_brick_box(a.x, a.y, a.z, min, max);
+    ivec3 size_a = max - min;
+    file->get_brick_box(b.x, b.y, b.z, min, max);
+    ivec3 size_b = max - min;
+
+    // only the rows of a at the border with b
+    int x1 = 0, x2 = size_a.x;
+    if (d.x > 0)
+        x1 = x2 - 1;
+    else if (d.x < 0)
+        x2 = 1;
+    int y1 = 0, y2 = size_a.y;
+    if (d.y > 0)
+        y1 = y2 - 1;
+    else if (d.y < 0)
+        y2 = 1;
+    // bricks with a single label each need at most one join
+    bool single = brick_a.count == 1 && brick_b.count == 1;
+    int steps = c->diagonal ? 1 : 0;
+    int shift = d.z * BRICK_SIZE;
+    ComponentRun tmp_a, tmp_b;
+    for (int ax = x1; ax < x2; ax++)
+    for (int ay = y1; ay < y2; ay++) {
+        int count_a;
+        const ComponentRun * runs_a = get_runs(brick_a, size_a, ax, ay,
+                                               tmp_a, count_a);
+        if (count_a == 0)
+            continue;
+        // across z, only the run at the border can touch
+        if (d.z > 0) {
+            runs_a += count_a - 1;
+            if (runs_a->z2 != BRICK_SIZE)
+                continue;
+            count_a = 1;
+        } else if (d.z < 0) {
+            if (runs_a->z1 != 0)
+                continue;
+            count_a = 1;
+        }
+        for (int ox = -1; ox <= 1; ox++)
+        for (int oy = -1; oy <= 1; oy++) {
+            int apart = abs(ox) + abs(oy);
+            if (apart > 1 + steps)
+                continue;
+            int bx = ax + ox - d.x * BRICK_SIZE;
+            int by = ay + oy - d.y * BRICK_SIZE;
+            if (bx < 0 || by < 0 || bx >= size_b.x || by >= size_b.y)
+                continue;
+            int count_b;
+            const ComponentRun * runs_b = get_runs(brick_b, size_b, bx, by,
+                                                   tmp_b, count_b);
+            if (count_b == 0)
+                continue;
+            if (d.z > 0) {
+                count_b = 1;
+            } else if (d.z < 0) {
+                runs_b += count_b - 1;
+                count_b = 1;
+            }
+            for (int i = 0; i < count_a; i++)
+            for (int j = 0; j < count_b; j++) {
+                const ComponentRun & ra = runs_a[i];
+                const ComponentRun & rb = runs_b[j];
+                if (!is_connected(ra.z1, ra.z2, rb.z1 + shift,
+                                  rb.z2 + shift, apart, c->diagonal))
+                    continue;
+                join_roots(parents, brick_a.first + ra.label,
+                           brick_b.first + rb.label);
+                if (single)
+                    return;
+            }
+        }
+    }
+}
+
+void VoxelComponents::build(VoxelFile * file, bool diagonal)
+{
+    this->file = file;
+    this->diagonal = diagonal;
+    bricks.clear();
+    bricks.resize(file->bricks.size());
+    LabelJob job(this);
+    parallel_for(job, file->x_bricks * file->y_bricks, file->pager == NULL);
+
+    quint32 total = 0;
+    for (size_t i = 0; i < bricks.size(); i++) {
+        bricks[i].first = total;
+        total += bricks[i].count;
+    }
+    std::vector<quint32> parents(total);
+    for (quint32 i = 0; i < total; i++)
+        parents[i] = i;
+
+    // neighbours that come after a brick, so every pair is seen once
+    std::vector<ivec3> dirs;
+    for (int dx = -1; dx <= 1; dx++)
+    for (int dy = -1; dy <= 1; dy++)
+    for (int dz = -1; dz <= 1; dz++) {
+        ivec3 d(dx, dy, dz);
+        if (!diagonal && abs(dx) + abs(dy) + abs(dz) != 1)
+            continue;
+        if (dx > 0 || (dx == 0 && (dy > 0 || (dy == 0 && dz > 0))))
+            dirs.push_back(d);
+    }
+    ivec3 count(file->x_bricks, file->y_bricks, file->z_bricks);
+    for (int x = 0; x < count.x; x++)
+    for (int y = 0; y < count.y; y++)
+    for (int z = 0; z < count.z; z++) {
+        ivec3 a(x, y, z);
+        if (bricks[file->get_slot_index(x, y, z)].count == 0)
+            continue;
+        for (size_t i = 0; i < dirs.size(); i++) {
+            ivec3 b = a + dirs[i];
+            if (glm::any(glm::lessThan(b, ivec3(0))) ||
+                glm::any(glm::greaterThanEqual(b, count)))
+                continue;
+            join_bricks(this, parents, a, dirs[i]);
+        }
+    }
+
+    labels.resize(total);
+    sizes.clear();
+    for (quint32 i = 0; i < total; i++) {
+        quint32 root = find_root(parents, i);
+        if (root != i) {
+            labels[i] = labels[root];
+            continue;
+        }
+        labels[i] = quint32(sizes.size());
+        sizes.push_back(0);
+    }
+
+    int n = get_count();
+    mins.assign(n, ivec3(std::numeric_limits<int>::max()));
+    maxs.assign(n, ivec3(std::numeric_limits<int>::min()));
+    for (int x = 0; x < count.x; x++)
+    for (int y = 0; y < count.y; y++)
+    for (int z = 0; z < count.z; z++) {
+        const ComponentBrick & brick = bricks[file->get_slot_index(x, y, z)];
+        if (brick.count == 0)
+            continue;
+        ivec3 min, max;
+        file->get_brick_box(x, y, z, min, max);
+        if (brick.uniform) {
+            quint32 c = labels[brick.first];
+            ivec3 size = max - min;
+            sizes[c] += int64_t(size.x) * size.y * size.z;
+            mins[c] = glm::min(mins[c], min);
+            maxs[c] = glm::max(maxs[c], max);
+            continue;
+        }
+        for (int row = 0; row < BRICK_SIZE * BRICK_SIZE; row++)
+        for (int i = brick.rows[row]; i < brick.rows[row + 1]; i++) {
+            const ComponentRun & run = brick.runs[i];
+            quint32 c = labels[brick.first + run.label];
+            sizes[c] += run.z2 - run.z1;
+            ivec3 p1 = min + ivec3(row >> BRICK_SHIFT, row & BRICK_MASK,
+                                   run.z1);
+            ivec3 p2 = min + ivec3((row >> BRICK_SHIFT) + 1,
+                                   (row & BRICK_MASK) + 1, run.z2);
+            mins[c] = glm::min(mins[c], p1);
+            maxs[c] = glm::max(maxs[c], p2);
+        }
+    }
+}
+
+int VoxelComponents::get_count()
+{
+    return int(sizes.size());
+}
+
+// the component of a voxel, or -1 for air
+int VoxelComponents::get(int x, int y, int z)
+{
+    if (x < 0 || y < 0 || z < 0 ||
+        x >= file->x_size || y >= file->y_size || z >= file->z_size)
+        return -1;
+    const ComponentBrick & brick = bricks[file->get_slot_index(
+        x >> BRICK_SHIFT, y >> BRICK_SHIFT, z >> BRICK_SHIFT)];
+    if (brick.count == 0)
+        return -1;
+    if (brick.uniform)
+        return labels[brick.first];
+    int row = (y & BRICK_MASK) | ((x & BRICK_MASK) << BRICK_SHIFT);
+    int lz = z & BRICK_MASK;
+    for (int i = brick.rows[row]; i < brick.rows[row + 1]; i++) {
+        const ComponentRun & run = brick.runs[i];
+        if (lz >= run.z1 && lz < run.z2)
+            return labels[brick.first + run.label];
+    }
+    return -1;
+}
+
+void VoxelComponents::get_voxels(int component, std::vector<ivec3> & out)
+{
+    ivec3 b1 = mins[component] >> BRICK_SHIFT;
+    ivec3 b2 = (maxs[component] - 1) >> BRICK_SHIFT;
+    for (int x = b1.x; x <= b2.x; x++)
+    for (int y = b1.y; y <= b2.y; y++)
+    for (int z = b1.z; z <= b2.z; z++) {
+        const ComponentBrick & brick = bricks[file->get_slot_index(x, y, z)];
+        if (brick.count == 0)
+            continue;
+        ivec3 min, max;
+        file->get_brick_box(x, y, z, min, max);
+        if (brick.uniform) {
+            if (int(labels[brick.first]) != component)
+                continue;
+            for (int vx = min.x; vx < max.x; vx++)
+            for (int vy = min.y; vy < max.y; vy++)
+            for (int vz = min.z; vz < max.z; vz++)
+                out.push_back(ivec3(vx, vy, vz));
+            continue;
+        }
+        for (int row = 0; row < BRICK_SIZE * BRICK_SIZE; row++)
+        for (int i = brick.rows[row]; i < brick.rows[row + 1]; i++) {
+            const ComponentRun & run = brick.runs[i];
+            if (int(labels[brick.first + run.label]) != component)
+                continue;
+            int vx = min.x + (row >> BRICK_SHIFT);
+            int vy = min.y + (row & BRICK_MASK);
+            for (int vz = run.z1; vz < run.z2; vz++)
+                out.push_back(ivec3(vx, vy, min.z + vz));
+        }
+    }
+}
+
+// clears the components with fewer than min_size voxels from the model and
+// returns the number of voxels removed
+int64_t VoxelComponents::remove_smaller(int64_t min_size)
+{
+    std::vector<bool> small(sizes.size());
+    bool any = false;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        small[i] = sizes[i] < min_size;
+        any = any || small[i];
+    }
+    if (!any)
+        return 0;
+    int64_t removed = 0;
+    for (int x = 0; x < file->x_bricks; x++)
+    for (int y = 0; y < file->y_bricks; y++)
+    for (int z = 0; z < file->z_bricks; z++) {
+        const ComponentBrick & brick = bricks[file->get_slot_index(x, y, z)];
+        if (brick.count == 0)
+            continue;
+        ivec3 min, max;
+        file->get_brick_box(x, y, z, min, max);
+        if (brick.uniform) {
+            quint32 c = labels[brick.first];
+            if (!small[c])
+                continue;
+            ivec3 size = max - min;
+            removed += int64_t(size.x) * size.y * size.z;
+            file->fill(min.x, min.y, min.z, max.x, max.y, max.z, VOXEL_AIR);
+            continue;
+        }
+        for (int row = 0; row < BRICK_SIZE * BRICK_SIZE; row++)
+        for (int i = brick.rows[row]; i < brick.rows[row + 1]; i++) {
+            const ComponentRun & run = brick.runs[i];
+            if (!small[labels[brick.first + run.label]])
+                continue;
+            int vx = min.x + (row >> BRICK_SHIFT);
+            int vy = min.y + (row & BRICK_MASK);
+            removed += run.z2 - run.z1;
+            file->fill(vx, vy, min.z + run.z1, vx + 1, vy + 1,
+                       min.z + run.z2, VOXEL_AIR);
+        }
+    }
+    return removed;
+}
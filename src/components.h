@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_COMPONENTS_H
+#define VOXIE_COMPONENTS_H
+
+#include "voxel.h"
+
+#include <vector>
+
+// a run of solid voxels along z in one row of a brick
+class ComponentRun
+{
+public:
+    unsigned char z1, z2;
+    // label within the brick
+    quint16 label;
+};
+
+// the runs of a brick, grouped by row (y + x * BRICK_SIZE). bricks filled
+// with a solid color are a single label without runs.
+class ComponentBrick
+{
+public:
+    quint32 first;
+    quint32 count;
+    bool uniform;
+    std::vector<ComponentRun> runs;
+    std::vector<quint16> rows;
+
+    ComponentBrick();
+};
+
+// labels the groups of connected solid voxels of a model, either through
+// faces (6-connectivity) or also through edges and corners (26). bricks
+// are labeled in parallel, then the labels that touch across brick borders
+// are merged. the result goes stale as soon as the model changes.
+class VoxelComponents
+{
+public:
+    VoxelFile * file;
+    bool diagonal;
+    std::vector<ComponentBrick> bricks;
+    // component of every brick label
+    std::vector<quint32> labels;
+    std::vector<int64_t> sizes;
+    std::vector<ivec3> mins, maxs;
+
+    VoxelComponents();
+    void build(VoxelFile * file, bool diagonal = false);
+    int get_count();
+    int get(int x, int y, int z);
+    void get_voxels(int component, std::vector<ivec3> & out);
+    int64_t remove_smaller(int64_t min_size);
+};
+
+#endif // VOXIE_COMPONENTS_H
@@ -0,0 +1,361 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "diff.h"
+
+#include <QDataStream>
+#include <algorithm>
+#include <string.h>
+
+#define DIFF_MAGIC 0x46445856
+
+// reads n <= BRICK_SIZE world voxels of a row into out, leaving the voxels
+// outside of the model as they are
+static void get_world_row(VoxelFile * file, int x, int y, int z, int n,
+                          unsigned char * out)
+{
+    x -= file->x_offset;
+    y -= file->y_offset;
+    z -= file->z_offset;
+    if (x < 0 || y < 0 || x >= file->x_size || y >= file->y_size)
+        return;
+    int z1 = std::max(z, 0);
+    int z2 = std::min(z + n, file->z_size);
+    if (z1 < z2)
+        file->get_row(x, y, z1, z2 - z1, out + z1 - z);
+}
+
+// color of the world box if it only has one, with the outside of the
+// model being air, or -1
+static int get_world_uniform(VoxelFile * file, const ivec3 & min,
+                             const ivec3 & max)
+{
+    ivec3 offset(file->x_offset, file->y_offset, file->z_offset);
+    ivec3 size(file->x_size, file->y_size, file->z_size);
+    ivec3 a = glm::max(min - offset, ivec3(0));
+    ivec3 b = glm::min(max - offset, size);
+    if (a.x >= b.x || a.y >= b.y || a.z >= b.z)
+        return VOXEL_AIR;
+    int v = file->get_uniform(a, b);
+    if (v != VOXEL_AIR && (a != min - offset || b != max - offset))
+        return -1;
+    return v;
+}
+
+// tests if both files have the same brick at world position p, which has
+// to lie on the brick grid of both. bricks shared between frames match by
+// pointer, others by their packed voxels. voxels of a brick outside of its
+// model are air, so equal bricks hold equal world voxels.
+static bool is_same_brick(VoxelFile * a, VoxelFile * b, const ivec3 & p)
+{
+    ivec3 pa = (p - ivec3(a->x_offset, a->y_offset, a->z_offset)) >>
+               BRICK_SHIFT;
+    ivec3 pb = (p - ivec3(b->x_offset, b->y_offset, b->z_offset)) >>
+               BRICK_SHIFT;
+    if (pa.x < 0 || pa.y < 0 || pa.z < 0 || pa.x >= a->x_bricks ||
+        pa.y >= a->y_bricks || pa.z >= a->z_bricks)
+        return false;
+    if (pb.x < 0 || pb.y < 0 || pb.z < 0 || pb.x >= b->x_bricks ||
+        pb.y >= b->y_bricks || pb.z >= b->z_bricks)
+        return false;
+    VoxelBrick * brick_a = a->get_brick(a->get_slot(pa.x, pa.y, pa.z));
+    VoxelBrick * brick_b = b->get_brick(b->get_slot(pb.x, pb.y, pb.z));
+    if (brick_a == NULL || brick_b == NULL)
+        return false;
+    if (brick_a == brick_b)
+        return true;
+    if (brick_a->bits != brick_b->bits)
+        return false;
+    if (brick_a->bits < 8 && (brick_a->colors != brick_b->colors ||
+        memcmp(brick_a->palette, brick_b->palette, brick_a->colors) != 0))
+        return false;
+    return memcmp(brick_a->data, brick_b->data,
+                  brick_a->get_data_size()) == 0;
+}
+
+// one bit per voxel of two BRICK_SIZE long rows for every kind of change
+static void get_row_changes(const unsigned char * a, const unsigned char * b,
+                            unsigned int * masks)
+{
+    unsigned int changed, a_air, b_air;
+#ifdef VOXIE_SSE2
+    __m128i va = _mm_loadu_si128((const __m128i*)a);
+    __m128i vb = _mm_loadu_si128((const __m128i*)b);
+    __m128i air = _mm_set1_epi8((char)VOXEL_AIR);
+    changed = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF;
+    a_air = _mm_movemask_epi8(_mm_cmpeq_epi8(va, air));
+    b_air = _mm_movemask_epi8(_mm_cmpeq_epi8(vb, air));
+#else
+    changed = a_air = b_air = 0;
+    for (int z = 0; z < BRICK_SIZE; z++) {
+        if (a[z] != b[z])
+            changed |= 1 << z;
+        if (a[z] == VOXEL_AIR)
+            a_air |= 1 << z;
+        if (b[z] == VOXEL_AIR)
+            b_air |= 1 << z;
+    }
+#endif
+    masks[DIFF_ADDED] = changed & a_air;
+    masks[DIFF_REMOVED] = changed & b_air;
+    masks[DIFF_RECOLORED] = changed & ~(a_air | b_air);
+}
+
+static void add_change(VoxelDiff & diff, int x, int y, int z, int type,
+                       unsigned char v)
+{
+    if (type != DIFF_REMOVED)
+        diff.colors.push_back(v);
+    diff.counts[type]++;
+    if (!diff.runs.empty()) {
+        DiffRun & last = diff.runs.back();
+        if (last.x == x && last.y == y && last.type == type &&
+            last.z + last.length == z) {
+            last.length++;
+            return;
+        }
+    }
+    DiffRun run;
+    run.x = x;
+    run.y = y;
+    run.z = z;
+    run.length = 1;
+    run.type = (unsigned char)type;
+    diff.runs.push_back(run);
+}
+
+VoxelDiff::VoxelDiff()
+{
+    clear();
+}
+
+void VoxelDiff::clear()
+{
+    min = max = ivec3(0);
+    runs.clear();
+    colors.clear();
+    counts[DIFF_ADDED] = counts[DIFF_REMOVED] = counts[DIFF_RECOLORED] = 0;
+}
+
+bool VoxelDiff::empty()
+{
+    return runs.empty();
+}
+
+// compares both models over the union of their boxes, in cells on the
+// brick grid of new_file. cells that are a single color in both, or that
+// hold the same brick in both, are skipped without reading their voxels.
+// the runs of one x, y row follow each other, ordered by z.
+void VoxelDiff::build(VoxelFile * old_file, VoxelFile * new_file)
+{
+    clear();
+    ivec3 a_min(old_file->x_offset, old_file->y_offset, old_file->z_offset);
+    ivec3 a_max = a_min + ivec3(old_file->x_size, old_file->y_size,
+                                old_file->z_size);
+    min = ivec3(new_file->x_offset, new_file->y_offset, new_file->z_offset);
+    max = min + ivec3(new_file->x_size, new_file->y_size, new_file->z_size);
+    bool has_old = old_file->get_volume() > 0;
+    bool has_new = new_file->get_volume() > 0;
+    if (!has_old && !has_new)
+        return;
+    ivec3 box_min, box_max;
+    if (!has_old) {
+        box_min = min;
+        box_max = max;
+    } else if (!has_new) {
+        box_min = a_min;
+        box_max = a_max;
+    } else {
+        box_min = glm::min(a_min, min);
+        box_max = glm::max(a_max, max);
+    }
+    ivec3 delta = a_min - min;
+    bool aligned = ((delta.x | delta.y | delta.z) & BRICK_MASK) == 0;
+    ivec3 c1 = (box_min - min) >> BRICK_SHIFT;
+    ivec3 c2 = (box_max - 1 - min) >> BRICK_SHIFT;
+    std::vector<bool> same(c2.z - c1.z + 1);
+    unsigned char row_a[BRICK_SIZE];
+    unsigned char row_b[BRICK_SIZE];
+    unsigned int masks[3];
+    for (int cx = c1.x; cx <= c2.x; cx++)
+    for (int cy = c1.y; cy <= c2.y; cy++) {
+        ivec3 p = min + ivec3(cx, cy, 0) * BRICK_SIZE;
+        int x1 = std::max(p.x, box_min.x);
+        int x2 = std::min(p.x + BRICK_SIZE, box_max.x);
+        int y1 = std::max(p.y, box_min.y);
+        int y2 = std::min(p.y + BRICK_SIZE, box_max.y);
+        bool has_changes = false;
+        for (int cz = c1.z; cz <= c2.z; cz++) {
+            p.z = min.z + cz * BRICK_SIZE;
+            ivec3 cell_min = glm::max(p, box_min);
+            ivec3 cell_max = glm::min(p + BRICK_SIZE, box_max);
+            int v = get_world_uniform(old_file, cell_min, cell_max);
+            bool skip = v != -1 &&
+                        v == get_world_uniform(new_file, cell_min, cell_max);
+            if (!skip && aligned)
+                skip = is_same_brick(old_file, new_file, p);
+            same[cz - c1.z] = skip;
+            has_changes = has_changes || !skip;
+        }
+        if (!has_changes)
+            continue;
+        for (int x = x1; x < x2; x++)
+        for (int y = y1; y < y2; y++)
+        for (int cz = c1.z; cz <= c2.z; cz++) {
+            if (same[cz - c1.z])
+                continue;
+            int z1 = std::max(min.z + cz * BRICK_SIZE, box_min.z);
+            int z2 = std::min(min.z + (cz + 1) * BRICK_SIZE, box_max.z);
+            memset(row_a, VOXEL_AIR, BRICK_SIZE);
+            memset(row_b, VOXEL_AIR, BRICK_SIZE);
+            get_world_row(old_file, x, y, z1, z2 - z1, row_a);
+            get_world_row(new_file, x, y, z1, z2 - z1, row_b);
+            get_row_changes(row_a, row_b, masks);
+            unsigned int changed = masks[DIFF_ADDED] | masks[DIFF_REMOVED] |
+                                   masks[DIFF_RECOLORED];
+            while (changed != 0) {
+                int z = count_trailing_zeros(changed);
+                unsigned int bit = 1 << z;
+                int type;
+                if (masks[DIFF_ADDED] & bit)
+                    type = DIFF_ADDED;
+                else if (masks[DIFF_REMOVED] & bit)
+                    type = DIFF_REMOVED;
+                else
+                    type = DIFF_RECOLORED;
+                add_change(*this, x, y, z1 + z, type, row_b[z]);
+                changed &= changed - 1;
+            }
+        }
+    }
+}
+
+// turns a copy of the old model into the new one
+void VoxelDiff::apply(VoxelFile * file)
+{
+    ivec3 offset(file->x_offset, file->y_offset, file->z_offset);
+    ivec3 size = max - min;
+    file->resize(min.x - offset.x, min.y - offset.y, min.z - offset.z,
+                 size.x, size.y, size.z);
+    size_t color = 0;
+    std::vector<DiffRun>::const_iterator it;
+    for (it = runs.begin(); it != runs.end(); it++) {
+        const DiffRun & run = *it;
+        ivec3 p = ivec3(run.x, run.y, run.z) - min;
+        if (run.type != DIFF_REMOVED) {
+            file->set_row(p.x, p.y, p.z, run.length, &colors[color]);
+            color += run.length;
+            continue;
+        }
+        // removed voxels may lie outside of the new model
+        int z1 = std::max(p.z, 0);
+        int z2 = std::min(p.z + run.length, size.z);
+        if (p.x < 0 || p.y < 0 || p.x >= size.x || p.y >= size.y ||
+            z1 >= z2)
+            continue;
+        file->fill_row(p.x, p.y, z1, z2 - z1, VOXEL_AIR);
+    }
+}
+
+void VoxelDiff::save_fp(QFile & fp)
+{
+    QDataStream stream(&fp);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << quint32(DIFF_MAGIC);
+    stream << qint32(min.x) << qint32(min.y) << qint32(min.z);
+    stream << qint32(max.x) << qint32(max.y) << qint32(max.z);
+    stream << quint32(runs.size()) << quint32(colors.size());
+    std::vector<DiffRun>::const_iterator it;
+    for (it = runs.begin(); it != runs.end(); it++) {
+        stream << it->x << it->y << it->z << it->length;
+        stream << quint8(it->type);
+    }
+    if (!colors.empty())
+        stream.writeRawData((const char*)&colors[0], int(colors.size()));
+}
+
+void VoxelDiff::save(const QString & filename)
+{
+    QFile fp(filename);
+    if (!fp.open(QIODevice::WriteOnly))
+        return;
+    save_fp(fp);
+    fp.close();
+}
+
+bool VoxelDiff::load_fp(QFile & fp)
+{
+    clear();
+    QDataStream stream(&fp);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    quint32 magic, run_count, color_count;
+    qint32 x1, y1, z1, x2, y2, z2;
+    stream >> magic >> x1 >> y1 >> z1 >> x2 >> y2 >> z2;
+    stream >> run_count >> color_count;
+    // every run takes 17 bytes
+    if (stream.status() != QDataStream::Ok || magic != DIFF_MAGIC ||
+        x2 < x1 || y2 < y1 || z2 < z1 ||
+        int64_t(run_count) * 17 + color_count > fp.size())
+        return false;
+    min = ivec3(x1, y1, z1);
+    max = ivec3(x2, y2, z2);
+    runs.resize(run_count);
+    int64_t needed = 0;
+    bool valid = true;
+    for (quint32 i = 0; i < run_count && valid; i++) {
+        DiffRun & run = runs[i];
+        quint8 type;
+        stream >> run.x >> run.y >> run.z >> run.length >> type;
+        run.type = type;
+        if (run.length <= 0 || type > DIFF_RECOLORED) {
+            valid = false;
+            break;
+        }
+        counts[type] += run.length;
+        if (type == DIFF_REMOVED)
+            continue;
+        // added and recolored voxels lie inside the new model
+        if (run.x < x1 || run.y < y1 || run.z < z1 || run.x >= x2 ||
+            run.y >= y2 || int64_t(run.z) + run.length > z2)
+            valid = false;
+        needed += run.length;
+    }
+    colors.resize(color_count);
+    if (valid && color_count > 0)
+        stream.readRawData((char*)&colors[0], int(color_count));
+    if (!valid || stream.status() != QDataStream::Ok ||
+        needed != color_count) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+bool VoxelDiff::load(const QString & filename)
+{
+    QFile fp(filename);
+    if (!fp.open(QIODevice::ReadOnly))
+        return false;
+    bool ret = load_fp(fp);
+    fp.close();
+    return ret;
+}
@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_DIFF_H
+#define VOXIE_DIFF_H
+
+#include "voxel.h"
+
+#include <vector>
+
+// kinds of DiffRun
+#define DIFF_ADDED 0
+#define DIFF_REMOVED 1
+#define DIFF_RECOLORED 2
+
+// changed voxels of one kind along z, starting at world position x, y, z
+class DiffRun
+{
+public:
+    qint32 x, y, z;
+    qint32 length;
+    unsigned char type;
+};
+
+// the changes that turn one model into another, which may be placed and
+// sized differently. runs are ordered by x, y and z, and the new colors of
+// added and recolored runs follow each other in colors.
+class VoxelDiff
+{
+public:
+    // world box of the new model
+    ivec3 min, max;
+    std::vector<DiffRun> runs;
+    std::vector<unsigned char> colors;
+    int64_t counts[3];
+
+    VoxelDiff();
+    void clear();
+    void build(VoxelFile * old_file, VoxelFile * new_file);
+    void apply(VoxelFile * file);
+    bool empty();
+    void save_fp(QFile & fp);
+    void save(const QString & filename);
+    bool load_fp(QFile & fp);
+    bool load(const QString & filename);
+};
+
+#endif // VOXIE_DIFF_H
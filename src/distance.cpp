@@ -0,0 +1,338 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "distance.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <QDataStream>
+
+// squared distance of samples without any feature on their lines so far
+#define SDF_INF 1e20f
+
+static quint16 float_to_half(float f)
+{
+    quint32 bits;
+    memcpy(&bits, &f, sizeof(bits));
+    quint32 sign = (bits >> 16) & 0x8000;
+    int exp = int((bits >> 23) & 0xFF) - 127 + 15;
+    quint32 mant = bits & 0x7FFFFF;
+    if (exp >= 31)
+        return quint16(sign | 0x7C00);
+    if (exp <= 0) {
+        // denormal
+        if (exp < -10)
+            return quint16(sign);
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        quint32 h = mant >> shift;
+        if ((mant >> (shift - 1)) & 1)
+            h++;
+        return quint16(sign | h);
+    }
+    // a carry out of the mantissa correctly bumps the exponent
+    quint32 h = sign | (quint32(exp) << 10) | (mant >> 13);
+    if (mant & 0x1000)
+        h++;
+    return quint16(h);
+}
+
+// first pass, along z. outside gets the squared distance to the nearest
+// solid voxel of the row, inside the one to the nearest air voxel.
+class DistanceRowJob : public ParallelJob
+{
+public:
+    DistanceField * field;
+    VoxelFile * file;
+    int padding;
+    float * outside;
+    float * inside;
+
+    DistanceRowJob(DistanceField * field, VoxelFile * file, int padding,
+                   float * outside, float * inside)
+    : field(field), file(file), padding(padding), outside(outside),
+      inside(inside)
+    {
+    }
+
+    void run(int x)
+    {
+        int n = field->z_size;
+        std::vector<unsigned char> solid(n, 0);
+        std::vector<int> dist(n);
+        for (int y = 0; y < field->y_size; y++) {
+            size_t start = (size_t(x) * field->y_size + y) * n;
+            get_solid(x - padding, y - padding, &solid[0]);
+            transform_row(&solid[0], 1, &dist[0], outside + start);
+            transform_row(&solid[0], 0, &dist[0], inside + start);
+        }
+    }
+
+    // rows outside the model are air
+    void get_solid(int x, int y, unsigned char * out)
+    {
+        memset(out, 0, field->z_size);
+        if (x < 0 || y < 0 || x >= file->x_size || y >= file->y_size)
+            return;
+        out += padding;
+        for (int w = 0; w < file->get_solid_words(); w++) {
+            uint64_t word = file->get_solid_word(x, y, w);
+            int z1 = w << SOLID_WORD_SHIFT;
+            int z2 = std::min(file->z_size, z1 + SOLID_WORD_BITS);
+            for (int z = z1; z < z2; z++)
+                out[z] = (word >> (z - z1)) & 1;
+        }
+    }
+
+    // distance to the nearest feature, in one sweep each way
+    void transform_row(const unsigned char * solid, unsigned char feature,
+                       int * dist, float * out)
+    {
+        int n = field->z_size;
+        int last = -1;
+        for (int z = 0; z < n; z++) {
+            if (solid[z] == feature)
+                last = z;
+            dist[z] = last < 0 ? -1 : z - last;
+        }
+        last = -1;
+        for (int z = n - 1; z >= 0; z--) {
+            if (solid[z] == feature)
+                last = z;
+            if (last >= 0 && (dist[z] < 0 || last - z < dist[z]))
+                dist[z] = last - z;
+            if (dist[z] < 0)
+                out[z] = SDF_INF;
+            else
+                out[z] = float(dist[z]) * float(dist[z]);
+        }
+    }
+};
+
+// the lower envelope of the parabolas f[q] + (p - q)^2 gives the exact
+// squared distance along one more axis (Felzenszwalb and Huttenlocher).
+// v holds the parabolas of the envelope, z the bounds between them.
+static void transform_line(float * line, int n, size_t stride, float * f,
+                           int * v, double * z)
+{
+    float lo = SDF_INF;
+    float hi = 0.0f;
+    for (int q = 0; q < n; q++) {
+        f[q] = line[q * stride];
+        lo = std::min(lo, f[q]);
+        hi = std::max(hi, f[q]);
+    }
+    // lines that are all features or have none stay the same
+    if (hi == 0.0f || lo >= SDF_INF)
+        return;
+    int k = 0;
+    v[0] = 0;
+    z[0] = -SDF_INF;
+    z[1] = SDF_INF;
+    for (int q = 1; q < n; q++) {
+        double s;
+        for (;;) {
+            int p = v[k];
+            s = ((double(f[q]) + double(q) * q) -
+                 (double(f[p]) + double(p) * p)) / (2.0 * (q - p));
+            if (s > z[k])
+                break;
+            k--;
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = SDF_INF;
+    }
+    k = 0;
+    for (int q = 0; q < n; q++) {
+        while (z[k + 1] < q)
+            k++;
+        float d = float(q - v[k]);
+        line[q * stride] = d * d + f[v[k]];
+    }
+}
+
+// the y pass runs over x slabs, the x pass over y slabs
+class DistanceAxisJob : public ParallelJob
+{
+public:
+    DistanceField * field;
+    int axis;
+    float * outside;
+    float * inside;
+
+    DistanceAxisJob(DistanceField * field, int axis, float * outside,
+                    float * inside)
+    : field(field), axis(axis), outside(outside), inside(inside)
+    {
+    }
+
+    void run(int i)
+    {
+        int z_size = field->z_size;
+        int n;
+        size_t stride, start;
+        if (axis == 1) {
+            n = field->y_size;
+            stride = z_size;
+            start = size_t(i) * field->y_size * z_size;
+        } else {
+            n = field->x_size;
+            stride = size_t(field->y_size) * z_size;
+            start = size_t(i) * z_size;
+        }
+        std::vector<float> f(n);
+        std::vector<int> v(n);
+        std::vector<double> z(n + 1);
+        for (int j = 0; j < z_size; j++) {
+            transform_line(outside + start + j, n, stride, &f[0], &v[0],
+                           &z[0]);
+            transform_line(inside + start + j, n, stride, &f[0], &v[0],
+                           &z[0]);
+        }
+    }
+};
+
+// solid voxels are at distance 0 from a solid voxel, air from air
+class DistanceSignJob : public ParallelJob
+{
+public:
+    DistanceField * field;
+    float * inside;
+    float max_distance;
+
+    DistanceSignJob(DistanceField * field, float * inside)
+    : field(field), inside(inside)
+    {
+        max_distance = glm::length(vec3(field->x_size, field->y_size,
+                                        field->z_size));
+    }
+
+    void run(int x)
+    {
+        size_t count = size_t(field->y_size) * field->z_size;
+        float * out = &field->data[size_t(x) * count];
+        const float * in = inside + size_t(x) * count;
+        for (size_t i = 0; i < count; i++) {
+            float d;
+            if (out[i] > 0.0f)
+                d = sqrtf(out[i]) - 0.5f;
+            else
+                d = 0.5f - sqrtf(in[i]);
+            // nothing to measure against in an empty or full field
+            out[i] = std::max(-max_distance, std::min(max_distance, d));
+        }
+    }
+};
+
+// DistanceField
+
+DistanceField::DistanceField()
+: x_size(0), y_size(0), z_size(0), x_offset(0), y_offset(0), z_offset(0)
+{
+}
+
+// the passes run along z, y and x, with both signs at once
+void DistanceField::build(VoxelFile * file, int padding)
+{
+    padding = std::max(0, padding);
+    x_size = file->x_size + padding * 2;
+    y_size = file->y_size + padding * 2;
+    z_size = file->z_size + padding * 2;
+    x_offset = file->x_offset - padding;
+    y_offset = file->y_offset - padding;
+    z_offset = file->z_offset - padding;
+    size_t volume = size_t(x_size) * y_size * z_size;
+    data.resize(volume);
+    std::vector<float> inside(volume);
+
+    DistanceRowJob row_job(this, file, padding, &data[0], &inside[0]);
+    parallel_for(row_job, x_size, file->pager == NULL);
+    DistanceAxisJob y_job(this, 1, &data[0], &inside[0]);
+    parallel_for(y_job, x_size);
+    DistanceAxisJob x_job(this, 0, &data[0], &inside[0]);
+    parallel_for(x_job, y_size);
+    DistanceSignJob sign_job(this, &inside[0]);
+    parallel_for(sign_job, x_size);
+}
+
+float DistanceField::get_max()
+{
+    float value = 0.0f;
+    for (size_t i = 0; i < data.size(); i++)
+        value = std::max(value, fabsf(data[i]));
+    return value;
+}
+
+// the header holds the size and offset of the field, the format and the
+// distance that SDF_BYTE maps to 255, followed by the samples. bytes are
+// 128 at the surface, i.e. distance = (byte - 128) * range / 127.
+void DistanceField::save_fp(QFile & fp, int format)
+{
+    QDataStream stream(&fp);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    float range = std::max(0.5f, get_max());
+    stream << x_size;
+    stream << y_size;
+    stream << z_size;
+    stream << x_offset;
+    stream << y_offset;
+    stream << z_offset;
+    stream << qint32(format);
+    stream << range;
+
+    size_t count = size_t(y_size) * z_size;
+    std::vector<quint16> halfs;
+    std::vector<unsigned char> bytes;
+    for (int x = 0; x < x_size; x++) {
+        const float * slab = &data[size_t(x) * count];
+        if (format == SDF_HALF) {
+            halfs.resize(count);
+            for (size_t i = 0; i < count; i++)
+                halfs[i] = float_to_half(slab[i]);
+            stream.writeRawData((char*)&halfs[0],
+                                int(count * sizeof(quint16)));
+        } else if (format == SDF_BYTE) {
+            bytes.resize(count);
+            float scale = 127.0f / range;
+            for (size_t i = 0; i < count; i++) {
+                int v = 128 + int(floorf(slab[i] * scale + 0.5f));
+                bytes[i] = (unsigned char)std::max(1, std::min(255, v));
+            }
+            stream.writeRawData((char*)&bytes[0], int(count));
+        } else
+            stream.writeRawData((char*)slab, int(count * sizeof(float)));
+    }
+}
+
+void DistanceField::save(const QString & filename, int format)
+{
+    QFile fp(filename);
+    if (!fp.open(QIODevice::WriteOnly))
+        return;
+    save_fp(fp, format);
+    fp.close();
+}
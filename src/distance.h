@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_DISTANCE_H
+#define VOXIE_DISTANCE_H
+
+#include "voxel.h"
+
+#include <vector>
+
+// sample formats of DistanceField::save()
+#define SDF_FLOAT 0
+#define SDF_HALF 1
+#define SDF_BYTE 2
+
+// signed euclidean distance from every voxel center to the surface of a
+// model, negative inside. the surface lies halfway between a solid voxel
+// and an air voxel, so neighbours across it are +-0.5 apart. the field
+// covers the model plus padding voxels of air on every side and is laid
+// out like the model, z fastest.
+class DistanceField
+{
+public:
+    qint32 x_size, y_size, z_size;
+    qint32 x_offset, y_offset, z_offset;
+    std::vector<float> data;
+
+    DistanceField();
+    void build(VoxelFile * file, int padding = 2);
+    float get_max();
+    void save_fp(QFile & fp, int format);
+    void save(const QString & filename, int format);
+
+    inline float get(int x, int y, int z)
+    {
+        return data[(size_t(x) * y_size + y) * z_size + z];
+    }
+};
+
+#endif // VOXIE_DISTANCE_H
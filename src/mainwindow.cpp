@@ -26,6 +26,7 @@ THE SOFTWARE.
 #include "modelproperties.h"
 #include "voxel.h"
 #include "editorcommon.h"
+#include "components.h"
 
 #include <QToolBar>
 #include <QMenuBar>
@@ -40,6 +41,10 @@ THE SOFTWARE.
 #include <QCloseEvent>
 #include <QGLWidget>
 #include <QFileDialog>
+#include <QInputDialog>
+#include <QDirIterator>
+
+#include <limits>
 
 QAction * create_tool_icon(const QString & name, const QString & v,
                            QActionGroup * group, int id)
@@ -55,6 +60,17 @@ QAction * create_tool_icon(const QString & name, const QString & v,
     return action;
 }
 
+QAction * create_brush_action(const QString & name, QActionGroup * group,
+                              int shape)
+{
+    QAction * action = new QAction(name, group);
+    action->setCheckable(true);
+    if (shape == SPHERE_BRUSH)
+        action->setChecked(true);
+    action->setData(shape);
+    return action;
+}
+
 MainWindow::MainWindow(QWidget * parent)
 : QMainWindow(parent)
 {
@@ -85,6 +101,8 @@ MainWindow::MainWindow(QWidget * parent)
         tool_group, PENCIL_EDIT_TOOL));
     tool->addAction(create_tool_icon("Bucket", "editor/bucket_tool.png",
         tool_group, BUCKET_EDIT_TOOL));
+    tool->addAction(create_tool_icon("Brush", "editor/brush_tool.png",
+        tool_group, BRUSH_EDIT_TOOL));
     addToolBar(Qt::LeftToolBarArea, tool);
 
     model_dock = new QDockWidget("Model");
@@ -119,6 +137,37 @@ void MainWindow::create_menus()
     model_menu->addAction(half_size_action);
     model_menu->addAction(optimize_action);
     model_menu->addAction(rotate_action);
+    model_menu->addAction(rotate_x_action);
+    model_menu->addAction(rotate_y_action);
+    model_menu->addSeparator();
+    model_menu->addAction(mirror_x_action);
+    model_menu->addAction(mirror_y_action);
+    model_menu->addAction(mirror_z_action);
+    model_menu->addSeparator();
+    model_menu->addAction(count_islands_action);
+    model_menu->addAction(remove_islands_action);
+    model_menu->addSeparator();
+    model_menu->addAction(union_action);
+    model_menu->addAction(subtract_action);
+    model_menu->addAction(intersect_action);
+    model_menu->addAction(replace_action);
+    model_menu->addSeparator();
+    model_menu->addAction(dilate_action);
+    model_menu->addAction(erode_action);
+    model_menu->addAction(open_shape_action);
+    model_menu->addAction(close_shape_action);
+    model_menu->addAction(hollow_action);
+    model_menu->addAction(shell_action);
+    model_menu->addSeparator();
+    model_menu->addAction(remap_action);
+    model_menu->addAction(remap_directory_action);
+    model_menu->addSeparator();
+    model_menu->addAction(show_changes_action);
+
+    brush_menu = menuBar()->addMenu(tr("&Brush"));
+    brush_menu->addActions(brush_group->actions());
+    brush_menu->addSeparator();
+    brush_menu->addAction(brush_size_action);
 }
 
 bool MainWindow::test_current_window(QWidget * other)
@@ -139,6 +188,18 @@ VoxelEditor * MainWindow::get_voxel_editor()
     return qobject_cast<VoxelEditor*>(get_current_window());
 }
 
+// the editor before the given one in the order of the animation frames,
+// see set_animation_frame()
+VoxelEditor * MainWindow::get_previous_editor(VoxelEditor * editor)
+{
+    QList<QMdiSubWindow*> windows = mdi->subWindowList();
+    for (int i = 1; i < windows.size(); i++) {
+        if (windows[i]->widget() == editor)
+            return qobject_cast<VoxelEditor*>(windows[i - 1]->widget());
+    }
+    return NULL;
+}
+
 VoxelFile * MainWindow::get_voxel()
 {
     VoxelEditor * ed = get_voxel_editor();
@@ -165,9 +226,7 @@ int MainWindow::get_tool()
 
 void MainWindow::model_changed()
 {
-    VoxelEditor * ed = get_voxel_editor();
-    ed->voxel->reset_shape();
-    ed->on_changed();
+    get_voxel_editor()->on_changed();
 }
 
 void MainWindow::create_actions()
@@ -236,6 +295,103 @@ void MainWindow::create_actions()
     connect(rotate_action, SIGNAL(triggered()), this,
         SLOT(rotate()));
 
+    rotate_x_action = new QAction(tr("Rotate 90 degrees around X"), this);
+    connect(rotate_x_action, SIGNAL(triggered()), this,
+        SLOT(rotate_x()));
+
+    rotate_y_action = new QAction(tr("Rotate 90 degrees around Y"), this);
+    connect(rotate_y_action, SIGNAL(triggered()), this,
+        SLOT(rotate_y()));
+
+    mirror_x_action = new QAction(tr("Mirror X"), this);
+    connect(mirror_x_action, SIGNAL(triggered()), this,
+        SLOT(mirror_x()));
+
+    mirror_y_action = new QAction(tr("Mirror Y"), this);
+    connect(mirror_y_action, SIGNAL(triggered()), this,
+        SLOT(mirror_y()));
+
+    mirror_z_action = new QAction(tr("Mirror Z"), this);
+    connect(mirror_z_action, SIGNAL(triggered()), this,
+        SLOT(mirror_z()));
+
+    count_islands_action = new QAction(tr("Count islands"), this);
+    connect(count_islands_action, SIGNAL(triggered()), this,
+        SLOT(count_islands()));
+
+    remove_islands_action = new QAction(tr("Remove floating voxels..."),
+                                        this);
+    connect(remove_islands_action, SIGNAL(triggered()), this,
+        SLOT(remove_islands()));
+
+    union_action = new QAction(tr("Union with model..."), this);
+    connect(union_action, SIGNAL(triggered()), this,
+        SLOT(union_model()));
+
+    subtract_action = new QAction(tr("Subtract model..."), this);
+    connect(subtract_action, SIGNAL(triggered()), this,
+        SLOT(subtract_model()));
+
+    intersect_action = new QAction(tr("Intersect with model..."), this);
+    connect(intersect_action, SIGNAL(triggered()), this,
+        SLOT(intersect_model()));
+
+    replace_action = new QAction(tr("Replace with model..."), this);
+    connect(replace_action, SIGNAL(triggered()), this,
+        SLOT(replace_model()));
+
+    dilate_action = new QAction(tr("Dilate..."), this);
+    connect(dilate_action, SIGNAL(triggered()), this,
+        SLOT(dilate_model()));
+
+    erode_action = new QAction(tr("Erode..."), this);
+    connect(erode_action, SIGNAL(triggered()), this,
+        SLOT(erode_model()));
+
+    open_shape_action = new QAction(tr("Remove thin parts..."), this);
+    connect(open_shape_action, SIGNAL(triggered()), this,
+        SLOT(open_shape()));
+
+    close_shape_action = new QAction(tr("Fill gaps..."), this);
+    connect(close_shape_action, SIGNAL(triggered()), this,
+        SLOT(close_shape()));
+
+    hollow_action = new QAction(tr("Hollow..."), this);
+    connect(hollow_action, SIGNAL(triggered()), this,
+        SLOT(hollow_model()));
+
+    shell_action = new QAction(tr("Shell..."), this);
+    connect(shell_action, SIGNAL(triggered()), this,
+        SLOT(shell_model()));
+
+    remap_action = new QAction(tr("Remap colors"), this);
+    connect(remap_action, SIGNAL(triggered()), this,
+        SLOT(remap_colors()));
+
+    remap_directory_action = new QAction(
+        tr("Remap colors in directory..."), this);
+    connect(remap_directory_action, SIGNAL(triggered()), this,
+        SLOT(remap_directory()));
+
+    show_changes_action = new QAction(
+        tr("Show changes to previous frame"), this);
+    show_changes_action->setCheckable(true);
+    connect(show_changes_action, SIGNAL(triggered()), this,
+        SLOT(show_changes()));
+
+    // brush menu
+
+    brush_group = new QActionGroup(this);
+    create_brush_action(tr("Sphere"), brush_group, SPHERE_BRUSH);
+    create_brush_action(tr("Box"), brush_group, BOX_BRUSH);
+    create_brush_action(tr("Cylinder"), brush_group, CYLINDER_BRUSH);
+    create_brush_action(tr("Line"), brush_group, LINE_BRUSH);
+    connect(brush_group, SIGNAL(triggered(QAction*)), this,
+        SLOT(set_brush_shape(QAction*)));
+
+    brush_size_action = new QAction(tr("Brush size..."), this);
+    connect(brush_size_action, SIGNAL(triggered()), this,
+        SLOT(set_brush_size()));
 }
 
 void MainWindow::closeEvent(QCloseEvent * event)
@@ -356,6 +512,236 @@ void MainWindow::rotate()
     model_changed();
 }
 
+void MainWindow::orient(const VoxelOrientation & orientation)
+{
+    VoxelFile * voxel = get_voxel();
+    voxel->orient(orientation);
+    model_properties->update_controls();
+    model_changed();
+}
+
+void MainWindow::rotate_x()
+{
+    orient(VoxelOrientation::rotation(0));
+}
+
+void MainWindow::rotate_y()
+{
+    orient(VoxelOrientation::rotation(1));
+}
+
+void MainWindow::mirror_x()
+{
+    orient(VoxelOrientation::mirror(0));
+}
+
+void MainWindow::mirror_y()
+{
+    orient(VoxelOrientation::mirror(1));
+}
+
+void MainWindow::mirror_z()
+{
+    orient(VoxelOrientation::mirror(2));
+}
+
+// the other model is placed by its offset, like in a map
+void MainWindow::combine_model(int op)
+{
+    QString name = get_model_name(this, false);
+    if (name.isEmpty())
+        return;
+    VoxelFile other;
+    if (!other.load(name))
+        return;
+    VoxelFile * voxel = get_voxel();
+    voxel->combine(other, op);
+    model_properties->update_controls();
+    model_changed();
+}
+
+void MainWindow::union_model()
+{
+    combine_model(CSG_UNION);
+}
+
+void MainWindow::subtract_model()
+{
+    combine_model(CSG_SUBTRACT);
+}
+
+void MainWindow::intersect_model()
+{
+    combine_model(CSG_INTERSECT);
+}
+
+void MainWindow::replace_model()
+{
+    combine_model(CSG_REPLACE);
+}
+
+// asks for the radius or thickness of a morphological operation. new
+// voxels from dilate, close and shell take the palette color.
+bool MainWindow::get_morph_size(const QString & title, const QString & label,
+                                int & size)
+{
+    bool ok;
+    size = QInputDialog::getInt(this, title, label, 1, 1, 256, 1, &ok);
+    return ok;
+}
+
+void MainWindow::dilate_model()
+{
+    int radius;
+    if (!get_morph_size(tr("Dilate"), tr("Radius:"), radius))
+        return;
+    get_voxel()->dilate(radius, get_palette_index());
+    model_properties->update_controls();
+    model_changed();
+}
+
+void MainWindow::erode_model()
+{
+    int radius;
+    if (!get_morph_size(tr("Erode"), tr("Radius:"), radius))
+        return;
+    get_voxel()->erode(radius);
+    model_changed();
+}
+
+void MainWindow::open_shape()
+{
+    int radius;
+    if (!get_morph_size(tr("Remove thin parts"), tr("Radius:"), radius))
+        return;
+    get_voxel()->open(radius);
+    model_changed();
+}
+
+void MainWindow::close_shape()
+{
+    int radius;
+    if (!get_morph_size(tr("Fill gaps"), tr("Radius:"), radius))
+        return;
+    get_voxel()->close(radius, get_palette_index());
+    model_properties->update_controls();
+    model_changed();
+}
+
+void MainWindow::hollow_model()
+{
+    int thickness;
+    if (!get_morph_size(tr("Hollow"), tr("Wall thickness:"), thickness))
+        return;
+    get_voxel()->hollow(thickness);
+    model_changed();
+}
+
+void MainWindow::shell_model()
+{
+    int thickness;
+    if (!get_morph_size(tr("Shell"), tr("Shell thickness:"), thickness))
+        return;
+    get_voxel()->shell(thickness, get_palette_index());
+    model_properties->update_controls();
+    model_changed();
+}
+
+// the remap table is set up in the palette editor. with a selection, only
+// the selected voxels are remapped.
+void MainWindow::remap_colors()
+{
+    VoxelEditor * editor = get_voxel_editor();
+    if (editor == NULL)
+        return;
+    const unsigned char * table = palette_editor->remap;
+    if (!editor->remap_selected(table))
+        editor->voxel->remap(table);
+    model_changed();
+}
+
+// remaps and saves every model in a directory and its subdirectories
+void MainWindow::remap_directory()
+{
+    QString dir = QFileDialog::getExistingDirectory(this,
+        tr("Remap colors in directory"));
+    if (dir.isEmpty())
+        return;
+    QDirIterator it(dir, QStringList() << "*.vxi", QDir::Files,
+                    QDirIterator::Subdirectories);
+    int count = 0;
+    while (it.hasNext()) {
+        QString name = it.next();
+        VoxelFile file;
+        if (!file.load(name))
+            continue;
+        file.remap(palette_editor->remap);
+        file.save(name);
+        count++;
+    }
+    set_status(tr("Remapped %1 models").arg(count).toStdString());
+}
+
+void MainWindow::show_changes()
+{
+    VoxelEditor * editor = get_voxel_editor();
+    if (editor != NULL)
+        editor->update();
+}
+
+void MainWindow::set_brush_shape(QAction * action)
+{
+    brush.shape = action->data().toInt();
+}
+
+// brushes take a radius along every axis, which makes spheres ellipsoids.
+// cylinders use z for half their height, lines only use x.
+void MainWindow::set_brush_size()
+{
+    QString labels[] = {tr("Radius along X:"), tr("Radius along Y:"),
+                        tr("Radius along Z:")};
+    ivec3 radius = brush.radius;
+    for (int i = 0; i < 3; i++) {
+        bool ok;
+        radius[i] = QInputDialog::getInt(this, tr("Brush size"), labels[i],
+            radius[i], 0, 256, 1, &ok);
+        if (!ok)
+            return;
+    }
+    brush.radius = radius;
+}
+
+void MainWindow::resize_brush(int amount)
+{
+    brush.radius = glm::clamp(brush.radius + amount, ivec3(0), ivec3(256));
+    set_status(tr("Brush radius %1, %2, %3").arg(brush.radius.x)
+        .arg(brush.radius.y).arg(brush.radius.z).toStdString());
+}
+
+// islands are groups of voxels that touch through faces, edges or corners
+void MainWindow::count_islands()
+{
+    VoxelComponents components;
+    components.build(get_voxel(), true);
+    set_status(tr("%1 islands").arg(components.get_count()).toStdString());
+}
+
+void MainWindow::remove_islands()
+{
+    bool ok;
+    int size = QInputDialog::getInt(this, tr("Remove floating voxels"),
+        tr("Remove islands with fewer voxels than:"), 8, 1,
+        std::numeric_limits<int>::max(), 1, &ok);
+    if (!ok)
+        return;
+    VoxelFile * voxel = get_voxel();
+    VoxelComponents components;
+    components.build(voxel, true);
+    qint64 removed = components.remove_smaller(size);
+    set_status(tr("Removed %1 voxels").arg(removed).toStdString());
+    model_changed();
+}
+
 void MainWindow::set_animation_frame(bool forward)
 {
     VoxelEditor * old = get_voxel_editor();
@@ -21,12 +21,14 @@ THE SOFTWARE.
 */
 
 #include "glm.h"
+#include "brush.h"
 
 #include <QMainWindow>
 #include <QAction>
 #include <QGLFormat>
 
 class VoxelFile;
+class VoxelOrientation;
 class VoxelEditor;
 class Map;
 class MapEditor;
@@ -45,6 +47,7 @@ class QGLWidget;
 #define BLOCK_EDIT_TOOL 1
 #define PENCIL_EDIT_TOOL 2
 #define BUCKET_EDIT_TOOL 3
+#define BRUSH_EDIT_TOOL 4
 
 class MainWindow : public QMainWindow
 {
@@ -54,12 +57,15 @@ public:
     PaletteEditor * palette_editor;
     ModelProperties * model_properties;
     QActionGroup * tool_group;
+    QActionGroup * brush_group;
+    VoxelBrush brush;
     QGLFormat gl_format;
     QGLWidget * shared_gl;
 
     QMdiArea * mdi;
     QMenu * file_menu;
     QMenu * model_menu;
+    QMenu * brush_menu;
 
     QAction * new_model_action;
     QAction * open_model_action;
@@ -72,6 +78,27 @@ public:
     QAction * half_size_action;
     QAction * optimize_action;
     QAction * rotate_action;
+    QAction * rotate_x_action;
+    QAction * rotate_y_action;
+    QAction * mirror_x_action;
+    QAction * mirror_y_action;
+    QAction * mirror_z_action;
+    QAction * count_islands_action;
+    QAction * remove_islands_action;
+    QAction * union_action;
+    QAction * subtract_action;
+    QAction * intersect_action;
+    QAction * replace_action;
+    QAction * dilate_action;
+    QAction * erode_action;
+    QAction * open_shape_action;
+    QAction * close_shape_action;
+    QAction * hollow_action;
+    QAction * shell_action;
+    QAction * remap_action;
+    QAction * remap_directory_action;
+    QAction * show_changes_action;
+    QAction * brush_size_action;
 
     QDockWidget * model_dock;
     QDockWidget * palette_dock;
@@ -86,12 +113,18 @@ public:
     int get_tool();
     QWidget * get_current_window();
     VoxelEditor * get_voxel_editor();
+    VoxelEditor * get_previous_editor(VoxelEditor * editor);
     bool test_current_window(QWidget * other);
     ~MainWindow();
 
     void model_changed();
     void set_status(const std::string & text);
     void set_animation_frame(bool forward);
+    void orient(const VoxelOrientation & orientation);
+    void combine_model(int op);
+    bool get_morph_size(const QString & title, const QString & label,
+                        int & size);
+    void resize_brush(int amount);
 
 private slots:
     void on_window_change(QMdiSubWindow * w);
@@ -106,4 +139,26 @@ private slots:
     void half_size();
     void optimize();
     void rotate();
+    void rotate_x();
+    void rotate_y();
+    void mirror_x();
+    void mirror_y();
+    void mirror_z();
+    void count_islands();
+    void remove_islands();
+    void union_model();
+    void subtract_model();
+    void intersect_model();
+    void replace_model();
+    void dilate_model();
+    void erode_model();
+    void open_shape();
+    void close_shape();
+    void hollow_model();
+    void shell_model();
+    void remap_colors();
+    void remap_directory();
+    void show_changes();
+    void set_brush_shape(QAction * action);
+    void set_brush_size();
 };
\ No newline at end of file
@@ -26,6 +26,11 @@ THE SOFTWARE.
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <algorithm>
+#include "types.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #define PI_F (float)(M_PI)
 
@@ -173,4 +178,43 @@ inline unsigned int prev_pow2(unsigned int x)
     return x - (x >> 1);
 }
 
+inline int count_trailing_zeros(uint64_t v)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return int(i);
+#elif defined(_MSC_VER)
+    unsigned long i;
+    if (_BitScanForward(&i, (unsigned long)v))
+        return int(i);
+    _BitScanForward(&i, (unsigned long)(v >> 32));
+    return int(i) + 32;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+inline int get_highest_bit(unsigned int v)
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanReverse(&i, v);
+    return int(i);
+#else
+    return 31 - __builtin_clz(v);
+#endif
+}
+
+inline int count_bits(uint64_t v)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    return int(__popcnt64(v));
+#elif defined(_MSC_VER)
+    return int(__popcnt((unsigned int)v) + __popcnt((unsigned int)(v >> 32)));
+#else
+    return __builtin_popcountll(v);
+#endif
+}
+
 #endif // VOXIE_MATHCOMMON_H
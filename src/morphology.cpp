@@ -0,0 +1,236 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "morphology.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <string.h>
+
+// combines the words of a neighbouring row into out. missing neighbours
+// are air.
+static inline void combine_words(uint64_t * out, const uint64_t * in, int n,
+                                 bool grow)
+{
+    if (in == NULL) {
+        if (!grow)
+            memset(out, 0, n * sizeof(uint64_t));
+        return;
+    }
+    int i = 0;
+#ifdef VOXIE_SSE2
+    for (; i + 2 <= n; i += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(out + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(in + i));
+        a = grow ? _mm_or_si128(a, b) : _mm_and_si128(a, b);
+        _mm_storeu_si128((__m128i*)(out + i), a);
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = grow ? out[i] | in[i] : out[i] & in[i];
+}
+
+// one step of a separable pass. every voxel is combined with the two
+// voxels 'shift' away along the axis, one x slab per job piece.
+class MaskPassJob : public ParallelJob
+{
+public:
+    VoxelMask * src;
+    VoxelMask * dst;
+    int axis;
+    int shift;
+    bool grow;
+
+    MaskPassJob(VoxelMask * src, VoxelMask * dst, int axis, int shift,
+                bool grow)
+    : src(src), dst(dst), axis(axis), shift(shift), grow(grow)
+    {
+    }
+
+    void run(int x)
+    {
+        int n = src->words;
+        for (int y = 0; y < src->y_size; y++) {
+            uint64_t * out = dst->get_row(x, y);
+            const uint64_t * in = src->get_row(x, y);
+            if (axis == 2) {
+                shift_row(out, in);
+                continue;
+            }
+            memcpy(out, in, n * sizeof(uint64_t));
+            const uint64_t * lo = NULL;
+            const uint64_t * hi = NULL;
+            if (axis == 0) {
+                if (x - shift >= 0)
+                    lo = src->get_row(x - shift, y);
+                if (x + shift < src->x_size)
+                    hi = src->get_row(x + shift, y);
+            } else {
+                if (y - shift >= 0)
+                    lo = src->get_row(x, y - shift);
+                if (y + shift < src->y_size)
+                    hi = src->get_row(x, y + shift);
+            }
+            combine_words(out, lo, n, grow);
+            combine_words(out, hi, n, grow);
+        }
+    }
+
+    // z rows move through whole words at once, carrying across words
+    void shift_row(uint64_t * out, const uint64_t * in)
+    {
+        int n = src->words;
+        int s = shift;
+        for (int w = 0; w < n; w++) {
+            uint64_t v = in[w];
+            uint64_t up = v << s;
+            uint64_t down = v >> s;
+            if (w > 0)
+                up |= in[w - 1] >> (SOLID_WORD_BITS - s);
+            if (w + 1 < n)
+                down |= in[w + 1] << (SOLID_WORD_BITS - s);
+            out[w] = grow ? v | up | down : v & up & down;
+        }
+        out[n - 1] &= src->get_last_word();
+    }
+};
+
+class MaskBuildJob : public ParallelJob
+{
+public:
+    VoxelMask * mask;
+    VoxelFile * file;
+
+    MaskBuildJob(VoxelMask * mask, VoxelFile * file)
+    : mask(mask), file(file)
+    {
+    }
+
+    void run(int x)
+    {
+        for (int y = 0; y < mask->y_size; y++) {
+            uint64_t * row = mask->get_row(x, y);
+            for (int w = 0; w < mask->words; w++)
+                row[w] = file->get_solid_word(x, y, w);
+        }
+    }
+};
+
+// box shaped passes of radius a and b add up to one of radius a + b, so
+// the radius is covered in steps that double up to SOLID_WORD_BITS / 2
+static void run_passes(VoxelMask & mask, int radius, bool grow,
+                       bool threaded)
+{
+    VoxelMask tmp;
+    tmp.reset(mask.x_size, mask.y_size, mask.z_size);
+    int step = 1;
+    while (radius > 0) {
+        int shift = std::min(step, radius);
+        for (int axis = 0; axis < 3; axis++) {
+            MaskPassJob job(&mask, &tmp, axis, shift, grow);
+            parallel_for(job, mask.x_size, threaded);
+            std::swap(mask.data, tmp.data);
+        }
+        radius -= shift;
+        step = std::min(step * 2, SOLID_WORD_BITS / 2);
+    }
+}
+
+// VoxelMask
+
+VoxelMask::VoxelMask()
+: x_size(0), y_size(0), z_size(0), words(0)
+{
+}
+
+void VoxelMask::reset(int x_size, int y_size, int z_size)
+{
+    this->x_size = x_size;
+    this->y_size = y_size;
+    this->z_size = z_size;
+    words = (z_size + SOLID_WORD_BITS - 1) >> SOLID_WORD_SHIFT;
+    data.assign(size_t(x_size) * y_size * words, 0);
+}
+
+void VoxelMask::build(VoxelFile * file)
+{
+    reset(file->x_size, file->y_size, file->z_size);
+    MaskBuildJob job(this, file);
+    parallel_for(job, x_size, file->pager == NULL);
+}
+
+// grows the mask by a cube of radius voxels around every set voxel
+void VoxelMask::dilate(int radius)
+{
+    run_passes(*this, radius, true, true);
+}
+
+// keeps the voxels whose cube of radius voxels around them is all set.
+// everything outside the mask counts as clear.
+void VoxelMask::erode(int radius)
+{
+    run_passes(*this, radius, false, true);
+}
+
+void VoxelMask::subtract(const VoxelMask & other)
+{
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] &= ~other.data[i];
+}
+
+// makes the model match the mask. solid is the mask the model has now.
+// voxels that leave the mask become air and the ones that join it get v.
+void VoxelMask::apply(VoxelFile * file, const VoxelMask & solid,
+                      unsigned char v)
+{
+    std::vector<unsigned char> row(z_size);
+    for (int x = 0; x < x_size; x++)
+    for (int y = 0; y < y_size; y++) {
+        const uint64_t * target = get_row(x, y);
+        const uint64_t * old = solid.get_row(x, y);
+        int w1 = 0;
+        while (w1 < words && target[w1] == old[w1])
+            w1++;
+        if (w1 == words)
+            continue;
+        int w2 = words;
+        while (target[w2 - 1] == old[w2 - 1])
+            w2--;
+        int z1 = w1 << SOLID_WORD_SHIFT;
+        int z2 = std::min(z_size, w2 << SOLID_WORD_SHIFT);
+        unsigned char * out = &row[0] - z1;
+        file->get_row(x, y, z1, z2 - z1, &row[0]);
+        for (int w = w1; w < w2; w++) {
+            uint64_t diff = target[w] ^ old[w];
+            while (diff != 0) {
+                int bit = count_trailing_zeros(diff);
+                diff &= diff - 1;
+                int z = (w << SOLID_WORD_SHIFT) + bit;
+                if (target[w] & (uint64_t(1) << bit))
+                    out[z] = v;
+                else
+                    out[z] = VOXEL_AIR;
+            }
+        }
+        file->set_row(x, y, z1, z2 - z1, &row[0]);
+    }
+}
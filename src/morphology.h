@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_MORPHOLOGY_H
+#define VOXIE_MORPHOLOGY_H
+
+#include "voxel.h"
+
+#include <vector>
+
+// one bit per voxel, z rows packed into 64 bit words like
+// VoxelFile::get_solid_word(). bits past z_size are always clear.
+class VoxelMask
+{
+public:
+    int x_size, y_size, z_size;
+    int words;
+    std::vector<uint64_t> data;
+
+    VoxelMask();
+    void reset(int x_size, int y_size, int z_size);
+    void build(VoxelFile * file);
+    void dilate(int radius);
+    void erode(int radius);
+    void subtract(const VoxelMask & other);
+    void apply(VoxelFile * file, const VoxelMask & solid, unsigned char v);
+
+    inline uint64_t * get_row(int x, int y)
+    {
+        return &data[(size_t(x) * y_size + y) * words];
+    }
+
+    inline const uint64_t * get_row(int x, int y) const
+    {
+        return &data[(size_t(x) * y_size + y) * words];
+    }
+
+    inline uint64_t get_last_word() const
+    {
+        int end = z_size - ((words - 1) << SOLID_WORD_SHIFT);
+        if (end >= SOLID_WORD_BITS)
+            return ~uint64_t(0);
+        return (uint64_t(1) << end) - 1;
+    }
+};
+
+#endif // VOXIE_MORPHOLOGY_H
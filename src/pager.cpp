@@ -0,0 +1,197 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "pager.h"
+
+#include <algorithm>
+#include <climits>
+
+struct BrickAge
+{
+    quint32 age;
+    size_t index;
+
+    BrickAge(quint32 age, size_t index)
+    : age(age), index(index)
+    {
+    }
+
+    // oldest first
+    bool operator<(const BrickAge & other) const
+    {
+        return age > other.age;
+    }
+};
+
+BrickPager::BrickPager(VoxelFile * file, int64_t max_bytes)
+: file(file), budget(0), swap_open(false), pages(0)
+{
+    set_limit(max_bytes);
+}
+
+void BrickPager::set_limit(int64_t max_bytes)
+{
+    this->max_bytes = max_bytes;
+    // assume the widest encoding
+    int64_t count = max_bytes / int64_t(sizeof(VoxelBrick) + BRICK_VOLUME);
+    max_bricks = int(std::max<int64_t>(16, std::min<int64_t>(INT_MAX,
+                                                             count)));
+    budget = 0;
+}
+
+// called before a brick of the file is paged in or allocated
+void BrickPager::reserve()
+{
+    if (--budget < 0)
+        evict();
+    file->page_clock++;
+}
+
+void BrickPager::evict()
+{
+    std::vector<BrickAge> ages;
+    int resident = 0;
+    quint32 clock = file->page_clock;
+    BrickSlots & bricks = file->bricks;
+    for (size_t i = 0; i < bricks.size(); i++) {
+        VoxelBrick * brick = bricks[i].brick;
+        if (brick == NULL)
+            continue;
+        resident++;
+        // bricks used since the last allocation may still be referenced
+        if (brick->stamp == clock)
+            continue;
+        ages.push_back(BrickAge(clock - brick->stamp, i));
+    }
+    // evict down to 3/4 of the limit so the scan above stays rare
+    int target = max_bricks - max_bricks / 4;
+    int count = std::min(resident - target, int(ages.size()));
+    if (count > 0) {
+        std::nth_element(ages.begin(), ages.begin() + count, ages.end());
+        for (int i = 0; i < count; i++) {
+            if (page_out(ages[i].index))
+                resident--;
+        }
+    }
+    budget = std::max(max_bricks - resident, max_bricks / 4);
+}
+
+bool BrickPager::page_out(size_t index)
+{
+    int z = int(index % file->z_bricks);
+    int y = int((index / file->z_bricks) % file->y_bricks);
+    int x = int(index / file->z_bricks / file->y_bricks);
+    // single-color bricks are just tagged instead
+    if (file->compact_brick(x, y, z))
+        return true;
+    BrickSlot & slot = file->bricks[index];
+    qint32 page = get_page();
+    if (page < 0)
+        return false;
+    unsigned char data[BRICK_VOLUME];
+    slot.brick->unpack(data);
+    if (!write_page(page, data)) {
+        free_pages.push_back(page);
+        return false;
+    }
+    release_brick(slot.brick);
+    slot.brick = NULL;
+    slot.page = page;
+    // read as air if the page cannot be read back
+    slot.fill = VOXEL_AIR;
+    return true;
+}
+
+// returns NULL if the page cannot be read. the slot keeps the page, so the
+// brick is not lost and the next access tries again.
+VoxelBrick * BrickPager::page_in(BrickSlot & slot)
+{
+    reserve();
+    unsigned char data[BRICK_VOLUME];
+    if (!read_page(slot.page, data)) {
+        budget++;
+        return NULL;
+    }
+    VoxelBrick * brick = new VoxelBrick;
+    brick->pack(data);
+    brick->stamp = file->page_clock;
+    free_pages.push_back(slot.page);
+    slot.page = -1;
+    slot.brick = brick;
+    return brick;
+}
+
+// copies a page of another pager into this one, returns -1 on failure
+qint32 BrickPager::copy_page(BrickPager & other, qint32 page)
+{
+    unsigned char data[BRICK_VOLUME];
+    if (!other.read_page(page, data))
+        return -1;
+    qint32 new_page = get_page();
+    if (new_page < 0)
+        return -1;
+    if (!write_page(new_page, data)) {
+        free_pages.push_back(new_page);
+        return -1;
+    }
+    return new_page;
+}
+
+// forgets all pages, for when the slots of the file are reset
+void BrickPager::clear()
+{
+    pages = 0;
+    free_pages.clear();
+    budget = 0;
+}
+
+bool BrickPager::open_swap()
+{
+    if (!swap_open)
+        swap_open = swap.open();
+    return swap_open;
+}
+
+qint32 BrickPager::get_page()
+{
+    if (!open_swap())
+        return -1;
+    if (free_pages.empty())
+        return pages++;
+    qint32 page = free_pages.back();
+    free_pages.pop_back();
+    return page;
+}
+
+bool BrickPager::write_page(qint32 page, const unsigned char * data)
+{
+    if (!swap.seek(qint64(page) * BRICK_VOLUME))
+        return false;
+    return swap.write((const char*)data, BRICK_VOLUME) == BRICK_VOLUME;
+}
+
+bool BrickPager::read_page(qint32 page, unsigned char * data)
+{
+    if (!swap.seek(qint64(page) * BRICK_VOLUME))
+        return false;
+    return swap.read((char*)data, BRICK_VOLUME) == BRICK_VOLUME;
+}
@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_PAGER_H
+#define VOXIE_PAGER_H
+
+#include "voxel.h"
+
+#include <QTemporaryFile>
+
+// keeps at most max_bricks bricks of a VoxelFile in memory, and writes the
+// least recently used ones to a swap file. not thread safe.
+class BrickPager
+{
+public:
+    VoxelFile * file;
+    int64_t max_bytes;
+    int max_bricks;
+    // number of allocations left before the resident bricks are counted
+    int budget;
+    QTemporaryFile swap;
+    bool swap_open;
+    qint32 pages;
+    std::vector<qint32> free_pages;
+
+    BrickPager(VoxelFile * file, int64_t max_bytes);
+    void set_limit(int64_t max_bytes);
+    void reserve();
+    void evict();
+    bool page_out(size_t index);
+    VoxelBrick * page_in(BrickSlot & slot);
+    qint32 copy_page(BrickPager & other, qint32 page);
+    void clear();
+    bool open_swap();
+    qint32 get_page();
+    bool write_page(qint32 page, const unsigned char * data);
+    bool read_page(qint32 page, unsigned char * data);
+};
+
+#endif // VOXIE_PAGER_H
@@ -28,6 +28,7 @@ THE SOFTWARE.
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QSpinBox>
+#include <QPushButton>
 #include <QKeyEvent>
 #include <QPainter>
 #include <QLabel>
@@ -240,6 +241,30 @@ void PaletteGrid::paintEvent(QPaintEvent * event)
         } else {
             p.fillRect(x1, y1, x_size, y_size, QColor(r, g, b));
         }
+
+        // remapped colors show their target in a corner
+        unsigned char target = ((PaletteEditor*)parentWidget())->remap[i];
+        if (i != VOXEL_AIR && voxel != NULL && target != i) {
+            const int marker = 8;
+            int y2 = y1 + y_size - marker - 2;
+            p.fillRect(x1 + 2, y2, marker, marker, Qt::black);
+            QColor target_color(20, 20, 20);
+            if (target != VOXEL_AIR) {
+                RGBColor & color = global_palette[target];
+                target_color = QColor(color.r, color.g, color.b);
+            }
+            p.fillRect(x1 + 3, y2 + 1, marker - 2, marker - 2,
+                       target_color);
+        }
+
+        // mark colors that are used by the current model
+        if (i == VOXEL_AIR || voxel == NULL || voxel->color_counts[i] <= 0)
+            continue;
+        const int marker = 4;
+        p.fillRect(x1 + x_size - marker - 2, y1 + 2, marker, marker,
+                   Qt::black);
+        p.fillRect(x1 + x_size - marker - 1, y1 + 3, marker - 2, marker - 2,
+                   Qt::white);
     }
 }
 
@@ -316,8 +341,11 @@ QSpinBox * PaletteEditor::create_color_spinbox()
 }
 
 PaletteEditor::PaletteEditor(MainWindow * parent)
-: QWidget(parent), window(parent), ignore_rgb(false)
+: QWidget(parent), window(parent), ignore_rgb(false), remap_source(-1)
 {
+    for (int i = 0; i < 256; i++)
+        remap[i] = (unsigned char)i;
+
     QVBoxLayout * layout = new QVBoxLayout(this);
 
     color_space = new ColorSpace(this);
@@ -347,6 +375,20 @@ PaletteEditor::PaletteEditor(MainWindow * parent)
 
     layout->addLayout(name_layout);
 
+    QHBoxLayout * remap_layout = new QHBoxLayout;
+    remap_layout->addWidget(create_label("Remap"));
+    remap_from = new QPushButton("From");
+    connect(remap_from, SIGNAL(clicked(bool)), SLOT(set_remap_source()));
+    remap_layout->addWidget(remap_from);
+    remap_to = new QPushButton("To");
+    connect(remap_to, SIGNAL(clicked(bool)), SLOT(set_remap_target()));
+    remap_layout->addWidget(remap_to);
+    remap_clear = new QPushButton("Clear");
+    connect(remap_clear, SIGNAL(clicked(bool)), SLOT(clear_remap()));
+    remap_layout->addWidget(remap_clear);
+
+    layout->addLayout(remap_layout);
+
     setLayout(layout);
 
     set_current();
@@ -423,3 +465,32 @@ void PaletteEditor::name_changed()
 {
     palette_names[grid->palette_index] = name->text();
 }
+
+// remap entries are made by picking the color to replace with From, then
+// the color to replace it with and To. the table is applied through the
+// model menu.
+void PaletteEditor::set_remap_source()
+{
+    remap_source = grid->palette_index;
+    window->set_status(tr("Remap color %1 to...").arg(remap_source)
+        .toStdString());
+}
+
+void PaletteEditor::set_remap_target()
+{
+    if (remap_source < 0 || remap_source == VOXEL_AIR)
+        return;
+    remap[remap_source] = (unsigned char)grid->palette_index;
+    window->set_status(tr("Color %1 remaps to %2").arg(remap_source)
+        .arg(grid->palette_index).toStdString());
+    remap_source = -1;
+    grid->update();
+}
+
+void PaletteEditor::clear_remap()
+{
+    for (int i = 0; i < 256; i++)
+        remap[i] = (unsigned char)i;
+    remap_source = -1;
+    grid->update();
+}
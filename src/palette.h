@@ -28,6 +28,7 @@ THE SOFTWARE.
 class MainWindow;
 class PaletteGrid;
 class QSpinBox;
+class QPushButton;
 
 class ColorSpace : public QWidget
 {
@@ -93,7 +94,13 @@ public:
     QSpinBox * g_edit;
     QSpinBox * b_edit;
     QLineEdit * name;
+    QPushButton * remap_from;
+    QPushButton * remap_to;
+    QPushButton * remap_clear;
     bool ignore_rgb;
+    // color remap table, see VoxelFile::remap()
+    unsigned char remap[256];
+    int remap_source;
 
     PaletteEditor(MainWindow * parent);
     int get_palette_index();
@@ -106,4 +113,7 @@ public:
 public slots:
     void rgb_changed();
     void name_changed();
+    void set_remap_source();
+    void set_remap_target();
+    void clear_remap();
 };
\ No newline at end of file
@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+static void run_pieces(ParallelJob & job, QAtomicInt & next, int count)
+{
+    while (true) {
+        int i = next.fetchAndAddRelaxed(1);
+        if (i >= count)
+            break;
+        job.run(i);
+    }
+}
+
+class ParallelWorker : public QRunnable
+{
+public:
+    ParallelJob * job;
+    QAtomicInt * next;
+    int count;
+    QSemaphore * done;
+
+    ParallelWorker(ParallelJob * job, QAtomicInt * next, int count,
+                   QSemaphore * done)
+    : job(job), next(next), count(count), done(done)
+    {
+    }
+
+    void run()
+    {
+        run_pieces(*job, *next, count);
+        done->release();
+    }
+};
+
+void parallel_for(ParallelJob & job, int count, bool threaded)
+{
+    if (count <= 0)
+        return;
+    QThreadPool * pool = QThreadPool::globalInstance();
+    int threads = 1;
+    if (threaded)
+        threads = std::max(1, std::min(count, pool->maxThreadCount()));
+    QAtomicInt next(0);
+    QSemaphore done;
+    for (int i = 1; i < threads; i++)
+        pool->start(new ParallelWorker(&job, &next, count, &done));
+    run_pieces(job, next, count);
+    done.acquire(threads - 1);
+}
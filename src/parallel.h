@@ -0,0 +1,39 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_PARALLEL_H
+#define VOXIE_PARALLEL_H
+
+// a job split into independent pieces, see parallel_for()
+class ParallelJob
+{
+public:
+    virtual ~ParallelJob() {}
+    virtual void run(int i) = 0;
+};
+
+// runs job.run(i) for every i in [0, count) on the global thread pool and
+// waits for all of them. the calling thread takes part, so with threaded
+// set to false everything simply runs inline. jobs must not nest.
+void parallel_for(ParallelJob & job, int count, bool threaded = true);
+
+#endif // VOXIE_PARALLEL_H
@@ -0,0 +1,445 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "selection.h"
+#include "collision.h"
+#include "draw.h"
+#include <QDataStream>
+
+#include <limits>
+
+VoxelSelection::VoxelSelection()
+: voxels(NULL), translation(0)
+{
+}
+
+VoxelSelection::~VoxelSelection()
+{
+    if (voxels == NULL)
+        return;
+    delete voxels->model;
+    delete voxels;
+}
+
+void VoxelSelection::clear()
+{
+    if (voxels != NULL)
+        voxels->reset(0, 0, 0);
+    translation = ivec3(0);
+}
+
+// starts an empty selection covering the world box [min, max)
+void VoxelSelection::reset(const ivec3 & min, const ivec3 & max)
+{
+    if (voxels == NULL)
+        voxels = new VoxelFile();
+    ivec3 size = max - min;
+    voxels->reset(size.x, size.y, size.z);
+    voxels->set_offset(min.x, min.y, min.z);
+    translation = ivec3(0);
+}
+
+// the bricks are shared until either selection writes to them
+void VoxelSelection::copy(VoxelSelection & other)
+{
+    if (other.empty()) {
+        clear();
+        return;
+    }
+    if (voxels == NULL)
+        voxels = new VoxelFile();
+    voxels->clone(*other.voxels);
+    translation = other.translation;
+}
+
+// moves the voxel at x, y, z of file into the selection, which has to
+// cover it
+void VoxelSelection::lift(VoxelFile * file, int x, int y, int z)
+{
+    unsigned char v = file->get(x, y, z);
+    if (v == VOXEL_AIR)
+        return;
+    voxels->set_fast(x + file->x_offset - voxels->x_offset - translation.x,
+                     y + file->y_offset - voxels->y_offset - translation.y,
+                     z + file->z_offset - voxels->z_offset - translation.z,
+                     v);
+    file->set_fast(x, y, z, VOXEL_AIR);
+}
+
+// moves the solid voxels of a row inside one brick between two files with
+// the same layout, for the voxels that have their bit set in mask
+static void move_row(VoxelFile * from, VoxelFile * to, int x, int y, int z,
+                     int n, unsigned int mask)
+{
+    unsigned char a[BRICK_SIZE];
+    unsigned char b[BRICK_SIZE];
+    from->get_row(x, y, z, n, a);
+    to->get_row(x, y, z, n, b);
+    bool changed = false;
+    for (int i = 0; i < n; i++) {
+        if (!(mask & (1 << i)) || a[i] == VOXEL_AIR)
+            continue;
+        b[i] = a[i];
+        a[i] = VOXEL_AIR;
+        changed = true;
+    }
+    if (!changed)
+        return;
+    from->set_row(x, y, z, n, a);
+    to->set_row(x, y, z, n, b);
+}
+
+// moves a whole brick, just by sharing it if the other file is still empty
+// there
+static void move_brick(VoxelFile * from, VoxelFile * to, int x, int y,
+                       int z)
+{
+    ivec3 min, max;
+    from->get_brick_box(x, y, z, min, max);
+    BrickSlot & slot = from->get_slot(x, y, z);
+    if (to->get_slot(x, y, z).is_empty()) {
+        to->share_brick(x, y, z, from->get_brick(slot), slot.fill);
+        from->fill(min.x, min.y, min.z, max.x, max.y, max.z, VOXEL_AIR);
+        return;
+    }
+    for (int xx = min.x; xx < max.x; xx++)
+    for (int yy = min.y; yy < max.y; yy++)
+        move_row(from, to, xx, yy, min.z, max.z - min.z, 0xFFFF);
+}
+
+// moves the voxels of a brick that crosses the frustum, testing whole rows
+// before single voxels. only voxels inside the frustum move if inside is
+// set, otherwise only those outside.
+static void move_partial(VoxelFile * from, VoxelFile * to, const ivec3 & p,
+                         vec4 * planes, bool inside)
+{
+    ivec3 min, max;
+    from->get_brick_box(p.x, p.y, p.z, min, max);
+    vec3 offset(from->x_offset, from->y_offset, from->z_offset);
+    int n = max.z - min.z;
+    int w = min.z >> SOLID_WORD_SHIFT;
+    int shift = min.z & (SOLID_WORD_BITS - 1);
+    unsigned int all = (1 << n) - 1;
+    for (int x = min.x; x < max.x; x++)
+    for (int y = min.y; y < max.y; y++) {
+        unsigned int solid = (from->get_solid_word(x, y, w) >> shift) & all;
+        if (solid == 0)
+            continue;
+        vec3 row_min = vec3(x, y, min.z) + offset;
+        vec3 row_max = vec3(x + 1, y + 1, max.z) + offset;
+        unsigned int mask;
+        int test = classify_aabb_frustum(row_min, row_max, planes);
+        if (test == FRUSTUM_PARTIAL) {
+            mask = 0;
+            for (int z = 0; z < n; z++) {
+                if (!(solid & (1 << z)))
+                    continue;
+                vec3 voxel_min = vec3(x, y, min.z + z) + offset;
+                if (test_aabb_frustum(voxel_min, voxel_min + vec3(1.0f),
+                                      planes))
+                    mask |= 1 << z;
+            }
+        } else
+            mask = test == FRUSTUM_INSIDE ? all : 0;
+        if (!inside)
+            mask = ~mask & all;
+        if ((mask & solid) != 0)
+            move_row(from, to, x, y, min.z, n, mask);
+    }
+}
+
+// walks the occupancy pyramid of from, moving the cells that lie entirely
+// on the wanted side of the frustum as a whole
+static void move_cell(VoxelFile * from, VoxelFile * to, int level,
+                      const ivec3 & cell, vec4 * planes, bool inside,
+                      bool whole)
+{
+    if (from->occupancy[level].get(cell.x, cell.y, cell.z) == 0)
+        return;
+    if (!whole) {
+        ivec3 min, max;
+        from->get_cell_box(level, cell.x, cell.y, cell.z, min, max);
+        vec3 offset(from->x_offset, from->y_offset, from->z_offset);
+        int test = classify_aabb_frustum(vec3(min) + offset,
+                                         vec3(max) + offset, planes);
+        if (test != FRUSTUM_PARTIAL) {
+            if ((test == FRUSTUM_INSIDE) != inside)
+                return;
+            whole = true;
+        }
+    }
+    if (level == 0) {
+        if (whole)
+            move_brick(from, to, cell.x, cell.y, cell.z);
+        else
+            move_partial(from, to, cell, planes, inside);
+        return;
+    }
+    for (int k = 0; k < 8; k++)
+        move_cell(from, to, level - 1, cell * 2 + get_octant(k), planes,
+                  inside, whole);
+}
+
+// changes the selection to the solid voxels inside the frustum, lifting
+// them out of file. while the selection keeps the size and offsets of
+// file, only the voxels that enter or leave it are touched, so following a
+// rubber band only costs as much as the change.
+void VoxelSelection::select_frustum(VoxelFile * file, vec4 * planes)
+{
+    ivec3 min(file->x_offset, file->y_offset, file->z_offset);
+    ivec3 max = min + ivec3(file->x_size, file->y_size, file->z_size);
+    ivec3 bounds_min, bounds_max;
+    if (voxels != NULL)
+        get_bounds(bounds_min, bounds_max);
+    if (voxels == NULL || translation != ivec3(0) || bounds_min != min ||
+        bounds_max != max) {
+        if (!empty())
+            apply(file);
+        reset(min, max);
+    }
+    voxels->update_occupancy();
+    move_cell(voxels, file, int(voxels->occupancy.size()) - 1, ivec3(0),
+              planes, false, false);
+    file->update_occupancy();
+    move_cell(file, voxels, int(file->occupancy.size()) - 1, ivec3(0),
+              planes, true, false);
+}
+
+// shrinks the selection to its voxels once they have been added
+void VoxelSelection::finish()
+{
+    if (empty())
+        return;
+    if (voxels->color_counts[VOXEL_AIR] == voxels->get_volume()) {
+        clear();
+        return;
+    }
+    voxels->optimize();
+}
+
+// world box of the selection, including the translation
+void VoxelSelection::get_bounds(ivec3 & min, ivec3 & max)
+{
+    min = ivec3(voxels->x_offset, voxels->y_offset, voxels->z_offset) +
+          translation;
+    max = min + ivec3(voxels->x_size, voxels->y_size, voxels->z_size);
+}
+
+// writes the selected voxels over file. the parts outside of it are lost.
+void VoxelSelection::apply(VoxelFile * file)
+{
+    if (translation != ivec3(0)) {
+        ivec3 min, max;
+        get_bounds(min, max);
+        voxels->set_offset(min.x, min.y, min.z);
+        translation = ivec3(0);
+    }
+    file->combine(*voxels, CSG_REPLACE);
+}
+
+// returns false if nothing is selected
+bool VoxelSelection::remap(const unsigned char * table)
+{
+    if (empty())
+        return false;
+    voxels->remap(table);
+    finish();
+    return true;
+}
+
+// clipboard format, see VoxelSelection::write()
+#define CLIPBOARD_MAGIC 0x4c535856
+#define CLIPBOARD_FILL 0
+#define CLIPBOARD_RUNS 1
+#define CLIPBOARD_RAW 2
+
+// encodes a brick as pairs of run length - 1 and color. returns -1 if the
+// runs would not be smaller than the brick itself.
+static int encode_runs(const unsigned char * in, unsigned char * out)
+{
+    int size = 0;
+    int i = 0;
+    while (i < BRICK_VOLUME) {
+        if (size + 2 >= BRICK_VOLUME)
+            return -1;
+        unsigned char v = in[i];
+        int n = 1;
+        while (n < 256 && i + n < BRICK_VOLUME && in[i + n] == v)
+            n++;
+        out[size++] = (unsigned char)(n - 1);
+        out[size++] = v;
+        i += n;
+    }
+    return size;
+}
+
+static bool decode_runs(const unsigned char * in, int size,
+                        unsigned char * out)
+{
+    if (size & 1)
+        return false;
+    int n = 0;
+    for (int i = 0; i < size; i += 2) {
+        int len = in[i] + 1;
+        if (n + len > BRICK_VOLUME)
+            return false;
+        memset(out + n, in[i + 1], len);
+        n += len;
+    }
+    return n == BRICK_VOLUME;
+}
+
+// stores the selection for the clipboard as its size and world offset,
+// followed by every brick as either a fill color, runs or raw voxels
+void VoxelSelection::write(QByteArray & data)
+{
+    data.clear();
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    ivec3 min(0), max(0);
+    if (!empty())
+        get_bounds(min, max);
+    ivec3 size = max - min;
+    stream << quint32(CLIPBOARD_MAGIC);
+    stream << qint32(size.x) << qint32(size.y) << qint32(size.z);
+    stream << qint32(min.x) << qint32(min.y) << qint32(min.z);
+    if (empty())
+        return;
+    unsigned char in[BRICK_VOLUME];
+    unsigned char out[BRICK_VOLUME];
+    for (int x = 0; x < voxels->x_bricks; x++)
+    for (int y = 0; y < voxels->y_bricks; y++)
+    for (int z = 0; z < voxels->z_bricks; z++) {
+        BrickSlot & slot = voxels->get_slot(x, y, z);
+        VoxelBrick * brick = voxels->get_brick(slot);
+        if (brick == NULL) {
+            stream << quint8(CLIPBOARD_FILL) << quint8(slot.fill);
+            continue;
+        }
+        brick->unpack(in);
+        int n = encode_runs(in, out);
+        if (n < 0) {
+            stream << quint8(CLIPBOARD_RAW);
+            stream.writeRawData((const char*)in, BRICK_VOLUME);
+        } else {
+            stream << quint8(CLIPBOARD_RUNS) << quint16(n);
+            stream.writeRawData((const char*)out, n);
+        }
+    }
+}
+
+// replaces the selection with one stored by write(). returns false and
+// leaves the selection empty if the data is not valid.
+bool VoxelSelection::read(const QByteArray & data)
+{
+    clear();
+    QDataStream stream(data);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    quint32 magic;
+    qint32 x_size, y_size, z_size, x, y, z;
+    stream >> magic >> x_size >> y_size >> z_size >> x >> y >> z;
+    if (stream.status() != QDataStream::Ok || magic != CLIPBOARD_MAGIC ||
+        x_size < 0 || y_size < 0 || z_size < 0)
+        return false;
+    if (x_size == 0 || y_size == 0 || z_size == 0)
+        return true;
+    // every brick takes at least two bytes, which bounds the size. the
+    // brick counts are checked one at a time, so they cannot overflow.
+    qint32 sizes[3] = {x_size, y_size, z_size};
+    qint32 offsets[3] = {x, y, z};
+    int64_t bricks = data.size() / 2;
+    for (int i = 0; i < 3; i++) {
+        int64_t n = (int64_t(sizes[i]) + BRICK_MASK) >> BRICK_SHIFT;
+        if (n > bricks ||
+            int64_t(offsets[i]) + sizes[i] > std::numeric_limits<int>::max())
+            return false;
+        bricks /= n;
+    }
+    ivec3 min(x, y, z);
+    reset(min, min + ivec3(x_size, y_size, z_size));
+    unsigned char in[BRICK_VOLUME];
+    unsigned char out[BRICK_VOLUME];
+    for (int bx = 0; bx < voxels->x_bricks; bx++)
+    for (int by = 0; by < voxels->y_bricks; by++)
+    for (int bz = 0; bz < voxels->z_bricks; bz++) {
+        quint8 type;
+        stream >> type;
+        if (type == CLIPBOARD_FILL) {
+            quint8 v;
+            stream >> v;
+            voxels->share_brick(bx, by, bz, NULL, v);
+            continue;
+        }
+        bool valid;
+        if (type == CLIPBOARD_RAW) {
+            valid = stream.readRawData((char*)out, BRICK_VOLUME) ==
+                    BRICK_VOLUME;
+        } else if (type == CLIPBOARD_RUNS) {
+            quint16 n;
+            stream >> n;
+            valid = n <= BRICK_VOLUME &&
+                    stream.readRawData((char*)in, n) == n &&
+                    decode_runs(in, n, out);
+        } else
+            valid = false;
+        if (!valid || stream.status() != QDataStream::Ok) {
+            clear();
+            return false;
+        }
+        // keep the voxels outside of the model air
+        ivec3 brick_min, brick_max;
+        voxels->get_brick_box(bx, by, bz, brick_min, brick_max);
+        ivec3 size = brick_max - brick_min;
+        for (int i = 0; i < BRICK_SIZE; i++)
+        for (int j = 0; j < BRICK_SIZE; j++) {
+            unsigned char * row =
+                &out[(j | (i << BRICK_SHIFT)) << BRICK_SHIFT];
+            int start = i < size.x && j < size.y ? size.z : 0;
+            memset(row + start, VOXEL_AIR, BRICK_SIZE - start);
+        }
+        voxels->add_brick_counts(bx, by, bz, -1);
+        voxels->store_brick(bx, by, bz, out);
+        voxels->add_brick_counts(bx, by, bz, 1);
+        voxels->mark_dirty(voxels->get_slot(bx, by, bz));
+    }
+    if (stream.status() != QDataStream::Ok) {
+        clear();
+        return false;
+    }
+    finish();
+    return true;
+}
+
+void VoxelSelection::draw()
+{
+    glPushMatrix();
+    glTranslatef(float(translation.x), float(translation.y),
+                 float(translation.z));
+    voxels->get_model()->draw();
+    glDisable(GL_LIGHTING);
+    vec3 min = voxels->get_min();
+    vec3 max = voxels->get_max();
+    draw_wireframe_cube(min.x, min.y, min.z, max.x, max.y, max.z,
+                        255, 255, 255, 255);
+    glEnable(GL_LIGHTING);
+    glPopMatrix();
+}
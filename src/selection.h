@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_SELECTION_H
+#define VOXIE_SELECTION_H
+
+#include "voxel.h"
+
+// clipboard type of the data written by VoxelSelection::write()
+#define SELECTION_MIME_TYPE "application/x-voxie-selection"
+
+// voxels lifted out of a model while they are selected. they are kept in a
+// model of their own that covers their bounds, and moved by translation
+// without being touched until they are put down with apply().
+class VoxelSelection
+{
+public:
+    // created on first use and then kept, so its display lists are only
+    // ever rebuilt while drawing. its offsets place the voxels in the world,
+    // before the translation.
+    VoxelFile * voxels;
+    ivec3 translation;
+
+    VoxelSelection();
+    ~VoxelSelection();
+    void clear();
+    void reset(const ivec3 & min, const ivec3 & max);
+    void copy(VoxelSelection & other);
+    void lift(VoxelFile * file, int x, int y, int z);
+    void select_frustum(VoxelFile * file, vec4 * planes);
+    void finish();
+    void get_bounds(ivec3 & min, ivec3 & max);
+    void apply(VoxelFile * file);
+    bool remap(const unsigned char * table);
+    void write(QByteArray & data);
+    bool read(const QByteArray & data);
+    void draw();
+
+    inline bool empty()
+    {
+        return voxels == NULL ||
+               voxels->color_counts[VOXEL_AIR] == voxels->get_volume();
+    }
+};
+
+#endif // VOXIE_SELECTION_H
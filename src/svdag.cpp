@@ -0,0 +1,403 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "svdag.h"
+
+#include <QDataStream>
+
+static uint64_t hash_words(const quint32 * words, int count)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < count; i++) {
+        hash ^= words[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+inline int get_octant(int x, int y, int z, int shift)
+{
+    return (((x >> shift) & 1) << 2) | (((y >> shift) & 1) << 1) |
+           ((z >> shift) & 1);
+}
+
+void VoxelDAG::clear()
+{
+    leaves.clear();
+    nodes.clear();
+    frames.clear();
+    leaf_map.clear();
+    node_maps.clear();
+}
+
+int VoxelDAG::add_frame(const QString & name, VoxelFile * file)
+{
+    SparseVoxelOctree tree;
+    tree.build(file);
+    return add_frame(name, tree);
+}
+
+int VoxelDAG::add_frame(const QString & name, SparseVoxelOctree & tree)
+{
+    VoxelDAGFrame frame;
+    frame.name = name;
+    frame.x_size = tree.x_size;
+    frame.y_size = tree.y_size;
+    frame.z_size = tree.z_size;
+    frame.x_offset = tree.x_offset;
+    frame.y_offset = tree.y_offset;
+    frame.z_offset = tree.z_offset;
+    frame.depth = tree.depth;
+    if (tree.depth == 0 || tree.levels[0].masks.empty())
+        frame.root = SVDAG_EMPTY;
+    else
+        frame.root = add_node(tree, 0, 0);
+    frames.push_back(frame);
+    return int(frames.size()) - 1;
+}
+
+int VoxelDAG::find_frame(const QString & name)
+{
+    for (size_t i = 0; i < frames.size(); i++) {
+        if (frames[i].name == name)
+            return int(i);
+    }
+    return -1;
+}
+
+quint32 VoxelDAG::add_node(SparseVoxelOctree & tree, int level,
+                           quint32 node)
+{
+    SVOLevel & l = tree.levels[level];
+    unsigned char mask = l.masks[node];
+    quint32 child = l.get_rank(node);
+    if (level == tree.depth - 1) {
+        uint64_t leaf = 0;
+        for (int k = 0; k < 8; k++) {
+            uint64_t v = VOXEL_AIR;
+            if (mask & (1 << k))
+                v = tree.colors[child++];
+            leaf |= v << (k * 8);
+        }
+        return add_leaf(leaf);
+    }
+    quint32 words[9];
+    int count = 1;
+    words[0] = mask;
+    for (int k = 0; k < 8; k++) {
+        if (mask & (1 << k))
+            words[count++] = add_node(tree, level + 1, child++);
+    }
+    return add_node(tree.depth - level, words, count);
+}
+
+quint32 VoxelDAG::add_leaf(uint64_t leaf)
+{
+    fast_map<uint64_t, quint32>::const_iterator it = leaf_map.find(leaf);
+    if (it != leaf_map.end())
+        return it->second;
+    quint32 ref = quint32(leaves.size());
+    leaves.push_back(leaf);
+    leaf_map[leaf] = ref;
+    return ref;
+}
+
+// nodes are looked up by the hash of their words. on a collision with a
+// different node, the next key is tried.
+quint32 VoxelDAG::add_node(int height, const quint32 * words, int count)
+{
+    if (int(nodes.size()) < height - 1) {
+        nodes.resize(height - 1);
+        node_maps.resize(height - 1);
+    }
+    std::vector<quint32> & pool = nodes[height - 2];
+    fast_map<uint64_t, quint32> & map = node_maps[height - 2];
+    uint64_t key = hash_words(words, count);
+    fast_map<uint64_t, quint32>::const_iterator it;
+    while ((it = map.find(key)) != map.end()) {
+        const quint32 * other = &pool[it->second];
+        if (memcmp(other, words, count * sizeof(quint32)) == 0)
+            return it->second;
+        key++;
+    }
+    quint32 ref = quint32(pool.size());
+    pool.insert(pool.end(), words, words + count);
+    map[key] = ref;
+    return ref;
+}
+
+unsigned char VoxelDAG::get(int index, int x, int y, int z)
+{
+    VoxelDAGFrame & frame = frames[index];
+    if (x < 0 || y < 0 || z < 0 ||
+        x >= frame.x_size || y >= frame.y_size || z >= frame.z_size)
+        return VOXEL_AIR;
+    quint32 ref = frame.root;
+    if (ref == SVDAG_EMPTY)
+        return VOXEL_AIR;
+    for (int h = frame.depth; h > 1; h--) {
+        const quint32 * node = &nodes[h - 2][ref];
+        int k = get_octant(x, y, z, h - 1);
+        if (!(node[0] & (1 << k)))
+            return VOXEL_AIR;
+        ref = node[1 + count_bits(node[0] & ((1 << k) - 1))];
+    }
+    return (leaves[ref] >> (get_octant(x, y, z, 0) * 8)) & 0xFF;
+}
+
+void VoxelDAG::extract(int index, VoxelFile & file)
+{
+    VoxelDAGFrame & frame = frames[index];
+    file.reset(frame.x_size, frame.y_size, frame.z_size);
+    file.set_offset(frame.x_offset, frame.y_offset, frame.z_offset);
+    if (frame.root != SVDAG_EMPTY)
+        extract_node(file, frame.depth, frame.root, ivec3(0));
+    file.compact_bricks();
+}
+
+void VoxelDAG::extract_node(VoxelFile & file, int height, quint32 ref,
+                            const ivec3 & pos)
+{
+    if (height == 1) {
+        uint64_t leaf = leaves[ref];
+        for (int k = 0; k < 8; k++) {
+            unsigned char v = (leaf >> (k * 8)) & 0xFF;
+            if (v == VOXEL_AIR)
+                continue;
+            file.set(pos.x + ((k >> 2) & 1), pos.y + ((k >> 1) & 1),
+                     pos.z + (k & 1), v);
+        }
+        return;
+    }
+    const quint32 * node = &nodes[height - 2][ref];
+    int half = 1 << (height - 1);
+    int child = 1;
+    for (int k = 0; k < 8; k++) {
+        if (!(node[0] & (1 << k)))
+            continue;
+        ivec3 p = pos + ivec3((k >> 2) & 1, (k >> 1) & 1, k & 1) * half;
+        extract_node(file, height - 1, node[child++], p);
+    }
+}
+
+size_t VoxelDAG::get_memory()
+{
+    size_t size = leaves.size() * sizeof(uint64_t) +
+                  frames.size() * sizeof(VoxelDAGFrame);
+    for (size_t i = 0; i < nodes.size(); i++)
+        size += nodes[i].size() * sizeof(quint32);
+    return size;
+}
+
+// the lookup maps are only needed to add frames, so they are not saved
+void VoxelDAG::update_maps()
+{
+    leaf_map.clear();
+    for (size_t i = 0; i < leaves.size(); i++)
+        leaf_map[leaves[i]] = quint32(i);
+    node_maps.clear();
+    node_maps.resize(nodes.size());
+    for (size_t h = 0; h < nodes.size(); h++) {
+        std::vector<quint32> & pool = nodes[h];
+        fast_map<uint64_t, quint32> & map = node_maps[h];
+        size_t i = 0;
+        while (i < pool.size()) {
+            int count = 1 + count_bits(pool[i]);
+            uint64_t key = hash_words(&pool[i], count);
+            while (map.find(key) != map.end())
+                key++;
+            map[key] = quint32(i);
+            i += count;
+        }
+    }
+}
+
+// serialization, little endian like the .vxi format
+
+void VoxelDAG::save_fp(QFile & fp)
+{
+    QDataStream stream(&fp);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << quint32(leaves.size());
+    for (size_t i = 0; i < leaves.size(); i++)
+        stream << quint64(leaves[i]);
+    stream << quint32(nodes.size());
+    for (size_t h = 0; h < nodes.size(); h++) {
+        std::vector<quint32> & pool = nodes[h];
+        stream << quint32(pool.size());
+        for (size_t i = 0; i < pool.size(); i++)
+            stream << pool[i];
+    }
+    stream << quint32(frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        VoxelDAGFrame & frame = frames[i];
+        write_cstring(stream, frame.name);
+        stream << frame.x_size;
+        stream << frame.y_size;
+        stream << frame.z_size;
+        stream << frame.x_offset;
+        stream << frame.y_offset;
+        stream << frame.z_offset;
+        stream << frame.depth;
+        stream << frame.root;
+    }
+}
+
+void VoxelDAG::save(const QString & filename)
+{
+    QFile fp(filename);
+    if (!fp.open(QIODevice::WriteOnly))
+        return;
+    save_fp(fp);
+    fp.close();
+}
+
+// bytes left in the file, which bounds the counts read from it
+static int64_t get_remaining(QFile & fp)
+{
+    return fp.size() - fp.pos();
+}
+
+// checks that every node of the pool of the given height lies inside it
+// and that its children start a node of the height below. starts marks the
+// words that start a node.
+static bool check_pool(VoxelDAG & dag, int height,
+                       std::vector<std::vector<bool> > & starts)
+{
+    std::vector<quint32> & pool = dag.nodes[height - 2];
+    std::vector<bool> & pool_starts = starts[height - 2];
+    pool_starts.assign(pool.size(), false);
+    size_t i = 0;
+    while (i < pool.size()) {
+        if (pool[i] > 0xFF)
+            return false;
+        size_t count = 1 + count_bits(pool[i]);
+        if (i + count > pool.size())
+            return false;
+        for (size_t k = 1; k < count; k++) {
+            quint32 ref = pool[i + k];
+            if (height == 2) {
+                if (ref >= dag.leaves.size())
+                    return false;
+            } else if (ref >= starts[height - 3].size() ||
+                       !starts[height - 3][ref])
+                return false;
+        }
+        pool_starts[i] = true;
+        i += count;
+    }
+    return true;
+}
+
+bool VoxelDAG::load_fp(QFile & fp)
+{
+    clear();
+    QDataStream stream(&fp);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    quint32 count;
+    stream >> count;
+    if (stream.status() != QDataStream::Ok ||
+        int64_t(count) * 8 > get_remaining(fp))
+        return false;
+    leaves.resize(count);
+    for (quint32 i = 0; i < count; i++) {
+        quint64 leaf;
+        stream >> leaf;
+        leaves[i] = leaf;
+    }
+    stream >> count;
+    if (stream.status() != QDataStream::Ok || count > 31) {
+        clear();
+        return false;
+    }
+    nodes.resize(count);
+    std::vector<std::vector<bool> > starts(count);
+    for (size_t h = 0; h < nodes.size(); h++) {
+        stream >> count;
+        if (stream.status() != QDataStream::Ok ||
+            int64_t(count) * 4 > get_remaining(fp)) {
+            clear();
+            return false;
+        }
+        nodes[h].resize(count);
+        for (quint32 i = 0; i < count; i++)
+            stream >> nodes[h][i];
+        if (stream.status() != QDataStream::Ok ||
+            !check_pool(*this, int(h) + 2, starts)) {
+            clear();
+            return false;
+        }
+    }
+    // a frame takes at least a terminated name and eight words
+    stream >> count;
+    if (stream.status() != QDataStream::Ok ||
+        int64_t(count) * 33 > get_remaining(fp)) {
+        clear();
+        return false;
+    }
+    frames.resize(count);
+    for (quint32 i = 0; i < count; i++) {
+        VoxelDAGFrame & frame = frames[i];
+        read_cstring(stream, frame.name);
+        stream >> frame.x_size;
+        stream >> frame.y_size;
+        stream >> frame.z_size;
+        stream >> frame.x_offset;
+        stream >> frame.y_offset;
+        stream >> frame.z_offset;
+        stream >> frame.depth;
+        stream >> frame.root;
+        bool valid = stream.status() == QDataStream::Ok &&
+                     frame.x_size >= 0 && frame.y_size >= 0 &&
+                     frame.z_size >= 0;
+        if (valid && frame.root != SVDAG_EMPTY) {
+            int64_t size = frame.depth >= 1 && frame.depth <= 32 ?
+                           int64_t(1) << frame.depth : 0;
+            valid = frame.x_size <= size && frame.y_size <= size &&
+                    frame.z_size <= size;
+            if (frame.depth == 1)
+                valid = valid && frame.root < leaves.size();
+            else if (valid) {
+                int h = frame.depth - 2;
+                valid = h < int(nodes.size()) &&
+                        frame.root < starts[h].size() &&
+                        starts[h][frame.root];
+            }
+        }
+        if (!valid) {
+            clear();
+            return false;
+        }
+    }
+    update_maps();
+    return true;
+}
+
+bool VoxelDAG::load(const QString & filename)
+{
+    QFile fp(filename);
+    if (!fp.open(QIODevice::ReadOnly))
+        return false;
+    bool ret = load_fp(fp);
+    fp.close();
+    return ret;
+}
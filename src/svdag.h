@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_SVDAG_H
+#define VOXIE_SVDAG_H
+
+#include "svo.h"
+
+#include <vector>
+
+// a sparse voxel DAG shared by a library of frames. nodes are stored by
+// height, where a node of height h covers 2^h voxels along every axis and
+// identical nodes are only stored once, no matter which frame they came
+// from. a node of height 1 is a leaf of 8 colors (one per octant, see
+// SparseVoxelOctree). a node of height h > 1 is a child mask followed by
+// the references of its children of height h - 1.
+#define SVDAG_EMPTY 0xFFFFFFFFU
+
+class VoxelDAGFrame
+{
+public:
+    QString name;
+    qint32 x_size, y_size, z_size;
+    qint32 x_offset, y_offset, z_offset;
+    qint32 depth;
+    quint32 root;
+};
+
+class VoxelDAG
+{
+public:
+    // leaves are indexed by their position, nodes by their word offset
+    std::vector<uint64_t> leaves;
+    std::vector<std::vector<quint32> > nodes;
+    std::vector<VoxelDAGFrame> frames;
+    fast_map<uint64_t, quint32> leaf_map;
+    std::vector<fast_map<uint64_t, quint32> > node_maps;
+
+    void clear();
+    int add_frame(const QString & name, VoxelFile * file);
+    int add_frame(const QString & name, SparseVoxelOctree & tree);
+    int find_frame(const QString & name);
+    unsigned char get(int frame, int x, int y, int z);
+    void extract(int frame, VoxelFile & file);
+    size_t get_memory();
+    void save_fp(QFile & fp);
+    void save(const QString & filename);
+    bool load_fp(QFile & fp);
+    bool load(const QString & filename);
+    quint32 add_node(SparseVoxelOctree & tree, int level, quint32 node);
+    quint32 add_leaf(uint64_t leaf);
+    quint32 add_node(int height, const quint32 * words, int count);
+    void extract_node(VoxelFile & file, int height, quint32 ref,
+                      const ivec3 & pos);
+    void update_maps();
+};
+
+#endif // VOXIE_SVDAG_H
@@ -0,0 +1,481 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "svo.h"
+#include "parallel.h"
+#include "collision.h"
+
+#include <algorithm>
+#include <limits>
+#include <QDataStream>
+
+// SVOLevel
+
+void SVOLevel::update_ranks()
+{
+    ranks.resize((masks.size() >> SVO_RANK_SHIFT) + 1);
+    quint32 rank = 0;
+    for (size_t i = 0; i < masks.size(); i++) {
+        if ((i & (SVO_RANK_STEP - 1)) == 0)
+            ranks[i >> SVO_RANK_SHIFT] = rank;
+        rank += count_bits(masks[i]);
+    }
+    if ((masks.size() & (SVO_RANK_STEP - 1)) == 0)
+        ranks.back() = rank;
+}
+
+// number of children of the nodes before node i
+quint32 SVOLevel::get_rank(quint32 i)
+{
+    quint32 rank = ranks[i >> SVO_RANK_SHIFT];
+    quint32 j = i & ~quint32(SVO_RANK_STEP - 1);
+    for (; j + 8 <= i; j += 8) {
+        uint64_t word;
+        memcpy(&word, &masks[j], 8);
+        rank += count_bits(word);
+    }
+    for (; j < i; j++)
+        rank += count_bits(masks[j]);
+    return rank;
+}
+
+// building
+
+class SVOChunk
+{
+public:
+    std::vector<std::vector<unsigned char> > levels;
+    std::vector<unsigned char> colors;
+};
+
+// a decoded brick, laid out like VoxelBrick
+class SVOBrick
+{
+public:
+    unsigned char data[BRICK_VOLUME];
+    unsigned short solid[BRICK_SIZE * BRICK_SIZE];
+
+    bool is_empty(const ivec3 & p, int size)
+    {
+        unsigned int bits = ((1 << size) - 1) << p.z;
+        for (int x = p.x; x < p.x + size; x++)
+        for (int y = p.y; y < p.y + size; y++) {
+            if (solid[y | (x << BRICK_SHIFT)] & bits)
+                return false;
+        }
+        return true;
+    }
+};
+
+// builds the subtrees below chunk_level, one job piece per chunk in morton
+// order, so that the chunk results only have to be concatenated
+class SVOBuildJob : public ParallelJob
+{
+public:
+    SparseVoxelOctree * tree;
+    VoxelFile * file;
+    int chunk_level;
+    std::vector<SVOChunk> chunks;
+
+    SVOBuildJob(SparseVoxelOctree * tree, VoxelFile * file, int chunk_level)
+    : tree(tree), file(file), chunk_level(chunk_level)
+    {
+        chunks.resize(1 << (chunk_level * 3));
+    }
+
+    void run(int i)
+    {
+        SVOChunk & chunk = chunks[i];
+        chunk.levels.resize(tree->depth - chunk_level);
+        ivec3 pos(0);
+        for (int b = 0; b < chunk_level; b++) {
+            ivec3 octant = get_octant((i >> (b * 3)) & 7);
+            pos += octant << b;
+        }
+        pos <<= tree->depth - chunk_level;
+        build_node(chunk, chunk_level, pos);
+    }
+
+    void add_node(SVOChunk & chunk, int level, unsigned char mask)
+    {
+        chunk.levels[level - chunk_level].push_back(mask);
+    }
+
+    bool build_node(SVOChunk & chunk, int level, const ivec3 & pos)
+    {
+        if (pos.x >= tree->x_size || pos.y >= tree->y_size ||
+            pos.z >= tree->z_size)
+            return false;
+        int size = 1 << (tree->depth - level);
+        if (size <= BRICK_SIZE)
+            return build_brick(chunk, level, pos);
+        int half = size >> 1;
+        unsigned char mask = 0;
+        for (int k = 0; k < 8; k++) {
+            if (build_node(chunk, level + 1, pos + get_octant(k) * half))
+                mask |= 1 << k;
+        }
+        if (mask == 0)
+            return false;
+        add_node(chunk, level, mask);
+        return true;
+    }
+
+    bool build_brick(SVOChunk & chunk, int level, const ivec3 & pos)
+    {
+        ivec3 b = pos >> BRICK_SHIFT;
+        BrickSlot & slot = file->get_slot(b.x, b.y, b.z);
+        if (slot.is_empty())
+            return false;
+        SVOBrick brick;
+        VoxelBrick * data = file->get_brick(slot);
+        if (data != NULL) {
+            data->unpack(brick.data);
+            memcpy(brick.solid, data->solid, sizeof(brick.solid));
+        } else {
+            ivec3 min, max;
+            file->get_brick_box(b.x, b.y, b.z, min, max);
+            ivec3 size = max - min;
+            memset(brick.data, VOXEL_AIR, BRICK_VOLUME);
+            for (int x = 0; x < size.x; x++)
+            for (int y = 0; y < size.y; y++)
+                memset(&brick.data[(y | (x << BRICK_SHIFT)) << BRICK_SHIFT],
+                       slot.fill, size.z);
+            for (int i = 0; i < BRICK_SIZE * BRICK_SIZE; i++)
+                brick.solid[i] = get_solid_mask(
+                    &brick.data[i << BRICK_SHIFT]);
+        }
+        return build_local(chunk, level, pos & BRICK_MASK, brick);
+    }
+
+    bool build_local(SVOChunk & chunk, int level, const ivec3 & pos,
+                     SVOBrick & brick)
+    {
+        int size = 1 << (tree->depth - level);
+        if (size >= 4 && brick.is_empty(pos, size))
+            return false;
+        unsigned char mask = 0;
+        if (size == 2) {
+            for (int k = 0; k < 8; k++) {
+                ivec3 p = pos + get_octant(k);
+                unsigned char v = brick.data[p.z | (p.y << BRICK_SHIFT) |
+                                             (p.x << (BRICK_SHIFT * 2))];
+                if (v == VOXEL_AIR)
+                    continue;
+                mask |= 1 << k;
+                chunk.colors.push_back(v);
+            }
+        } else {
+            int half = size >> 1;
+            for (int k = 0; k < 8; k++) {
+                ivec3 p = pos + get_octant(k) * half;
+                if (build_local(chunk, level + 1, p, brick))
+                    mask |= 1 << k;
+            }
+        }
+        if (mask == 0)
+            return false;
+        add_node(chunk, level, mask);
+        return true;
+    }
+};
+
+// SparseVoxelOctree
+
+SparseVoxelOctree::SparseVoxelOctree()
+: depth(0), x_size(0), y_size(0), z_size(0), x_offset(0), y_offset(0),
+  z_offset(0)
+{
+}
+
+void SparseVoxelOctree::clear()
+{
+    depth = 0;
+    x_size = y_size = z_size = 0;
+    x_offset = y_offset = z_offset = 0;
+    levels.clear();
+    colors.clear();
+}
+
+void SparseVoxelOctree::build(VoxelFile * file)
+{
+    x_size = file->x_size;
+    y_size = file->y_size;
+    z_size = file->z_size;
+    x_offset = file->x_offset;
+    y_offset = file->y_offset;
+    z_offset = file->z_offset;
+    int size = std::max(x_size, std::max(y_size, z_size));
+    depth = 1;
+    while ((1 << depth) < size)
+        depth++;
+    levels.clear();
+    levels.resize(depth);
+    colors.clear();
+
+    // aim for chunks of at least a brick, and a few hundred of them
+    int chunk_level = std::max(0, std::min(depth - 4, 3));
+    SVOBuildJob job(this, file, chunk_level);
+    parallel_for(job, int(job.chunks.size()), file->pager == NULL);
+
+    std::vector<quint32> codes;
+    for (size_t i = 0; i < job.chunks.size(); i++) {
+        SVOChunk & chunk = job.chunks[i];
+        if (chunk.levels[0].empty())
+            continue;
+        codes.push_back(quint32(i));
+        for (int l = chunk_level; l < depth; l++) {
+            std::vector<unsigned char> & src = chunk.levels[l - chunk_level];
+            std::vector<unsigned char> & dst = levels[l].masks;
+            dst.insert(dst.end(), src.begin(), src.end());
+        }
+        colors.insert(colors.end(), chunk.colors.begin(),
+                      chunk.colors.end());
+    }
+
+    // the levels above the chunks follow from the morton codes
+    for (int l = chunk_level - 1; l >= 0; l--) {
+        std::vector<unsigned char> & masks = levels[l].masks;
+        std::vector<quint32> parents;
+        for (size_t i = 0; i < codes.size(); i++) {
+            quint32 parent = codes[i] >> 3;
+            if (parents.empty() || parents.back() != parent) {
+                parents.push_back(parent);
+                masks.push_back(0);
+            }
+            masks.back() |= 1 << (codes[i] & 7);
+        }
+        codes.swap(parents);
+    }
+
+    for (int l = 0; l < depth; l++)
+        levels[l].update_ranks();
+}
+
+// x, y, z are in voxel coordinates, i.e. without the model offset
+unsigned char SparseVoxelOctree::get(int x, int y, int z)
+{
+    if (x < 0 || y < 0 || z < 0 ||
+        x >= x_size || y >= y_size || z >= z_size)
+        return VOXEL_AIR;
+    if (depth == 0 || levels[0].masks.empty())
+        return VOXEL_AIR;
+    quint32 node = 0;
+    for (int l = 0; l < depth; l++) {
+        int shift = depth - 1 - l;
+        int k = (((x >> shift) & 1) << 2) | (((y >> shift) & 1) << 1) |
+                ((z >> shift) & 1);
+        SVOLevel & level = levels[l];
+        unsigned char mask = level.masks[node];
+        if (!(mask & (1 << k)))
+            return VOXEL_AIR;
+        node = level.get_rank(node) + count_bits(mask & ((1 << k) - 1));
+    }
+    return colors[node];
+}
+
+// pos and dir are in voxel coordinates, i.e. without the model offset.
+// returns the first solid voxel along the ray.
+bool SparseVoxelOctree::raycast(const vec3 & pos, const vec3 & dir,
+                                SVOHit & hit)
+{
+    if (depth == 0 || levels[0].masks.empty())
+        return false;
+    vec3 inv_dir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+    float t_max = std::numeric_limits<float>::infinity();
+    if (!raycast_node(0, 0, ivec3(0), pos, inv_dir, t_max, hit))
+        return false;
+    for (int i = 0; i < 3; i++)
+        hit.normal[i] = hit.normal[i] * (dir[i] > 0.0f ? -1 : 1);
+    return true;
+}
+
+bool SparseVoxelOctree::raycast_node(int level, quint32 node,
+                                     const ivec3 & min, const vec3 & pos,
+                                     const vec3 & inv_dir, float t_max,
+                                     SVOHit & hit)
+{
+    SVOLevel & l = levels[level];
+    unsigned char mask = l.masks[node];
+    quint32 first = l.get_rank(node);
+    int half = 1 << (depth - level - 1);
+
+    // children sorted front to back by their entry distance
+    int count = 0;
+    int order[8], axes[8];
+    float entries[8];
+    for (int k = 0; k < 8; k++) {
+        if (!(mask & (1 << k)))
+            continue;
+        float t_near, t_far;
+        int axis;
+        vec3 child_min(min + get_octant(k) * half);
+        if (!test_ray_aabb(pos, inv_dir, child_min, child_min + float(half),
+                           t_near, t_far, axis) || t_near > t_max)
+            continue;
+        int i = count++;
+        for (; i > 0 && entries[i - 1] > t_near; i--) {
+            entries[i] = entries[i - 1];
+            order[i] = order[i - 1];
+            axes[i] = axes[i - 1];
+        }
+        entries[i] = t_near;
+        order[i] = k;
+        axes[i] = axis;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int k = order[i];
+        quint32 child = first + count_bits(mask & ((1 << k) - 1));
+        ivec3 child_min = min + get_octant(k) * half;
+        if (level + 1 < depth) {
+            if (raycast_node(level + 1, child, child_min, pos, inv_dir,
+                             t_max, hit))
+                return true;
+            continue;
+        }
+        hit.pos = child_min;
+        hit.color = colors[child];
+        hit.t = std::max(0.0f, entries[i]);
+        hit.normal = ivec3(0);
+        hit.normal[axes[i]] = 1;
+        return true;
+    }
+    return false;
+}
+
+size_t SparseVoxelOctree::get_memory()
+{
+    size_t size = colors.size();
+    for (size_t i = 0; i < levels.size(); i++)
+        size += levels[i].masks.size() +
+                levels[i].ranks.size() * sizeof(quint32);
+    return size;
+}
+
+// serialization, little endian like the .vxi format
+
+void SparseVoxelOctree::save_fp(QFile & fp)
+{
+    QDataStream stream(&fp);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream << qint32(depth);
+    stream << x_size;
+    stream << y_size;
+    stream << z_size;
+    stream << x_offset;
+    stream << y_offset;
+    stream << z_offset;
+    for (int l = 0; l < depth; l++) {
+        std::vector<unsigned char> & masks = levels[l].masks;
+        stream << quint32(masks.size());
+        if (!masks.empty())
+            stream.writeRawData((char*)&masks[0], int(masks.size()));
+    }
+    stream << quint32(colors.size());
+    if (!colors.empty())
+        stream.writeRawData((char*)&colors[0], int(colors.size()));
+}
+
+void SparseVoxelOctree::save(const QString & filename)
+{
+    QFile fp(filename);
+    if (!fp.open(QIODevice::WriteOnly))
+        return;
+    save_fp(fp);
+    fp.close();
+}
+
+// reads a count and that many bytes. the count is bounded by the bytes left
+// in the file.
+static bool read_bytes(QFile & fp, QDataStream & stream,
+                       std::vector<unsigned char> & v)
+{
+    quint32 size;
+    stream >> size;
+    if (stream.status() != QDataStream::Ok ||
+        int64_t(size) > fp.size() - fp.pos())
+        return false;
+    v.resize(size);
+    if (size == 0)
+        return true;
+    return stream.readRawData((char*)&v[0], int(size)) == int(size);
+}
+
+bool SparseVoxelOctree::load_fp(QFile & fp)
+{
+    clear();
+    QDataStream stream(&fp);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    qint32 new_depth;
+    stream >> new_depth;
+    stream >> x_size;
+    stream >> y_size;
+    stream >> z_size;
+    stream >> x_offset;
+    stream >> y_offset;
+    stream >> z_offset;
+    if (stream.status() != QDataStream::Ok ||
+        new_depth < 0 || new_depth > 30) {
+        clear();
+        return false;
+    }
+    depth = new_depth;
+    qint32 size = 1 << depth;
+    if (x_size < 0 || y_size < 0 || z_size < 0 ||
+        x_size > size || y_size > size || z_size > size) {
+        clear();
+        return false;
+    }
+    // every level holds one node per set bit of the level above, and the
+    // root level holds one node, or none for an empty model
+    levels.resize(depth);
+    quint32 count = 1;
+    for (int l = 0; l < depth; l++) {
+        SVOLevel & level = levels[l];
+        if (!read_bytes(fp, stream, level.masks) ||
+            (level.masks.size() != count &&
+             !(l == 0 && level.masks.empty()))) {
+            clear();
+            return false;
+        }
+        level.update_ranks();
+        count = level.get_rank(quint32(level.masks.size()));
+    }
+    if (depth == 0)
+        count = 0;
+    if (!read_bytes(fp, stream, colors) || colors.size() != count) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+bool SparseVoxelOctree::load(const QString & filename)
+{
+    QFile fp(filename);
+    if (!fp.open(QIODevice::ReadOnly))
+        return false;
+    bool ret = load_fp(fp);
+    fp.close();
+    return ret;
+}
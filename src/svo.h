@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_SVO_H
+#define VOXIE_SVO_H
+
+#include "voxel.h"
+
+#include <vector>
+
+// nodes are stored level by level in morton order, each as a byte with one
+// bit per non-empty child octant (x << 2 | y << 1 | z). the children of a
+// node follow each other on the next level, so the index of a child is the
+// number of children of all earlier nodes on the level, which is sampled
+// every SVO_RANK_STEP nodes and counted from the masks in between.
+#define SVO_RANK_SHIFT 5
+#define SVO_RANK_STEP (1 << SVO_RANK_SHIFT)
+
+class SVOLevel
+{
+public:
+    std::vector<unsigned char> masks;
+    std::vector<quint32> ranks;
+
+    void update_ranks();
+    quint32 get_rank(quint32 i);
+};
+
+class SVOHit
+{
+public:
+    ivec3 pos;
+    ivec3 normal;
+    float t;
+    unsigned char color;
+};
+
+class SparseVoxelOctree
+{
+public:
+    // the root covers 2^depth voxels along every axis. levels[depth - 1]
+    // holds nodes of 2^3 voxels, whose set bits index into colors.
+    int depth;
+    qint32 x_size, y_size, z_size;
+    qint32 x_offset, y_offset, z_offset;
+    std::vector<SVOLevel> levels;
+    std::vector<unsigned char> colors;
+
+    SparseVoxelOctree();
+    void clear();
+    void build(VoxelFile * file);
+    unsigned char get(int x, int y, int z);
+    bool raycast(const vec3 & pos, const vec3 & dir, SVOHit & hit);
+    size_t get_memory();
+    void save_fp(QFile & fp);
+    void save(const QString & filename);
+    bool load_fp(QFile & fp);
+    bool load(const QString & filename);
+    bool raycast_node(int level, quint32 node, const ivec3 & min,
+                      const vec3 & pos, const vec3 & inv_dir, float t_max,
+                      SVOHit & hit);
+};
+
+#endif // VOXIE_SVO_H
@@ -63,6 +63,23 @@ typedef unsigned __int64 uint64_t;
 
 #endif // _MSC_VER
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOXIE_SSE2
+#endif
+
+#ifdef VOXIE_SSE2
+#include <emmintrin.h>
+#endif
+
+// kernels for newer instruction sets are built with target attributes and
+// picked at runtime, see get_remap_bytes()
+#if defined(VOXIE_SSE2) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define VOXIE_CPU_DISPATCH
+#include <immintrin.h>
+#endif
+
 typedef std::vector<std::string> StringList;
 
 #endif // VOXIE_TYPES_H
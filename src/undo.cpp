@@ -0,0 +1,488 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "undo.h"
+
+#include <algorithm>
+#include <string.h>
+
+static inline void put_short(std::vector<unsigned char> & out, int v)
+{
+    out.push_back((unsigned char)(v & 0xFF));
+    out.push_back((unsigned char)(v >> 8));
+}
+
+static inline int get_short(const unsigned char * in)
+{
+    return in[0] | (in[1] << 8);
+}
+
+static inline int64_t get_brick_size(VoxelBrick * brick)
+{
+    if (brick == NULL)
+        return 0;
+    return int64_t(sizeof(VoxelBrick)) + brick->get_data_size();
+}
+
+static void share_slot(BrickSlot & dst, const BrickSlot & src)
+{
+    if (src.brick != NULL)
+        src.brick->refs.ref();
+    release_brick(dst.brick);
+    dst.brick = src.brick;
+    dst.fill = src.fill;
+}
+
+static void unpack_slot(const BrickSlot & slot, unsigned char * out)
+{
+    if (slot.brick == NULL)
+        memset(out, slot.fill, BRICK_VOLUME);
+    else
+        slot.brick->unpack(out);
+}
+
+static bool is_uniform(const unsigned char * data, int n)
+{
+    for (int i = 1; i < n; i++) {
+        if (data[i] != data[0])
+            return false;
+    }
+    return true;
+}
+
+static void put_voxels(std::vector<unsigned char> & out,
+                       const unsigned char * data, int n, bool uniform)
+{
+    if (uniform)
+        out.push_back(data[0]);
+    else
+        out.insert(out.end(), data, data + n);
+}
+
+// a brick is stored as its position and the number of runs, followed by
+// the runs. a run is the index of its first voxel in the unpacked brick,
+// its length minus one, flags for uniform old and new voxels, and then the
+// old and new voxels. runs may span several rows. a brick without runs
+// swaps one single color for another.
+#define RUN_OLD_UNIFORM 1
+#define RUN_NEW_UNIFORM 2
+
+static void put_header(std::vector<unsigned char> & out, const ivec3 & p,
+                       int runs)
+{
+    put_short(out, p.x);
+    put_short(out, p.y);
+    put_short(out, p.z);
+    put_short(out, runs);
+}
+
+static inline bool is_inside(int i, const ivec3 & size)
+{
+    return (i & BRICK_MASK) < size.z &&
+           ((i >> BRICK_SHIFT) & BRICK_MASK) < size.y &&
+           (i >> (BRICK_SHIFT * 2)) < size.x;
+}
+
+// appends the runs of voxels that differ between the unpacked bricks a and
+// b within size. returns the number of runs.
+static int encode_brick(const ivec3 & size, const unsigned char * a,
+                        const unsigned char * b,
+                        std::vector<unsigned char> & out)
+{
+    int runs = 0;
+    int i = 0;
+    while (i < BRICK_VOLUME) {
+        if (a[i] == b[i] || !is_inside(i, size)) {
+            i++;
+            continue;
+        }
+        int start = i;
+        while (i < BRICK_VOLUME && a[i] != b[i] && is_inside(i, size))
+            i++;
+        int n = i - start;
+        bool old_uniform = is_uniform(a + start, n);
+        bool new_uniform = is_uniform(b + start, n);
+        put_short(out, start);
+        put_short(out, n - 1);
+        out.push_back((unsigned char)((old_uniform ? RUN_OLD_UNIFORM : 0) |
+                                      (new_uniform ? RUN_NEW_UNIFORM : 0)));
+        put_voxels(out, a + start, n, old_uniform);
+        put_voxels(out, b + start, n, new_uniform);
+        runs++;
+    }
+    return runs;
+}
+
+// writes the old or new voxels of the runs to the file
+static void decode_runs(VoxelFile * file,
+                        const std::vector<unsigned char> & runs, bool redo)
+{
+    const unsigned char * in = runs.empty() ? NULL : &runs[0];
+    const unsigned char * end = in + runs.size();
+    while (in < end) {
+        ivec3 min, max;
+        file->get_brick_box(get_short(in), get_short(in + 2),
+                            get_short(in + 4), min, max);
+        int count = get_short(in + 6);
+        in += 8;
+        if (count == 0) {
+            file->fill(min.x, min.y, min.z, max.x, max.y, max.z,
+                       in[redo ? 1 : 0]);
+            in += 2;
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            int start = get_short(in);
+            int n = get_short(in + 2) + 1;
+            int flags = in[4];
+            in += 5;
+            const unsigned char * old_v = in;
+            in += (flags & RUN_OLD_UNIFORM) ? 1 : n;
+            const unsigned char * new_v = in;
+            in += (flags & RUN_NEW_UNIFORM) ? 1 : n;
+            const unsigned char * v = redo ? new_v : old_v;
+            bool uniform = (flags & (redo ? RUN_NEW_UNIFORM :
+                                            RUN_OLD_UNIFORM)) != 0;
+            if (uniform && n == BRICK_VOLUME) {
+                // a whole brick of one color goes back to being a tag
+                file->fill(min.x, min.y, min.z, max.x, max.y, max.z, *v);
+                continue;
+            }
+            // split the run into its rows
+            while (n > 0) {
+                int z = start & BRICK_MASK;
+                int len = std::min(BRICK_SIZE - z, n);
+                int x = min.x + (start >> (BRICK_SHIFT * 2));
+                int y = min.y + ((start >> BRICK_SHIFT) & BRICK_MASK);
+                if (uniform)
+                    file->fill_row(x, y, min.z + z, len, *v);
+                else {
+                    file->set_row(x, y, min.z + z, len, v);
+                    v += len;
+                }
+                start += len;
+                n -= len;
+            }
+        }
+    }
+}
+
+// size of the bricks only held by the history, and of the slots
+static int64_t get_file_size(VoxelFile * file)
+{
+    int64_t size = int64_t(file->bricks.size()) * sizeof(BrickSlot);
+    BrickSlots::const_iterator it;
+    for (it = file->bricks.begin(); it != file->bricks.end(); it++) {
+        VoxelBrick * brick = it->brick;
+        if (brick != NULL && !brick->is_shared())
+            size += get_brick_size(brick);
+    }
+    return size;
+}
+
+// true if a layout change left the voxels and offsets as they were
+static bool is_same_state(VoxelFile & a, VoxelFile & b)
+{
+    if (a.x_size != b.x_size || a.y_size != b.y_size ||
+        a.z_size != b.z_size || a.x_offset != b.x_offset ||
+        a.y_offset != b.y_offset || a.z_offset != b.z_offset)
+        return false;
+    unsigned char a_data[BRICK_VOLUME];
+    unsigned char b_data[BRICK_VOLUME];
+    for (int x = 0; x < a.x_bricks; x++)
+    for (int y = 0; y < a.y_bricks; y++)
+    for (int z = 0; z < a.z_bricks; z++) {
+        const BrickSlot & a_slot = a.get_slot(x, y, z);
+        const BrickSlot & b_slot = b.get_slot(x, y, z);
+        if (a_slot.brick == NULL && b_slot.brick == NULL) {
+            if (a_slot.fill != b_slot.fill)
+                return false;
+            continue;
+        }
+        if (a_slot.brick == b_slot.brick)
+            continue;
+        ivec3 min, max;
+        a.get_brick_box(x, y, z, min, max);
+        std::vector<unsigned char> runs;
+        unpack_slot(a_slot, a_data);
+        unpack_slot(b_slot, b_data);
+        if (encode_brick(max - min, a_data, b_data, runs) != 0)
+            return false;
+    }
+    return true;
+}
+
+// UndoStep
+
+UndoStep::UndoStep()
+: old_file(NULL), new_file(NULL), size(0)
+{
+}
+
+UndoStep::~UndoStep()
+{
+    std::vector<UndoBrick>::const_iterator it;
+    for (it = bricks.begin(); it != bricks.end(); it++) {
+        release_brick(it->old_brick);
+        release_brick(it->new_brick);
+    }
+    delete old_file;
+    delete new_file;
+}
+
+void UndoStep::apply(VoxelFile * file, bool redo)
+{
+    if (old_file != NULL) {
+        file->clone(redo ? *new_file : *old_file);
+        return;
+    }
+    decode_runs(file, runs, redo);
+    std::vector<UndoBrick>::const_iterator it;
+    for (it = bricks.begin(); it != bricks.end(); it++) {
+        const UndoBrick & b = *it;
+        if (redo)
+            file->share_brick(b.x, b.y, b.z, b.new_brick, b.new_fill);
+        else
+            file->share_brick(b.x, b.y, b.z, b.old_brick, b.old_fill);
+    }
+}
+
+void UndoStep::update_size()
+{
+    // drop the slack of the run buffer, it is never appended to again
+    std::vector<unsigned char>(runs).swap(runs);
+    size = int64_t(sizeof(UndoStep)) + int64_t(runs.size()) +
+           int64_t(bricks.size()) * sizeof(UndoBrick);
+    std::vector<UndoBrick>::const_iterator it;
+    for (it = bricks.begin(); it != bricks.end(); it++)
+        size += get_brick_size(it->old_brick) + get_brick_size(it->new_brick);
+    if (old_file != NULL)
+        size += get_file_size(old_file) + get_file_size(new_file);
+}
+
+// UndoJournal
+
+UndoJournal::UndoJournal(int64_t max_bytes)
+: epoch(0), enabled(false), size(0), max_bytes(max_bytes)
+{
+}
+
+UndoJournal::~UndoJournal()
+{
+    clear();
+}
+
+void UndoJournal::clear()
+{
+    while (!undo_steps.empty()) {
+        delete undo_steps.back();
+        undo_steps.pop_back();
+    }
+    while (!redo_steps.empty()) {
+        delete redo_steps.back();
+        redo_steps.pop_back();
+    }
+    size = 0;
+}
+
+// forgets the history and starts over from the current state of file
+void UndoJournal::reset(VoxelFile * file)
+{
+    clear();
+    enabled = file->pager == NULL;
+    if (enabled)
+        base.clone(*file);
+    else
+        base.free_bricks();
+    epoch = file->next_epoch();
+}
+
+void UndoJournal::set_limit(int64_t max_bytes)
+{
+    this->max_bytes = max_bytes;
+    trim();
+}
+
+void UndoJournal::trim()
+{
+    while (size > max_bytes && !undo_steps.empty()) {
+        size -= undo_steps.front()->size;
+        delete undo_steps.front();
+        undo_steps.pop_front();
+    }
+    // redo steps furthest away from the current state go next
+    while (size > max_bytes && !redo_steps.empty()) {
+        size -= redo_steps.front()->size;
+        delete redo_steps.front();
+        redo_steps.pop_front();
+    }
+}
+
+void UndoJournal::push(UndoStep * step)
+{
+    while (!redo_steps.empty()) {
+        size -= redo_steps.back()->size;
+        delete redo_steps.back();
+        redo_steps.pop_back();
+    }
+    step->update_size();
+    size += step->size;
+    undo_steps.push_back(step);
+    trim();
+}
+
+// records the difference of a brick between base and file
+void UndoJournal::add_brick(UndoStep * step, VoxelFile * file,
+                            const ivec3 & p)
+{
+    const BrickSlot & a = base.get_slot(p.x, p.y, p.z);
+    const BrickSlot & b = file->get_slot(p.x, p.y, p.z);
+    if (a.brick == b.brick && (a.brick != NULL || a.fill == b.fill))
+        return;
+    std::vector<unsigned char> & out = step->runs;
+    size_t start = out.size();
+    if (a.brick == NULL && b.brick == NULL) {
+        put_header(out, p, 0);
+        out.push_back(a.fill);
+        out.push_back(b.fill);
+        return;
+    }
+    ivec3 min, max;
+    file->get_brick_box(p.x, p.y, p.z, min, max);
+    unsigned char old_data[BRICK_VOLUME];
+    unsigned char new_data[BRICK_VOLUME];
+    unpack_slot(a, old_data);
+    unpack_slot(b, new_data);
+    put_header(out, p, 0);
+    int runs = encode_brick(max - min, old_data, new_data, out);
+    int64_t shared = get_brick_size(a.brick) + get_brick_size(b.brick);
+    if (runs != 0 && int64_t(out.size() - start) <= shared) {
+        out[start + 6] = (unsigned char)(runs & 0xFF);
+        out[start + 7] = (unsigned char)(runs >> 8);
+        return;
+    }
+    out.resize(start);
+    if (runs == 0)
+        return;
+    // cheaper to keep both bricks around
+    UndoBrick brick;
+    brick.x = p.x;
+    brick.y = p.y;
+    brick.z = p.z;
+    brick.old_brick = a.brick;
+    brick.new_brick = b.brick;
+    brick.old_fill = a.fill;
+    brick.new_fill = b.fill;
+    if (a.brick != NULL)
+        a.brick->refs.ref();
+    if (b.brick != NULL)
+        b.brick->refs.ref();
+    step->bricks.push_back(brick);
+}
+
+// brings base up to date with the changed bricks of file
+void UndoJournal::sync(VoxelFile * file, const std::vector<ivec3> & changed)
+{
+    std::vector<ivec3>::const_iterator it;
+    for (it = changed.begin(); it != changed.end(); it++)
+        share_slot(base.get_slot(it->x, it->y, it->z),
+                   file->get_slot(it->x, it->y, it->z));
+    memcpy(base.color_counts, file->color_counts, sizeof(base.color_counts));
+    base.x_counts = file->x_counts;
+    base.y_counts = file->y_counts;
+    base.z_counts = file->z_counts;
+    base.points = file->points;
+}
+
+// records everything written to file since the last commit as a step
+void UndoJournal::commit(VoxelFile * file)
+{
+    // paging starts or stops with some of the layout changes
+    if (enabled != (file->pager == NULL)) {
+        reset(file);
+        return;
+    }
+    if (!enabled)
+        return;
+    std::vector<ivec3> changed;
+    if (!file->get_changes(epoch, changed)) {
+        if (is_same_state(base, *file)) {
+            base.clone(*file);
+            epoch = file->next_epoch();
+            return;
+        }
+        UndoStep * step = new UndoStep;
+        step->old_file = new VoxelFile;
+        step->old_file->clone(base);
+        step->new_file = new VoxelFile;
+        step->new_file->clone(*file);
+        base.clone(*file);
+        push(step);
+    } else if (!changed.empty()) {
+        UndoStep * step = new UndoStep;
+        std::vector<ivec3>::const_iterator it;
+        for (it = changed.begin(); it != changed.end(); it++)
+            add_brick(step, file, *it);
+        sync(file, changed);
+        if (step->runs.empty() && step->bricks.empty())
+            delete step;
+        else
+            push(step);
+    }
+    epoch = file->next_epoch();
+}
+
+void UndoJournal::apply(VoxelFile * file, UndoStep * step, bool redo)
+{
+    step->apply(file, redo);
+    std::vector<ivec3> changed;
+    if (file->get_changes(epoch, changed))
+        sync(file, changed);
+    else
+        base.clone(*file);
+    epoch = file->next_epoch();
+}
+
+// reverts the last step. anything not committed yet is committed first.
+bool UndoJournal::undo(VoxelFile * file)
+{
+    commit(file);
+    if (!enabled || undo_steps.empty())
+        return false;
+    UndoStep * step = undo_steps.back();
+    undo_steps.pop_back();
+    apply(file, step, false);
+    redo_steps.push_back(step);
+    return true;
+}
+
+bool UndoJournal::redo(VoxelFile * file)
+{
+    commit(file);
+    if (!enabled || redo_steps.empty())
+        return false;
+    UndoStep * step = redo_steps.back();
+    redo_steps.pop_back();
+    apply(file, step, true);
+    undo_steps.push_back(step);
+    return true;
+}
@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef VOXIE_UNDO_H
+#define VOXIE_UNDO_H
+
+#include "voxel.h"
+
+#include <deque>
+#include <vector>
+
+// default size of the undo history in bytes
+#define UNDO_MEMORY_LIMIT (int64_t(64) << 20)
+
+// a brick that changed too much to be stored as runs. the bricks are
+// shared with the files, or NULL for single-color bricks.
+class UndoBrick
+{
+public:
+    qint32 x, y, z;
+    VoxelBrick * old_brick;
+    VoxelBrick * new_brick;
+    unsigned char old_fill, new_fill;
+};
+
+// the difference between two states of a model. runs holds the rows that
+// changed in a brick along with their old and new voxels, see
+// encode_brick(). layout changes keep both states as clones instead.
+class UndoStep
+{
+public:
+    std::vector<unsigned char> runs;
+    std::vector<UndoBrick> bricks;
+    VoxelFile * old_file;
+    VoxelFile * new_file;
+    int64_t size;
+
+    UndoStep();
+    ~UndoStep();
+    void apply(VoxelFile * file, bool redo);
+    void update_size();
+};
+
+// undo history of a model. commit() records everything written since the
+// last commit as one step, by comparing the model with 'base', a clone
+// that shares all unchanged bricks. the oldest steps are dropped once the
+// history takes more than max_bytes. paged models keep no history.
+class UndoJournal
+{
+public:
+    VoxelFile base;
+    quint64 epoch;
+    bool enabled;
+    std::deque<UndoStep*> undo_steps;
+    std::deque<UndoStep*> redo_steps;
+    int64_t size, max_bytes;
+
+    UndoJournal(int64_t max_bytes = UNDO_MEMORY_LIMIT);
+    ~UndoJournal();
+    void reset(VoxelFile * file);
+    void clear();
+    void set_limit(int64_t max_bytes);
+    void commit(VoxelFile * file);
+    bool undo(VoxelFile * file);
+    bool redo(VoxelFile * file);
+    void add_brick(UndoStep * step, VoxelFile * file, const ivec3 & p);
+    void push(UndoStep * step);
+    void apply(VoxelFile * file, UndoStep * step, bool redo);
+    void sync(VoxelFile * file, const std::vector<ivec3> & changed);
+    void trim();
+};
+
+#endif // VOXIE_UNDO_H
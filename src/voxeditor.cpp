@@ -26,6 +26,11 @@ THE SOFTWARE.
 #include "draw.h"
 #include "modelproperties.h"
 #include "collision.h"
+#include "palette.h"
+#include "components.h"
+#include "undo.h"
+#include "selection.h"
+#include "diff.h"
 #include <btBulletDynamicsCommon.h>
 #include <LinearMath/btGeometryUtil.h>
 
@@ -39,6 +44,7 @@ THE SOFTWARE.
 #include <QRubberBand>
 #include <QApplication>
 #include <QClipboard>
+#include <QMimeData>
 
 #define CAMERA_ROTATION_SPEED 0.25f
 #define CAMERA_MOVE_SPEED 1.0f
@@ -54,15 +60,21 @@ THE SOFTWARE.
 
 // static variable
 
-SelectedVoxels VoxelEditor::copied_list;
+VoxelSelection VoxelEditor::copied;
 
 VoxelEditor::VoxelEditor(MainWindow * parent)
 : QGLWidget(parent->gl_format, parent, parent->shared_gl), scale(10.0f), 
-  rotate_x(-58.0f), rotate_z(-143.0f), window(parent), pos_arrows(0.05f)
+  rotate_x(-58.0f), rotate_z(-143.0f), window(parent), pos_arrows(0.05f),
+  has_line(false)
 {
     setFocusPolicy(Qt::StrongFocus);
     setMouseTracking(true);
     voxel = new VoxelFile();
+    history = new UndoJournal();
+    selection = new VoxelSelection();
+    changes = new VoxelDiff();
+    changes_editor = NULL;
+    changes_file = NULL;
     rubberband = new QRubberBand(QRubberBand::Rectangle);
     rubberband->setWindowOpacity((qreal)0.5);
     rubberband->setWindowFlags(Qt::ToolTip);
@@ -74,6 +86,7 @@ void VoxelEditor::load(const QString & filename)
     current_model = filename;
     if (!voxel->load(filename))
         reset();
+    history->reset(voxel);
     set_window_file_path(this, current_model);
 }
 
@@ -81,23 +94,64 @@ void VoxelEditor::reset()
 {
     voxel->reset(16, 16, 16);
     voxel->set_offset(-8, -8, 0);
+    history->reset(voxel);
     setWindowModified(true);
 }
 
 void VoxelEditor::clone(VoxelFile * other)
 {
     voxel->clone(*other);
+    history->reset(voxel);
     setWindowModified(true);
 }
 
 void VoxelEditor::on_changed()
 {
+    // a stroke becomes a single step once the mouse is released
+    if (QApplication::mouseButtons() == Qt::NoButton)
+        commit_history();
     update();
+    // color usage markers depend on the voxel counts
+    window->palette_editor->grid->update();
     setWindowModified(true);
 }
 
+// selected voxels are lifted out of the model, so nothing is recorded until
+// they are put down again
+void VoxelEditor::commit_history()
+{
+    if (selection->empty())
+        history->commit(voxel);
+}
+
+// the selection is put down first, so it becomes part of the last step
+void VoxelEditor::undo()
+{
+    deselect();
+    if (!history->undo(voxel)) {
+        window->set_status("Nothing to undo");
+        return;
+    }
+    window->model_properties->update_controls();
+    on_changed();
+}
+
+void VoxelEditor::redo()
+{
+    deselect();
+    if (!history->redo(voxel)) {
+        window->set_status("Nothing to redo");
+        return;
+    }
+    window->model_properties->update_controls();
+    on_changed();
+}
+
 VoxelEditor::~VoxelEditor()
 {
+    delete changes;
+    delete selection;
+    delete history;
     delete voxel;
 }
 
@@ -139,22 +193,16 @@ void VoxelEditor::paintGL()
 
     glEnable(GL_LIGHTING);
     setup_lighting();
-    model->draw_immediate();
-
-    SelectedVoxels::const_iterator it;
-    for (it = selected_list.begin(); it != selected_list.end(); it++) {
-        const SelectedVoxel & v = *it;
-        RGBColor & c = global_palette[v.v];
-        draw_cube(v.x, v.y, v.z, v.x + 1.0f, v.y + 1.0f, v.z + 1.0f,
-            c.r, c.g, c.b, 255);
-        glDisable(GL_LIGHTING);
-        draw_wireframe_cube(v.x, v.y, v.z, v.x + 1.0f, v.y + 1.0f, v.z + 1.0f,
-            255, 255, 255, 255);
-        glEnable(GL_LIGHTING);
-    }
+    model->draw();
+
+    if (!selection->empty())
+        selection->draw();
 
     glDisable(GL_LIGHTING);
 
+    if (window->show_changes_action->isChecked())
+        draw_changes();
+
     glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
     vec3 min = voxel->get_min();
     vec3 max = voxel->get_max();
@@ -212,7 +260,7 @@ void VoxelEditor::paintGL()
 
     glDisable(GL_DEPTH_TEST);
 
-    if (selected_list.size() > 0)
+    if (!selection->empty())
         pos_arrows.draw();
 
     if (window->test_current_window(this)) {
@@ -256,6 +304,27 @@ void VoxelEditor::keyPressEvent(QKeyEvent *e)
             if (e->modifiers() & Qt::ControlModifier)
                 paste();
             break;
+        case Qt::Key_Z:
+            if (!(e->modifiers() & Qt::ControlModifier))
+                break;
+            if (e->modifiers() & Qt::ShiftModifier)
+                redo();
+            else
+                undo();
+            break;
+        case Qt::Key_Y:
+            if (e->modifiers() & Qt::ControlModifier)
+                redo();
+            break;
+        case Qt::Key_I:
+            select_island();
+            break;
+        case Qt::Key_BracketLeft:
+            window->resize_brush(-1);
+            break;
+        case Qt::Key_BracketRight:
+            window->resize_brush(1);
+            break;
         case Qt::Key_Insert:
             use_tool_primary(true);
             break;
@@ -274,13 +343,6 @@ void VoxelEditor::keyPressEvent(QKeyEvent *e)
     }
 }
 
-btCollisionObject * VoxelEditor::get_collision_object()
-{
-    static btCollisionObject * obj = new btCollisionObject();
-    obj->setCollisionShape(voxel->get_shape());
-    return obj;
-}
-
 ivec3 VoxelEditor::get_pos_vec(const vec3 & v)
 {
     int x = int(v.x - voxel->x_offset);
@@ -295,59 +357,48 @@ void VoxelEditor::update_hit()
     vec3 dir, pos;
     vec2 win_pos(last_pos.x(), height() - last_pos.y());
     get_window_ray(win_pos, inverse_mvp, viewport, pos, dir);
-    btCollisionObject * obj = get_collision_object();
-
-    btTransform from_trans;
-    btVector3 from_vec = convert_vec(pos);
-    from_trans.setIdentity();
-    from_trans.setOrigin(from_vec);
-
-    btTransform to_trans;
-    btVector3 to_vec = convert_vec(pos + dir * float(1e12));
-    to_trans.setIdentity();
-    to_trans.setOrigin(to_vec);
-
-    btTransform obj_trans;
-    obj_trans.setIdentity();
-
-    btCollisionWorld::ClosestRayResultCallback callback(from_vec, to_vec);
-
-    btCollisionWorld::rayTestSingle(from_trans, to_trans, obj, 
-        obj->getCollisionShape(), obj_trans, callback);
-    if (!callback.hasHit()) {
-        vec3 min = voxel->get_min();
-        vec3 max = voxel->get_max();
-        btStaticPlaneShape plane(btVector3(0.0f, 0.0f, 1.0f), min.z);
-        obj->setCollisionShape(&plane);
-        btCollisionWorld::rayTestSingle(from_trans, to_trans, obj, 
-            obj->getCollisionShape(), obj_trans, callback);
-        if (!callback.hasHit())
-            return;
-        float x = callback.m_hitPointWorld.x();
-        float y = callback.m_hitPointWorld.y();
-        if (x >= max.x || x < min.x ||
-            y >= max.y || y < min.y)
-            return;
-        hit_floor = true;
+
+    vec3 offset(voxel->x_offset, voxel->y_offset, voxel->z_offset);
+    ivec3 hit_normal;
+    if (voxel->raycast(pos - offset, dir, hit_block, hit_normal)) {
+        hit_next = hit_block + hit_normal;
+        has_hit = true;
+        return;
     }
-    vec3 hit_normal = convert_vec(callback.m_hitNormalWorld);
-    vec3 hit_pos = convert_vec(callback.m_hitPointWorld);
-    hit_next = get_pos_vec(hit_pos + hit_normal * 0.1f);
-    hit_block = get_pos_vec(hit_pos - hit_normal * 0.1f);
+
+    // the floor of the model, seen from above
+    if (dir.z >= 0.0f)
+        return;
+    vec3 min = voxel->get_min();
+    vec3 max = voxel->get_max();
+    vec3 floor_normal(0.0f, 0.0f, 1.0f);
+    vec3 hit_pos;
+    test_ray_plane(pos, dir, min, floor_normal, hit_pos);
+    if (hit_pos.x >= max.x || hit_pos.x < min.x ||
+        hit_pos.y >= max.y || hit_pos.y < min.y)
+        return;
+    hit_floor = true;
+    hit_next = get_pos_vec(hit_pos + floor_normal * 0.1f);
+    hit_block = get_pos_vec(hit_pos - floor_normal * 0.1f);
     has_hit = true;
 }
 
+// other instances read the clipboard, while pasting here shares the
+// bricks of the copy
 void VoxelEditor::copy_selected()
 {
-    QClipboard * clipboard = QApplication::clipboard();
-    clipboard->clear();
-    copied_list = selected_list;
+    copied.copy(*selection);
+    QByteArray data;
+    selection->write(data);
+    QMimeData * mime = new QMimeData;
+    mime->setData(SELECTION_MIME_TYPE, data);
+    QApplication::clipboard()->setMimeData(mime);
     window->set_status("Copied voxels");
 }
 
 void VoxelEditor::delete_selected()
 {
-    selected_list.clear();
+    selection->clear();
     window->set_status("Deleted voxels");
     on_changed();
 }
@@ -356,46 +407,45 @@ void VoxelEditor::paste()
 {
     deselect();
 
-    // test for image in clipboard
     QClipboard * clipboard = QApplication::clipboard();
-    QImage img = clipboard->image();
-    if (img.isNull()) {
-        // paste whatever we have in the internal copied list
-        selected_list = copied_list;
-    } else {
-        // paste image from clipboard
-        selected_list.clear();
-        SelectedVoxel voxel;
+    const QMimeData * mime = clipboard->mimeData();
+    if (mime == NULL)
+        return;
+    if (mime->hasFormat(SELECTION_MIME_TYPE)) {
+        if (clipboard->ownsClipboard())
+            selection->copy(copied);
+        else if (!selection->read(mime->data(SELECTION_MIME_TYPE))) {
+            window->set_status("Invalid voxels in clipboard");
+            return;
+        }
+    } else if (mime->hasImage()) {
+        // paste image from clipboard, standing up on the xz plane
+        QImage img = clipboard->image();
+        int height = img.height();
+        selection->reset(ivec3(0, 0, 1), ivec3(img.width(), 1, height + 1));
         for (int x = 0; x < img.width(); x++)
-        for (int y = 0; y < img.height(); y++) {
+        for (int y = 0; y < height; y++) {
             QColor pixel = QColor(img.pixel(x, y));
             if (pixel.alpha() <= 0)
                 continue;
             RGBColor c(pixel.red(), pixel.green(), pixel.blue());
             unsigned char cc = VoxelFile::get_closest_index(c);
-            voxel.x = x;
-            voxel.y = 0;
-            voxel.z = img.height() - y;
-            voxel.v = cc;
-            selected_list.push_back(voxel);
+            selection->voxels->set_fast(x, 0, height - 1 - y, cc);
         }
-    }
+        selection->finish();
+    } else
+        return;
     window->set_status("Pasted voxels");
     on_changed();
 }
 
 void VoxelEditor::deselect()
 {
-    SelectedVoxels::const_iterator it;
-    for (it = selected_list.begin(); it != selected_list.end(); it++) {
-        const SelectedVoxel & v = *it;
-        voxel->set(v.x - voxel->x_offset,
-                   v.y - voxel->y_offset, 
-                   v.z - voxel->z_offset, 
-                   v.v);
+    if (!selection->empty()) {
+        selection->apply(voxel);
+        selection->clear();
     }
-    selected_list.clear();
-    voxel->reset_shape();
+    commit_history();
     update();
 }
 
@@ -413,8 +463,6 @@ void add_frustum_vertices(int x, int y, const mat4 & inverse_mvp,
 
 void VoxelEditor::update_drag()
 {
-    deselect();
-
     int x1, y1, x2, y2;
     x1 = start_drag.x();
     y1 = height() - start_drag.y();
@@ -432,51 +480,93 @@ void VoxelEditor::update_drag()
 
     btGeometryUtil::getPlaneEquationsFromVertices(vertices, bt_planes);
 
-    if (bt_planes.size() != 6)
-        return;
-
+    // without a volume, the band selects nothing
     vec4 planes[6];
+    for (int i = 0; i < 6; i++) {
+        if (bt_planes.size() != 6)
+            planes[i] = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        else
+            planes[i] = vec4(bt_planes[i].x(),
+                             bt_planes[i].y(),
+                             bt_planes[i].z(),
+                             bt_planes[i].w());
+    }
 
-    for (int i = 0; i < 6; i++)
-        planes[i] = vec4(bt_planes[i].x(),
-                         bt_planes[i].y(),
-                         bt_planes[i].z(),
-                         bt_planes[i].w());
-    
-    vec3 global_min, global_max;
-    bool global_set = false;
-
-    for (int x = 0; x < voxel->x_size; x++)
-    for (int y = 0; y < voxel->y_size; y++)
-    for (int z = 0; z < voxel->z_size; z++) {
-        unsigned char & v = voxel->get(x, y, z);
-        if (v == VOXEL_AIR)
-            continue;
-        int x2, y2, z2;
-        x2 = x + voxel->x_offset;
-        y2 = y + voxel->y_offset;
-        z2 = z + voxel->z_offset;
-        vec3 min(x2, y2, z2);
-        vec3 max = min + vec3(1.0f);
-        if (!test_aabb_frustum(min, max, planes))
-            continue;
-        selected_list.push_back(SelectedVoxel(x2, y2, z2, v));
-        v = VOXEL_AIR;
-        if (!global_set) {
-            global_min = min;
-            global_max = max;
-            global_set = true;
-        } else {
-            global_min = glm::min(global_min, min);
-            global_max = glm::max(global_max, max);
-        }
+    selection->select_frustum(voxel, planes);
+    ivec3 min, max;
+    if (selection->voxels->get_solid_bounds(min, max)) {
+        vec3 offset(voxel->x_offset, voxel->y_offset, voxel->z_offset);
+        pos_arrows.set_pos(vec3(min + max) * 0.5f + offset);
     }
 
-    pos_arrows.set_pos((global_min + global_max) * 0.5f);
+    update();
+}
+
+// outlines the voxels that changed since the previous animation frame,
+// added ones in green, removed ones in red and recolored ones in blue. the
+// changes are only compared again once either model has been written to.
+void VoxelEditor::draw_changes()
+{
+    VoxelEditor * other = window->get_previous_editor(this);
+    if (other == NULL)
+        return;
+    VoxelFile * old_file = other->voxel;
+    if (other != changes_editor || old_file != changes_file ||
+        old_file->layout_epoch != changes_layout ||
+        voxel->has_changes(changes_epoch) ||
+        old_file->has_changes(changes_old_epoch)) {
+        changes->build(old_file, voxel);
+        changes_editor = other;
+        changes_file = old_file;
+        changes_layout = old_file->layout_epoch;
+        changes_epoch = voxel->next_epoch();
+        changes_old_epoch = old_file->next_epoch();
+    }
+    static const unsigned char colors[3][3] = {
+        {GREEN_R, GREEN_G, GREEN_B},
+        {RED_R, RED_G, RED_B},
+        {BLUE_R, BLUE_G, BLUE_B}
+    };
+    std::vector<DiffRun>::const_iterator it;
+    for (it = changes->runs.begin(); it != changes->runs.end(); it++) {
+        const unsigned char * c = colors[it->type];
+        draw_wireframe_cube(it->x, it->y, it->z, it->x + 1.0f, it->y + 1.0f,
+                            float(it->z + it->length), c[0], c[1], c[2], 255);
+    }
+}
 
+// lifts the island under the cursor into the selection
+void VoxelEditor::select_island()
+{
+    if (!has_hit || hit_floor)
+        return;
+    deselect();
+    VoxelComponents components;
+    components.build(voxel, true);
+    int island = components.get(hit_block.x, hit_block.y, hit_block.z);
+    if (island < 0)
+        return;
+    std::vector<ivec3> voxels;
+    components.get_voxels(island, voxels);
+    ivec3 offset(voxel->x_offset, voxel->y_offset, voxel->z_offset);
+    ivec3 min = components.mins[island] + offset;
+    ivec3 max = components.maxs[island] + offset;
+    selection->reset(min, max);
+    std::vector<ivec3>::const_iterator it;
+    for (it = voxels.begin(); it != voxels.end(); it++)
+        selection->lift(voxel, it->x, it->y, it->z);
+    selection->finish();
+    pos_arrows.set_pos(vec3(min + max) * 0.5f);
+    window->set_status("Selected island");
     update();
 }
 
+// returns false if nothing is selected
+bool VoxelEditor::remap_selected(const unsigned char * table)
+{
+    return selection->remap(table);
+}
+
 void VoxelEditor::mousePressEvent(QMouseEvent *event)
 {
     last_pos = event->pos();
@@ -493,38 +583,13 @@ void VoxelEditor::offset_selected(int dx, int dy, int dz)
 {
     if (dx == 0 && dy == 0 && dz == 0)
         return;
-    SelectedVoxels::iterator it;
-    for (it = selected_list.begin(); it != selected_list.end(); it++) {
-        SelectedVoxel & v = *it;
-        v.x += dx;
-        v.y += dy;
-        v.z += dz;
-    }
+    // only the translation moves, the voxels stay where they are
+    selection->translation += ivec3(dx, dy, dz);
     on_changed();
 }
 
-struct FillNode
-{
-    int x, y, z;
-
-    FillNode(int x, int y, int z) 
-    : x(x), y(y), z(z)
-    {
-    }
-};
-
-inline void add_node(int x, int y, int z, VoxelFile * voxel,
-                     unsigned char col, std::vector<FillNode> & nodes)
-{
-    if (x < 0 || x >= voxel->x_size ||
-        y < 0 || y >= voxel->y_size ||
-        z < 0 || z >= voxel->z_size)
-        return;
-    if (voxel->get(x, y, z) != col)
-        return;
-    nodes.push_back(FillNode(x, y, z));
-}
-
+// fills inside the bounds of the selection, if there is one. with shift
+// held, every voxel of the clicked color is replaced, connected or not.
 void VoxelEditor::flood_fill(int x, int y, int z)
 {
     unsigned char col = voxel->get(x, y, z);
@@ -533,28 +598,18 @@ void VoxelEditor::flood_fill(int x, int y, int z)
     unsigned char new_col = window->get_palette_index();
     if (col == new_col)
         return;
-    std::vector<FillNode> nodes;
-
-    add_node(x, y, z, voxel, col, nodes);
-    
-    while (!nodes.empty()) {
-        FillNode & node = nodes.back();
-        x = node.x;
-        y = node.y;
-        z = node.z;
-        nodes.pop_back();
-        unsigned char & c = voxel->get(x, y, z);
-        if (c == new_col)
-            continue;
-        c = new_col;
-
-        add_node(x, y, z - 1, voxel, col, nodes);
-        add_node(x, y - 1, z, voxel, col, nodes);
-        add_node(x, y + 1, z, voxel, col, nodes);
-        add_node(x - 1, y, z, voxel, col, nodes);
-        add_node(x + 1, y, z, voxel, col, nodes);
-        add_node(x, y, z + 1, voxel, col, nodes);
+    ivec3 min(0);
+    ivec3 max(voxel->x_size, voxel->y_size, voxel->z_size);
+    if (!selection->empty()) {
+        ivec3 offset(voxel->x_offset, voxel->y_offset, voxel->z_offset);
+        selection->get_bounds(min, max);
+        min -= offset;
+        max -= offset;
     }
+    if (QApplication::keyboardModifiers() & Qt::ShiftModifier)
+        voxel->replace_color(col, new_col, min, max);
+    else
+        voxel->flood_fill(x, y, z, new_col, min, max);
 }
 
 void VoxelEditor::use_tool_primary(bool click)
@@ -569,7 +624,7 @@ void VoxelEditor::use_tool_primary(bool click)
         vec3 pos, dir;
         get_window_ray(mouse, inverse_mvp, viewport, pos, dir);
 
-        if (selected_list.size() > 0) {
+        if (!selection->empty()) {
             if (click)
                 pos_arrows.on_mouse_press(pos, dir);
             else {
@@ -587,6 +642,7 @@ void VoxelEditor::use_tool_primary(bool click)
         }
 
         if (click) {
+            deselect();
             start_drag = last_pos;
             rubberband->move(mapToGlobal(start_drag));
             rubberband->resize(0, 0);
@@ -600,6 +656,11 @@ void VoxelEditor::use_tool_primary(bool click)
         return;
     }
 
+    if (tool == BRUSH_EDIT_TOOL) {
+        use_brush(click, false);
+        return;
+    }
+
     if (!has_hit)
         return;
 
@@ -621,7 +682,6 @@ void VoxelEditor::use_tool_primary(bool click)
         flood_fill(hit_x, hit_y, hit_z);
     else
         voxel->set(hit_x, hit_y, hit_z, window->get_palette_index());
-    voxel->reset_shape();
 
     update_hit();
     on_changed();
@@ -629,22 +689,27 @@ void VoxelEditor::use_tool_primary(bool click)
 
 void VoxelEditor::pick_color()
 {
+    if (!voxel->is_solid(hit_block.x, hit_block.y, hit_block.z))
+        return;
     int i = voxel->get(hit_block.x, hit_block.y, hit_block.z);
     window->set_palette_index(i);
 }
 
 void VoxelEditor::use_tool_secondary(bool click)
 {
+    int tool = window->get_tool();
+    if (tool == BRUSH_EDIT_TOOL) {
+        use_brush(click, true);
+        return;
+    }
+
     if (!has_hit)
         return;
     if (!click)
         return;
 
-    int tool = window->get_tool();
-
     if (tool == BLOCK_EDIT_TOOL) {
         voxel->set(hit_block.x, hit_block.y, hit_block.z, VOXEL_AIR);
-        voxel->reset_shape();
         update_hit();
         on_changed();
     } else if (tool == PENCIL_EDIT_TOOL) {
@@ -652,6 +717,51 @@ void VoxelEditor::use_tool_secondary(bool click)
     }
 }
 
+// brushes are stamped once per position while dragging. lines go from
+// where the button is pressed to where it is released.
+void VoxelEditor::use_brush(bool click, bool erase)
+{
+    if (!has_hit || (erase && hit_floor))
+        return;
+    ivec3 pos = erase ? hit_block : hit_next;
+    unsigned char v = erase ? VOXEL_AIR : window->get_palette_index();
+    VoxelBrush & brush = window->brush;
+    if (brush.shape == LINE_BRUSH) {
+        if (click) {
+            has_line = true;
+            line_start = pos;
+            line_value = v;
+        }
+        return;
+    }
+    if (!click && pos == last_brush)
+        return;
+    last_brush = pos;
+    ivec3 min, max;
+    if (!brush.apply(voxel, pos, pos, v, min, max))
+        return;
+    update_hit();
+    on_changed();
+}
+
+void VoxelEditor::end_line()
+{
+    if (!has_line)
+        return;
+    has_line = false;
+    if (!has_hit)
+        return;
+    bool erase = line_value == VOXEL_AIR;
+    if (erase && hit_floor)
+        return;
+    ivec3 pos = erase ? hit_block : hit_next;
+    ivec3 min, max;
+    if (!window->brush.apply(voxel, line_start, pos, line_value, min, max))
+        return;
+    update_hit();
+    on_changed();
+}
+
 void VoxelEditor::mouseMoveEvent(QMouseEvent * e)
 {
     QPoint dpos = e->pos() - last_pos;
@@ -682,7 +792,7 @@ void VoxelEditor::mouseMoveEvent(QMouseEvent * e)
     } else {
         if (left) {
             use_tool_primary(false);
-        } else {
+        } else if (right) {
             use_tool_secondary(false);
         }
     }
@@ -690,7 +800,13 @@ void VoxelEditor::mouseMoveEvent(QMouseEvent * e)
 
 void VoxelEditor::mouseReleaseEvent(QMouseEvent * e)
 {
-    rubberband->hide();
+    if (rubberband->isVisible()) {
+        rubberband->hide();
+        // the drag is over, so the selection can shrink to its voxels
+        selection->finish();
+    }
+    end_line();
+    commit_history();
     if (pos_arrows.pan != NONE_CONE) {
         pos_arrows.on_mouse_release();
         update();
@@ -27,25 +27,13 @@ THE SOFTWARE.
 
 class VoxelFile;
 class VoxelModel;
+class UndoJournal;
+class VoxelSelection;
+class VoxelDiff;
 class MainWindow;
-class btCollisionObject;
 class QPaintEvent;
 class QRubberBand;
 
-class SelectedVoxel
-{
-public:
-    int x, y, z;
-    unsigned char v;
-
-    SelectedVoxel(int x = 0, int y = 0, int z = 0, unsigned char v = 0)
-    : x(x), y(y), z(z), v(v)
-    {
-    }
-};
-
-typedef std::vector<SelectedVoxel> SelectedVoxels;
-
 class VoxelEditor : public QGLWidget
 {
     Q_OBJECT
@@ -57,6 +45,7 @@ public:
 
     VoxelFile * voxel;
     VoxelModel * model;
+    UndoJournal * history;
 
     mat4 projection_matrix, view_matrix, mvp, inverse_mvp;
     vec4 viewport;
@@ -72,18 +61,35 @@ public:
 
     QRubberBand * rubberband;
     QPoint start_drag;
-    SelectedVoxels selected_list;
-    static SelectedVoxels copied_list;
+    VoxelSelection * selection;
+    static VoxelSelection copied;
     PositionArrows pos_arrows;
 
+    // changes since the previous animation frame, see draw_changes(). the
+    // frame is known by its editor, file and layout epoch, since a closed
+    // editor or file may leave its address to a new one.
+    VoxelDiff * changes;
+    VoxelEditor * changes_editor;
+    VoxelFile * changes_file;
+    quint64 changes_layout, changes_epoch, changes_old_epoch;
+
     QPoint last_pos;
 
+    ivec3 last_brush;
+    bool has_line;
+    ivec3 line_start;
+    unsigned char line_value;
+
     VoxelEditor(MainWindow * parent);
     void load(const QString & name);
     void reset();
     void clone(VoxelFile * other);
     void on_changed();
+    void commit_history();
     void update_hit();
+    bool remap_selected(const unsigned char * table);
+    void undo();
+    void redo();
     ~VoxelEditor();
 
 protected:
@@ -92,7 +98,6 @@ protected:
     void paintEvent(QPaintEvent * e);
     void resizeGL(int w, int h);
     void keyPressEvent(QKeyEvent *e);
-    btCollisionObject * get_collision_object();
     ivec3 get_pos_vec(const vec3 & v);
     void update_drag();
     void offset_selected(int dx, int dy, int dz);
@@ -102,6 +107,8 @@ protected:
     void pick_color();
     void use_tool_primary(bool click);
     void use_tool_secondary(bool click);
+    void use_brush(bool click, bool erase);
+    void end_line();
     void wheelEvent(QWheelEvent * e);
     void closeEvent(QCloseEvent *event);
     void deselect();
@@ -109,6 +116,8 @@ protected:
     void delete_selected();
     void paste();
     void flood_fill(int x, int y, int z);
+    void select_island();
+    void draw_changes();
 
 public slots:
     void save();
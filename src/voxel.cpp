@@ -23,8 +23,13 @@ THE SOFTWARE.
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <deque>
 
 #include "voxel.h"
+#include "pager.h"
+#include "parallel.h"
+#include "collision.h"
+#include "morphology.h"
 #include <QDataStream>
 
 RGBColor * global_palette = NULL;
@@ -49,259 +54,1941 @@ void write_cstring(QDataStream & stream, const QString & v)
     stream.writeRawData(bytes.constData(), bytes.size() + 1);
 }
 
+// epochs are global, so they stay comparable when bricks move between files
+static quint64 global_epoch = 0;
+
+int64_t VoxelFile::memory_limit = int64_t(1) << 30;
+
 // VoxelModel
 
 VoxelModel::VoxelModel(VoxelFile * file)
-: file(file), value(0)
+: file(file), value(0), lists(0), epoch(0)
 {
 }
 
 void VoxelModel::draw_immediate(float alpha, bool offset)
 {
-    int x_offset, y_offset, z_offset;
-    if (offset) {
-        x_offset = file->x_offset;
-        y_offset = file->y_offset;
-        z_offset = file->z_offset;
-    } else
-        x_offset = y_offset = z_offset = 0;
-
-    glBegin(GL_QUADS);
+    ivec3 off(0);
+    if (offset)
+        off = ivec3(file->x_offset, file->y_offset, file->z_offset);
     unsigned char alpha_c = (unsigned char)(alpha * 255.0f);
+    glBegin(GL_QUADS);
+    draw_region(ivec3(0), ivec3(file->x_size, file->y_size, file->z_size),
+                alpha_c, off);
+    glEnd();
+}
+
+void VoxelModel::draw_region(const ivec3 & min, const ivec3 & max,
+                             unsigned char alpha_c, const ivec3 & offset)
+{
+    int x_offset = offset.x;
+    int y_offset = offset.y;
+    int z_offset = offset.z;
+    int x, y, z, w;
+    int w1 = min.z >> SOLID_WORD_SHIFT;
+    int w2 = (max.z + SOLID_WORD_BITS - 1) >> SOLID_WORD_SHIFT;
+    for (x = min.x; x < max.x; x++)
+    for (y = min.y; y < max.y; y++)
+    for (w = w1; w < w2; w++) {
+        uint64_t solid = file->get_solid_word(x, y, w);
+        if (solid == 0)
+            continue;
+        // neighbours along z, shifted into place
+        uint64_t above = (solid >> 1) |
+                         (file->get_solid_word(x, y, w + 1) << 63);
+        uint64_t below = (solid << 1) |
+                         (file->get_solid_word(x, y, w - 1) >> 63);
+        // one bit per voxel that has the given face exposed
+        uint64_t y_pos = solid & ~file->get_solid_word(x, y + 1, w);
+        uint64_t y_neg = solid & ~file->get_solid_word(x, y - 1, w);
+        uint64_t z_pos = solid & ~above;
+        uint64_t z_neg = solid & ~below;
+        uint64_t x_pos = solid & ~file->get_solid_word(x + 1, y, w);
+        uint64_t x_neg = solid & ~file->get_solid_word(x - 1, y, w);
+        uint64_t visible = y_pos | y_neg | z_pos | z_neg | x_pos | x_neg;
+        visible &= get_word_range(w, min.z, max.z);
+        while (visible != 0) {
+            int i = count_trailing_zeros(visible);
+            uint64_t bit = uint64_t(1) << i;
+            visible &= visible - 1;
+            z = (w << SOLID_WORD_SHIFT) + i;
+            RGBColor & color2 = global_palette[file->get(x, y, z)];
+
+            float noise = glm::simplex(vec3(x, y, z));
+            vec3 color3 = vec3(color2.r, color2.g, color2.b);
+            color3 *= (1.0f + noise * 0.01f);
+            color3 = glm::clamp(color3, 0, 255);
+
+            glColor4ub(int(color3.x), int(color3.y), int(color3.z), alpha_c);
+
+            float gl_x1 = float(x + x_offset);
+            float gl_x2 = gl_x1 + 1.0f;
+            float gl_y1 = float(y + y_offset);
+            float gl_y2 = gl_y1 + 1.0f;
+            float gl_z1 = float(z + z_offset);
+            float gl_z2 = gl_z1 + 1.0f;
+
+            // Left Face
+            if (y_pos & bit) {
+                glNormal3f(0.0f, 1.0f, 0.0f);
+                glVertex3f(gl_x1, gl_y2, gl_z1);
+                glVertex3f(gl_x1, gl_y2, gl_z2);
+                glVertex3f(gl_x2, gl_y2, gl_z2);
+                glVertex3f(gl_x2, gl_y2, gl_z1);
+            }
+
+            // Right face
+            if (y_neg & bit) {
+                glNormal3f(0.0f, -1.0f, 0.0f);
+                glVertex3f(gl_x1, gl_y1, gl_z1); // Top right
+                glVertex3f(gl_x2, gl_y1, gl_z1); // Top left
+                glVertex3f(gl_x2, gl_y1, gl_z2); // Bottom left
+                glVertex3f(gl_x1, gl_y1, gl_z2); // Bottom right
+            }
+
+            // Top face
+            if (z_pos & bit) {
+                glNormal3f(0.0f, 0.0f, -1.0f);
+                glVertex3f(gl_x1, gl_y1, gl_z2); // Bottom left
+                glVertex3f(gl_x2, gl_y1, gl_z2); // Bottom right
+                glVertex3f(gl_x2, gl_y2, gl_z2); // Top right
+                glVertex3f(gl_x1, gl_y2, gl_z2); // Top left
+            }
+
+            // Bottom face
+            if (z_neg & bit) {
+                glNormal3f(0.0f, 0.0f, 1.0f);
+                glVertex3f(gl_x1, gl_y1, gl_z1); // Bottom right
+                glVertex3f(gl_x1, gl_y2, gl_z1); // Top right
+                glVertex3f(gl_x2, gl_y2, gl_z1); // Top left
+                glVertex3f(gl_x2, gl_y1, gl_z1); // Bottom left
+            }
+
+            // Right face
+            if (x_pos & bit) {
+                glNormal3f(1.0f, 0.0f, 0.0f);
+                glVertex3f(gl_x2, gl_y1, gl_z1); // Bottom right
+                glVertex3f(gl_x2, gl_y2, gl_z1); // Top right
+                glVertex3f(gl_x2, gl_y2, gl_z2); // Top left
+                glVertex3f(gl_x2, gl_y1, gl_z2); // Bottom left
+            }
+
+            // Left Face
+            if (x_neg & bit) {
+                glNormal3f(-1.0f, 0.0f, 0.0f);
+                glVertex3f(gl_x1, gl_y1, gl_z1); // Bottom left
+                glVertex3f(gl_x1, gl_y1, gl_z2); // Bottom right
+                glVertex3f(gl_x1, gl_y2, gl_z2); // Top right
+                glVertex3f(gl_x1, gl_y2, gl_z1); // Top left
+            }
+        }
+    }
+}
+
+void VoxelModel::update_brick(int x, int y, int z)
+{
+    ivec3 min, max;
+    file->get_brick_box(x, y, z, min, max);
+    ivec3 offset(file->x_offset, file->y_offset, file->z_offset);
+    glNewList(value + GLuint(file->get_slot_index(x, y, z)), GL_COMPILE);
+    // bricks without exposed voxels are left empty
+    if (file->occupancy[0].get(x, y, z) != 0 &&
+        !file->is_brick_hidden(x, y, z)) {
+        glBegin(GL_QUADS);
+        draw_region(min, max, 255, offset);
+        glEnd();
+    }
+    glEndList();
+}
+
+void VoxelModel::update(bool force)
+{
+    std::vector<ivec3> changed;
+    file->update_occupancy();
+    // faces on the edge of a brick depend on the neighbouring bricks
+    if (force || value == 0 || !file->get_changes(epoch, changed, true)) {
+        if (value != 0)
+            glDeleteLists(value, lists);
+        lists = GLsizei(file->bricks.size());
+        value = lists == 0 ? 0 : glGenLists(lists);
+        for (int x = 0; x < file->x_bricks; x++)
+        for (int y = 0; y < file->y_bricks; y++)
+        for (int z = 0; z < file->z_bricks; z++)
+            update_brick(x, y, z);
+    } else {
+        std::vector<ivec3>::const_iterator it;
+        for (it = changed.begin(); it != changed.end(); it++)
+            update_brick(it->x, it->y, it->z);
+    }
+    epoch = file->next_epoch();
+}
+
+void VoxelModel::draw()
+{
+    if (value == 0 || file->has_changes(epoch))
+        update(false);
+    glDisable(GL_TEXTURE_2D);
+    for (GLsizei i = 0; i < lists; i++) {
+        const BrickSlot & slot = file->bricks[i];
+        if (slot.is_empty())
+            continue;
+        glCallList(value + i);
+    }
+}
+
+VoxelModel::~VoxelModel()
+{
+    if (value != 0)
+        glDeleteLists(value, lists);
+}
+
+ReferencePoint * VoxelModel::get_point(const QString & name)
+{
+    return file->get_point(name);
+}
+
+// ReferencePoint
+
+ReferencePoint::ReferencePoint(const QString & name,int x, int y, int z)
+: name(name), x(x), y(y), z(z)
+{
+
+}
+void ReferencePoint::translate()
+{
+    glTranslatef(float(x) + 0.01f, float(y) + 0.01f, float(z) + 0.01f);
+}
+
+// VoxelFile
+
+#define PALETTE_FILE "palette.dat"
+
+void VoxelFile::load_palette()
+{
+    if (global_palette != NULL)
+        return;
+    global_palette = new RGBColor[256];
+    palette_names = new QString[256];
+    QFile fp(PALETTE_FILE);
+    if (!fp.open(QIODevice::ReadOnly))
+        return;
+    for (int i = 0; i < 256; i++)
+        fp.read((char*)&global_palette[i], sizeof(RGBColor));
+    QDataStream stream(&fp);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    if (!fp.atEnd()) {
+        // read names
+        for (int i = 0; i < 256; i++) {
+            read_cstring(stream, palette_names[i]);
+        }
+    }
+    fp.close();
+}
+
+void VoxelFile::save_palette()
+{
+    if (global_palette == NULL)
+        return;
+    QFile fp(PALETTE_FILE);
+    if (!fp.open(QIODevice::WriteOnly))
+        return;
+    for (int i = 0; i < 256; i++)
+        fp.write((char*)&global_palette[i], sizeof(RGBColor));
+    QDataStream stream(&fp);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    for (int i = 0; i < 256; i++)
+        write_cstring(stream, palette_names[i]);
+    fp.close();
+}
+
+unsigned char VoxelFile::get_closest_index(RGBColor c)
+{
+    load_palette();
+    vec3 color_vec(c.r, c.g, c.b);
+    bool is_set = false;
+    float dist;
+    unsigned char current_index = 0;
+    for (int i = 0; i < 256; i++) {
+        RGBColor & pal_color = global_palette[i];
+        vec3 new_vec(pal_color.r, pal_color.g, pal_color.b);
+        float new_dist = glm::distance(color_vec, new_vec);
+        if (is_set && new_dist >= dist)
+            continue;
+        is_set = true;
+        dist = new_dist;
+        current_index = i;
+    }
+    return current_index;
+}
+
+VoxelFile::VoxelFile()
+: x_bricks(0), y_bricks(0), z_bricks(0), epoch(++global_epoch),
+  layout_epoch(epoch), change_epoch(epoch), pager(NULL), page_clock(0),
+  occupancy_epoch(0), model(NULL)
+{
+    load_palette();
+}
+
+VoxelFile::VoxelFile(QFile & fp)
+: x_bricks(0), y_bricks(0), z_bricks(0), epoch(++global_epoch),
+  layout_epoch(epoch), change_epoch(epoch), pager(NULL), page_clock(0),
+  occupancy_epoch(0), model(NULL)
+{
+    load_palette();
+    load_fp(fp);
+}
+
+VoxelFile::VoxelFile(const QString & filename)
+: x_bricks(0), y_bricks(0), z_bricks(0), epoch(++global_epoch),
+  layout_epoch(epoch), change_epoch(epoch), pager(NULL), page_clock(0),
+  occupancy_epoch(0), model(NULL)
+{
+    load_palette();
+    load(filename);
+}
+
+VoxelFile::VoxelFile(int x_size, int y_size, int z_size)
+: x_bricks(0), y_bricks(0), z_bricks(0), epoch(++global_epoch),
+  layout_epoch(epoch), change_epoch(epoch), pager(NULL), page_clock(0),
+  x_offset(0), y_offset(0), z_offset(0), occupancy_epoch(0), model(NULL)
+{
+    load_palette();
+    reset(x_size, y_size, z_size);
+}
+
+VoxelFile::~VoxelFile()
+{
+    free_bricks();
+    delete pager;
+}
+
+void VoxelFile::update_model()
+{
+    if (model == NULL)
+        return;
+    model->update();
+}
+
+void VoxelFile::reset(int x_size, int y_size, int z_size)
+{
+    this->x_size = x_size;
+    this->y_size = y_size;
+    this->z_size = z_size;
+    free_bricks();
+    x_bricks = (x_size + BRICK_MASK) >> BRICK_SHIFT;
+    y_bricks = (y_size + BRICK_MASK) >> BRICK_SHIFT;
+    z_bricks = (z_size + BRICK_MASK) >> BRICK_SHIFT;
+    BrickSlot slot;
+    slot.brick = NULL;
+    slot.epoch = epoch;
+    slot.page = -1;
+    slot.fill = VOXEL_AIR;
+    bricks.resize(x_bricks * y_bricks * z_bricks, slot);
+    reset_counts();
+    mark_layout();
+    points.clear();
+}
+
+void VoxelFile::reset_counts()
+{
+    for (int i = 0; i < 256; i++)
+        color_counts[i] = 0;
+    color_counts[VOXEL_AIR] = get_volume();
+    x_counts.assign(x_size, 0);
+    y_counts.assign(y_size, 0);
+    z_counts.assign(z_size, 0);
+}
+
+void VoxelFile::add_box_counts(const ivec3 & min, const ivec3 & max,
+                               unsigned char v, int64_t sign)
+{
+    ivec3 size = max - min;
+    color_counts[v] += sign * size.x * size.y * size.z;
+    if (v == VOXEL_AIR)
+        return;
     int x, y, z;
-    for (x = 0; x < file->x_size; x++)
-    for (y = 0; y < file->y_size; y++)
-    for (z = 0; z < file->z_size; z++) {
-        unsigned char color = file->get(x, y, z);
-        if (color == VOXEL_AIR)
+    for (x = min.x; x < max.x; x++)
+        x_counts[x] += sign * size.y * size.z;
+    for (y = min.y; y < max.y; y++)
+        y_counts[y] += sign * size.x * size.z;
+    for (z = min.z; z < max.z; z++)
+        z_counts[z] += sign * size.x * size.y;
+}
+
+void VoxelFile::add_brick_counts(int x, int y, int z, int64_t sign)
+{
+    BrickSlot & slot = get_slot(x, y, z);
+    ivec3 min, max;
+    get_brick_box(x, y, z, min, max);
+    VoxelBrick * brick = get_brick(slot);
+    if (brick == NULL) {
+        add_box_counts(min, max, slot.fill, sign);
+        return;
+    }
+    for (x = min.x; x < max.x; x++)
+    for (y = min.y; y < max.y; y++) {
+        int lx = x & BRICK_MASK;
+        int ly = y & BRICK_MASK;
+        unsigned char row[BRICK_SIZE];
+        brick->get_row(lx, ly, 0, max.z - min.z, row);
+        for (z = 0; z < max.z - min.z; z++)
+            color_counts[row[z]] += sign;
+        unsigned int mask = brick->solid[ly | (lx << BRICK_SHIFT)];
+        int count = count_bits(mask);
+        x_counts[x] += sign * count;
+        y_counts[y] += sign * count;
+        while (mask != 0) {
+            z_counts[min.z + count_trailing_zeros(mask)] += sign;
+            mask &= mask - 1;
+        }
+    }
+}
+
+quint64 VoxelFile::next_epoch()
+{
+    quint64 last = epoch;
+    epoch = ++global_epoch;
+    return last;
+}
+
+void VoxelFile::mark_layout()
+{
+    layout_epoch = change_epoch = epoch;
+}
+
+static void add_changed_brick(VoxelFile * file, int x, int y, int z,
+                              std::vector<bool> & added,
+                              std::vector<ivec3> & out)
+{
+    if (x < 0 || y < 0 || z < 0 ||
+        x >= file->x_bricks || y >= file->y_bricks || z >= file->z_bricks)
+        return;
+    size_t i = file->get_slot_index(x, y, z);
+    if (added[i])
+        return;
+    added[i] = true;
+    out.push_back(ivec3(x, y, z));
+}
+
+// adds the bricks written to after the epoch 'since' to out, optionally
+// with their face neighbours. returns false if the layout has changed, in
+// which case everything has to be rebuilt.
+bool VoxelFile::get_changes(quint64 since, std::vector<ivec3> & out,
+                            bool neighbours)
+{
+    if (layout_epoch > since)
+        return false;
+    if (change_epoch <= since)
+        return true;
+    std::vector<bool> added(bricks.size(), false);
+    for (int x = 0; x < x_bricks; x++)
+    for (int y = 0; y < y_bricks; y++)
+    for (int z = 0; z < z_bricks; z++) {
+        if (get_slot(x, y, z).epoch <= since)
+            continue;
+        add_changed_brick(this, x, y, z, added, out);
+        if (!neighbours)
             continue;
-        RGBColor & color2 = global_palette[color];
-
-        float noise = glm::simplex(vec3(x, y, z));
-        vec3 color3 = vec3(color2.r, color2.g, color2.b);
-        color3 *= (1.0f + noise * 0.01f);
-        color3 = glm::clamp(color3, 0, 255);
-
-        glColor4ub(int(color3.x), int(color3.y), int(color3.z), alpha_c);
-
-        float gl_x1 = float(x + x_offset);
-        float gl_x2 = gl_x1 + 1.0f;
-        float gl_y1 = float(y + y_offset);
-        float gl_y2 = gl_y1 + 1.0f;
-        float gl_z1 = float(z + z_offset);
-        float gl_z2 = gl_z1 + 1.0f;
-
-        // Left Face
-        if (!file->is_solid(x, y + 1, z)) {
-            glNormal3f(0.0f, 1.0f, 0.0f);
-            glVertex3f(gl_x1, gl_y2, gl_z1);
-            glVertex3f(gl_x1, gl_y2, gl_z2);
-            glVertex3f(gl_x2, gl_y2, gl_z2);
-            glVertex3f(gl_x2, gl_y2, gl_z1);
-        }
-
-        // Right face
-        if (!file->is_solid(x, y - 1, z)) {
-            glNormal3f(0.0f, -1.0f, 0.0f);
-            glVertex3f(gl_x1, gl_y1, gl_z1); // Top right
-            glVertex3f(gl_x2, gl_y1, gl_z1); // Top left
-            glVertex3f(gl_x2, gl_y1, gl_z2); // Bottom left
-            glVertex3f(gl_x1, gl_y1, gl_z2); // Bottom right
-        }
-
-        // Top face
-        if (!file->is_solid(x, y, z + 1)) {
-            glNormal3f(0.0f, 0.0f, -1.0f);
-            glVertex3f(gl_x1, gl_y1, gl_z2); // Bottom left
-            glVertex3f(gl_x2, gl_y1, gl_z2); // Bottom right
-            glVertex3f(gl_x2, gl_y2, gl_z2); // Top right
-            glVertex3f(gl_x1, gl_y2, gl_z2); // Top left
-        }
-
-        // Bottom face
-        if (!file->is_solid(x, y, z - 1)) {
-            glNormal3f(0.0f, 0.0f, 1.0f);
-            glVertex3f(gl_x1, gl_y1, gl_z1); // Bottom right
-            glVertex3f(gl_x1, gl_y2, gl_z1); // Top right
-            glVertex3f(gl_x2, gl_y2, gl_z1); // Top left
-            glVertex3f(gl_x2, gl_y1, gl_z1); // Bottom left
-        }
-
-        // Right face
-        if (!file->is_solid(x + 1, y, z)) {
-            glNormal3f(1.0f, 0.0f, 0.0f);
-            glVertex3f(gl_x2, gl_y1, gl_z1); // Bottom right
-            glVertex3f(gl_x2, gl_y2, gl_z1); // Top right
-            glVertex3f(gl_x2, gl_y2, gl_z2); // Top left
-            glVertex3f(gl_x2, gl_y1, gl_z2); // Bottom left
-        }
-
-        // Left Face
-        if (!file->is_solid(x - 1, y, z)) {
-            glNormal3f(-1.0f, 0.0f, 0.0f);
-            glVertex3f(gl_x1, gl_y1, gl_z1); // Bottom left
-            glVertex3f(gl_x1, gl_y1, gl_z2); // Bottom right
-            glVertex3f(gl_x1, gl_y2, gl_z2); // Top right
-            glVertex3f(gl_x1, gl_y2, gl_z1); // Top left
+        add_changed_brick(this, x - 1, y, z, added, out);
+        add_changed_brick(this, x + 1, y, z, added, out);
+        add_changed_brick(this, x, y - 1, z, added, out);
+        add_changed_brick(this, x, y + 1, z, added, out);
+        add_changed_brick(this, x, y, z - 1, added, out);
+        add_changed_brick(this, x, y, z + 1, added, out);
+    }
+    return true;
+}
+
+bool VoxelFile::get_solid_bounds(ivec3 & min, ivec3 & max)
+{
+    if (color_counts[VOXEL_AIR] == get_volume())
+        return false;
+    // the slice counts only have to be scanned across the empty margins
+    for (min.x = 0; x_counts[min.x] == 0; min.x++) {}
+    for (min.y = 0; y_counts[min.y] == 0; min.y++) {}
+    for (min.z = 0; z_counts[min.z] == 0; min.z++) {}
+    for (max.x = x_size; x_counts[max.x - 1] == 0; max.x--) {}
+    for (max.y = y_size; y_counts[max.y - 1] == 0; max.y--) {}
+    for (max.z = z_size; z_counts[max.z - 1] == 0; max.z--) {}
+    return true;
+}
+
+// finds the solid voxels of the 16 rows of a brick at one x, restricted to
+// the y_mask rows and z_mask columns. returns one bit per row that has any
+// and ors their columns into z_bits.
+static inline unsigned int get_solid_rows(const unsigned short * rows,
+                                          unsigned int y_mask,
+                                          unsigned int z_mask,
+                                          unsigned int & z_bits)
+{
+#ifdef VOXIE_SSE2
+    // expand the row mask to one lane per row
+    __m128i lane_a = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+    __m128i lane_b = _mm_slli_epi16(lane_a, 8);
+    __m128i y = _mm_set1_epi16((short)y_mask);
+    __m128i z = _mm_set1_epi16((short)z_mask);
+    __m128i zero = _mm_setzero_si128();
+    __m128i a = _mm_loadu_si128((const __m128i*)rows);
+    __m128i b = _mm_loadu_si128((const __m128i*)(rows + 8));
+    a = _mm_and_si128(_mm_and_si128(a, z),
+                      _mm_cmpeq_epi16(_mm_and_si128(y, lane_a), lane_a));
+    b = _mm_and_si128(_mm_and_si128(b, z),
+                      _mm_cmpeq_epi16(_mm_and_si128(y, lane_b), lane_b));
+    __m128i empty = _mm_packs_epi16(_mm_cmpeq_epi16(a, zero),
+                                    _mm_cmpeq_epi16(b, zero));
+    __m128i o = _mm_or_si128(a, b);
+    o = _mm_or_si128(o, _mm_srli_si128(o, 8));
+    o = _mm_or_si128(o, _mm_srli_si128(o, 4));
+    o = _mm_or_si128(o, _mm_srli_si128(o, 2));
+    z_bits |= _mm_cvtsi128_si32(o) & 0xFFFF;
+    return ~_mm_movemask_epi8(empty) & 0xFFFF;
+#else
+    unsigned int ret = 0;
+    for (int y = 0; y < BRICK_SIZE; y++) {
+        if (!(y_mask & (1 << y)))
+            continue;
+        unsigned int bits = rows[y] & z_mask;
+        z_bits |= bits;
+        if (bits)
+            ret |= 1 << y;
+    }
+    return ret;
+#endif
+}
+
+struct SolidBounds
+{
+    bool found;
+    ivec3 min, max;
+
+    SolidBounds()
+    : found(false)
+    {
+    }
+
+    void add(const ivec3 & box_min, const ivec3 & box_max)
+    {
+        if (!found) {
+            min = box_min;
+            max = box_max;
+            found = true;
+            return;
         }
+        min = glm::min(min, box_min);
+        max = glm::max(max, box_max);
     }
-    glEnd();
+
+    bool contains(const ivec3 & box_min, const ivec3 & box_max) const
+    {
+        return found && glm::all(glm::lessThanEqual(min, box_min)) &&
+               glm::all(glm::lessThanEqual(box_max, max));
+    }
+};
+
+// one job piece per x slab of bricks, reduced once all of them are done
+class SolidBoundsJob : public ParallelJob
+{
+public:
+    VoxelFile * file;
+    ivec3 region_min, region_max;
+    ivec3 brick_min, brick_max;
+    std::vector<SolidBounds> slabs;
+
+    SolidBoundsJob(VoxelFile * file, const ivec3 & min, const ivec3 & max)
+    : file(file), region_min(min), region_max(max)
+    {
+        brick_min = min >> BRICK_SHIFT;
+        brick_max = ((max - 1) >> BRICK_SHIFT) + 1;
+        slabs.resize(brick_max.x - brick_min.x);
+    }
+
+    void run(int i)
+    {
+        SolidBounds & bounds = slabs[i];
+        int x = brick_min.x + i;
+        for (int y = brick_min.y; y < brick_max.y; y++)
+        for (int z = brick_min.z; z < brick_max.z; z++) {
+            ivec3 min, max;
+            file->get_brick_box(x, y, z, min, max);
+            min = glm::max(min, region_min);
+            max = glm::min(max, region_max);
+            if (bounds.contains(min, max))
+                continue;
+            BrickSlot & slot = file->get_slot(x, y, z);
+            if (slot.is_empty())
+                continue;
+            VoxelBrick * brick = file->get_brick(slot);
+            if (brick == NULL) {
+                if (slot.fill != VOXEL_AIR)
+                    bounds.add(min, max);
+                continue;
+            }
+            scan_brick(bounds, brick, min, max);
+        }
+    }
+
+    void scan_brick(SolidBounds & bounds, VoxelBrick * brick,
+                    const ivec3 & min, const ivec3 & max)
+    {
+        ivec3 base = (min >> BRICK_SHIFT) << BRICK_SHIFT;
+        ivec3 lmin = min - base;
+        ivec3 lmax = max - base;
+        unsigned int y_mask = (1 << lmax.y) - (1 << lmin.y);
+        unsigned int z_mask = (1 << lmax.z) - (1 << lmin.z);
+        unsigned int y_bits = 0;
+        unsigned int z_bits = 0;
+        int x1 = -1, x2 = -1;
+        for (int x = lmin.x; x < lmax.x; x++) {
+            const unsigned short * rows = &brick->solid[x << BRICK_SHIFT];
+            unsigned int hit = get_solid_rows(rows, y_mask, z_mask, z_bits);
+            if (hit == 0)
+                continue;
+            if (x1 < 0)
+                x1 = x;
+            x2 = x;
+            y_bits |= hit;
+        }
+        if (x1 < 0)
+            return;
+        ivec3 hit_min(x1, count_trailing_zeros(y_bits),
+                      count_trailing_zeros(z_bits));
+        ivec3 hit_max(x2, get_highest_bit(y_bits), get_highest_bit(z_bits));
+        bounds.add(base + hit_min, base + hit_max + 1);
+    }
+};
+
+// tight bounds of the solid voxels inside [region_min, region_max)
+bool VoxelFile::get_solid_bounds(const ivec3 & region_min,
+                                 const ivec3 & region_max,
+                                 ivec3 & min, ivec3 & max)
+{
+    ivec3 r1 = glm::max(region_min, ivec3(0));
+    ivec3 r2 = glm::min(region_max, ivec3(x_size, y_size, z_size));
+    if (glm::any(glm::lessThanEqual(r2, r1)))
+        return false;
+    SolidBoundsJob job(this, r1, r2);
+    parallel_for(job, int(job.slabs.size()), pager == NULL);
+    SolidBounds bounds;
+    for (size_t i = 0; i < job.slabs.size(); i++) {
+        if (job.slabs[i].found)
+            bounds.add(job.slabs[i].min, job.slabs[i].max);
+    }
+    if (!bounds.found)
+        return false;
+    min = bounds.min;
+    max = bounds.max;
+    return true;
+}
+
+// occupancy pyramid
+
+void VoxelFile::update_occupancy()
+{
+    if (!occupancy.empty() && !has_changes(occupancy_epoch))
+        return;
+    std::vector<ivec3> changed;
+    if (occupancy.empty() || !get_changes(occupancy_epoch, changed)) {
+        occupancy.clear();
+        ivec3 size(x_bricks, y_bricks, z_bricks);
+        for (;;) {
+            OccupancyLevel level;
+            level.x_size = size.x;
+            level.y_size = size.y;
+            level.z_size = size.z;
+            level.cells.resize(size_t(size.x) * size.y * size.z);
+            occupancy.push_back(level);
+            if (size.x <= 1 && size.y <= 1 && size.z <= 1)
+                break;
+            size = (size + 1) / 2;
+        }
+        for (int l = 0; l < int(occupancy.size()); l++) {
+            OccupancyLevel & level = occupancy[l];
+            for (int x = 0; x < level.x_size; x++)
+            for (int y = 0; y < level.y_size; y++)
+            for (int z = 0; z < level.z_size; z++)
+                update_occupancy_cell(l, x, y, z);
+        }
+    } else {
+        // only walk up while the cells actually change
+        std::vector<ivec3>::const_iterator it;
+        for (it = changed.begin(); it != changed.end(); it++) {
+            ivec3 cell = *it;
+            for (int l = 0; l < int(occupancy.size()); l++) {
+                if (!update_occupancy_cell(l, cell.x, cell.y, cell.z))
+                    break;
+                cell /= 2;
+            }
+        }
+    }
+    occupancy_epoch = next_epoch();
+}
+
+unsigned char VoxelFile::get_brick_occupancy(int x, int y, int z)
+{
+    BrickSlot & slot = get_slot(x, y, z);
+    VoxelBrick * brick = get_brick(slot);
+    if (brick == NULL) {
+        if (slot.fill == VOXEL_AIR)
+            return 0;
+        return OCCUPANCY_ANY | OCCUPANCY_ALL;
+    }
+    // voxels outside the model are air, so they never count
+    int count = 0;
+    for (int i = 0; i < BRICK_SIZE * BRICK_SIZE; i++)
+        count += count_bits(brick->solid[i]);
+    if (count == 0)
+        return 0;
+    ivec3 min, max;
+    get_brick_box(x, y, z, min, max);
+    ivec3 size = max - min;
+    if (count == size.x * size.y * size.z)
+        return OCCUPANCY_ANY | OCCUPANCY_ALL;
+    return OCCUPANCY_ANY;
+}
+
+// returns true if the cell has changed
+bool VoxelFile::update_occupancy_cell(int level, int x, int y, int z)
+{
+    unsigned char flags;
+    if (level == 0)
+        flags = get_brick_occupancy(x, y, z);
+    else {
+        OccupancyLevel & below = occupancy[level - 1];
+        unsigned char any = 0;
+        unsigned char all = OCCUPANCY_ALL;
+        for (int k = 0; k < 8; k++) {
+            ivec3 child = ivec3(x, y, z) * 2 + get_octant(k);
+            if (child.x >= below.x_size || child.y >= below.y_size ||
+                child.z >= below.z_size)
+                continue;
+            unsigned char c = below.cells[below.get_index(child.x, child.y,
+                                                          child.z)];
+            any |= c & OCCUPANCY_ANY;
+            all &= c;
+        }
+        flags = any | all;
+    }
+    OccupancyLevel & current = occupancy[level];
+    unsigned char & cell = current.cells[current.get_index(x, y, z)];
+    if (cell == flags)
+        return false;
+    cell = flags;
+    return true;
+}
+
+// voxel box of a cell of the pyramid, clipped to the model
+void VoxelFile::get_cell_box(int level, int x, int y, int z, ivec3 & min,
+                             ivec3 & max)
+{
+    int shift = BRICK_SHIFT + level;
+    min = ivec3(x << shift, y << shift, z << shift);
+    max = glm::min(min + (1 << shift), ivec3(x_size, y_size, z_size));
+}
+
+// a brick without exposed voxels, i.e. full and surrounded by full bricks.
+// the pyramid has to be up to date.
+bool VoxelFile::is_brick_hidden(int x, int y, int z)
+{
+    OccupancyLevel & level = occupancy[0];
+    unsigned char flags = level.get(x, y, z) &
+                          level.get(x - 1, y, z) & level.get(x + 1, y, z) &
+                          level.get(x, y - 1, z) & level.get(x, y + 1, z) &
+                          level.get(x, y, z - 1) & level.get(x, y, z + 1);
+    return (flags & OCCUPANCY_ALL) != 0;
+}
+
+class RayChild
+{
+public:
+    ivec3 pos;
+    float t;
+    int axis;
+};
+
+// inserts a child hit by the ray, keeping the children sorted front to back
+static void add_ray_child(RayChild * children, int & count, const ivec3 & pos,
+                          const vec3 & min, const vec3 & max,
+                          const vec3 & ray_pos, const vec3 & inv_dir)
+{
+    float t_near, t_far;
+    int axis;
+    if (!test_ray_aabb(ray_pos, inv_dir, min, max, t_near, t_far, axis))
+        return;
+    int i = count++;
+    for (; i > 0 && children[i - 1].t > t_near; i--)
+        children[i] = children[i - 1];
+    children[i].pos = pos;
+    children[i].t = t_near;
+    children[i].axis = axis;
+}
+
+// the 2x, 4x and 8x levels inside a brick follow from its solid masks
+inline bool is_block_empty(const unsigned short * solid, const ivec3 & p,
+                           int size)
+{
+    unsigned int bits = ((1 << size) - 1) << p.z;
+    for (int x = p.x; x < p.x + size; x++)
+    for (int y = p.y; y < p.y + size; y++) {
+        if (solid[y | (x << BRICK_SHIFT)] & bits)
+            return false;
+    }
+    return true;
+}
+
+static bool raycast_block(const unsigned short * solid, const ivec3 & origin,
+                          const ivec3 & model_max, const ivec3 & min,
+                          int size, const vec3 & pos, const vec3 & inv_dir,
+                          RayChild & hit)
+{
+    int half = size >> 1;
+    RayChild children[8];
+    int count = 0;
+    for (int k = 0; k < 8; k++) {
+        ivec3 child = min + get_octant(k) * half;
+        ivec3 child_min = origin + child;
+        if (child_min.x >= model_max.x || child_min.y >= model_max.y ||
+            child_min.z >= model_max.z || is_block_empty(solid, child, half))
+            continue;
+        ivec3 child_max = glm::min(child_min + half, model_max);
+        add_ray_child(children, count, child, vec3(child_min),
+                      vec3(child_max), pos, inv_dir);
+    }
+    for (int i = 0; i < count; i++) {
+        if (half == 1) {
+            hit = children[i];
+            return true;
+        }
+        if (raycast_block(solid, origin, model_max, children[i].pos, half,
+                          pos, inv_dir, hit))
+            return true;
+    }
+    return false;
+}
+
+// pos and dir are in voxel coordinates, i.e. without the model offset.
+// returns the first solid voxel along the ray and the normal of the face
+// the ray enters it through.
+bool VoxelFile::raycast(const vec3 & pos, const vec3 & dir, ivec3 & hit,
+                        ivec3 & normal)
+{
+    update_occupancy();
+    OccupancyLevel & top = occupancy.back();
+    if (top.cells.empty() || top.cells[0] == 0)
+        return false;
+    vec3 inv_dir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+    int axis;
+    if (!raycast_cell(int(occupancy.size()) - 1, ivec3(0), pos, inv_dir,
+                      hit, axis))
+        return false;
+    normal = ivec3(0);
+    normal[axis] = dir[axis] > 0.0f ? -1 : 1;
+    return true;
+}
+
+bool VoxelFile::raycast_cell(int level, const ivec3 & cell, const vec3 & pos,
+                             const vec3 & inv_dir, ivec3 & hit, int & axis)
+{
+    if (level == 0)
+        return raycast_brick(cell, pos, inv_dir, hit, axis);
+    OccupancyLevel & below = occupancy[level - 1];
+    RayChild children[8];
+    int count = 0;
+    ivec3 min, max;
+    for (int k = 0; k < 8; k++) {
+        ivec3 child = cell * 2 + get_octant(k);
+        if (below.get(child.x, child.y, child.z) == 0)
+            continue;
+        get_cell_box(level - 1, child.x, child.y, child.z, min, max);
+        add_ray_child(children, count, child, vec3(min), vec3(max), pos,
+                      inv_dir);
+    }
+    for (int i = 0; i < count; i++) {
+        if (raycast_cell(level - 1, children[i].pos, pos, inv_dir, hit,
+                         axis))
+            return true;
+    }
+    return false;
+}
+
+bool VoxelFile::raycast_brick(const ivec3 & brick, const vec3 & pos,
+                              const vec3 & inv_dir, ivec3 & hit, int & axis)
+{
+    BrickSlot & slot = get_slot(brick.x, brick.y, brick.z);
+    VoxelBrick * data = get_brick(slot);
+    unsigned short full[BRICK_SIZE * BRICK_SIZE];
+    const unsigned short * solid;
+    if (data != NULL)
+        solid = data->solid;
+    else if (slot.fill == VOXEL_AIR)
+        return false;
+    else {
+        memset(full, 0xFF, sizeof(full));
+        solid = full;
+    }
+    ivec3 origin = brick * BRICK_SIZE;
+    RayChild child;
+    if (!raycast_block(solid, origin, ivec3(x_size, y_size, z_size),
+                       ivec3(0), BRICK_SIZE, pos, inv_dir, child))
+        return false;
+    hit = origin + child.pos;
+    axis = child.axis;
+    return true;
+}
+
+void VoxelFile::free_bricks()
+{
+    BrickSlots::iterator it;
+    for (it = bricks.begin(); it != bricks.end(); it++)
+        release_brick((*it).brick);
+    bricks.clear();
+    if (pager != NULL)
+        pager->clear();
+}
+
+void VoxelFile::swap_bricks(VoxelFile & other)
+{
+    std::swap(bricks, other.bricks);
+    std::swap(x_bricks, other.x_bricks);
+    std::swap(y_bricks, other.y_bricks);
+    std::swap(z_bricks, other.z_bricks);
+    std::swap(x_size, other.x_size);
+    std::swap(y_size, other.y_size);
+    std::swap(z_size, other.z_size);
+    std::swap_ranges(color_counts, color_counts + 256, other.color_counts);
+    std::swap(x_counts, other.x_counts);
+    std::swap(y_counts, other.y_counts);
+    std::swap(z_counts, other.z_counts);
+    std::swap(pager, other.pager);
+    std::swap(page_clock, other.page_clock);
+    if (pager != NULL)
+        pager->file = this;
+    if (other.pager != NULL)
+        other.pager->file = &other;
+    mark_layout();
+    other.mark_layout();
+}
+
+void VoxelFile::get_brick_box(int x, int y, int z, ivec3 & min, ivec3 & max)
+{
+    min = ivec3(x, y, z) * BRICK_SIZE;
+    max = glm::min(min + BRICK_SIZE, ivec3(x_size, y_size, z_size));
+}
+
+// the single color of the bricks covering [min, max), or -1 if any of them
+// holds voxels
+int VoxelFile::get_uniform(const ivec3 & min, const ivec3 & max)
+{
+    ivec3 b1 = min >> BRICK_SHIFT;
+    ivec3 b2 = (max - 1) >> BRICK_SHIFT;
+    int v = -1;
+    for (int x = b1.x; x <= b2.x; x++)
+    for (int y = b1.y; y <= b2.y; y++)
+    for (int z = b1.z; z <= b2.z; z++) {
+        BrickSlot & slot = get_slot(x, y, z);
+        if (slot.brick != NULL || slot.page >= 0)
+            return -1;
+        if (v != -1 && v != slot.fill)
+            return -1;
+        v = slot.fill;
+    }
+    return v;
+}
+
+VoxelBrick * VoxelFile::allocate_brick(int x, int y, int z)
+{
+    if (pager != NULL)
+        pager->reserve();
+    BrickSlot & slot = get_slot(x, y, z);
+    ivec3 min, max;
+    get_brick_box(x, y, z, min, max);
+    ivec3 size = max - min;
+    VoxelBrick * brick;
+    if (slot.fill == VOXEL_AIR || size == ivec3(BRICK_SIZE))
+        brick = new VoxelBrick(slot.fill);
+    else {
+        // keep the part outside the model as air
+        brick = new VoxelBrick(VOXEL_AIR);
+        for (int xx = 0; xx < size.x; xx++)
+        for (int yy = 0; yy < size.y; yy++)
+            brick->fill_row(xx, yy, 0, size.z, slot.fill);
+    }
+    brick->stamp = page_clock;
+    slot.brick = brick;
+    return brick;
+}
+
+VoxelBrick * VoxelFile::unshare_brick(int x, int y, int z)
+{
+    if (pager != NULL)
+        pager->reserve();
+    BrickSlot & slot = get_slot(x, y, z);
+    VoxelBrick * brick = new VoxelBrick(*slot.brick);
+    brick->stamp = page_clock;
+    release_brick(slot.brick);
+    slot.brick = brick;
+    return brick;
+}
+
+// makes the slot share a brick of another file with the same layout, or
+// tags it with v if brick is NULL
+void VoxelFile::share_brick(int x, int y, int z, VoxelBrick * brick,
+                            unsigned char v)
+{
+    add_brick_counts(x, y, z, -1);
+    BrickSlot & slot = get_slot(x, y, z);
+    if (brick != NULL)
+        brick->refs.ref();
+    release_brick(slot.brick);
+    if (slot.page >= 0) {
+        pager->free_pages.push_back(slot.page);
+        slot.page = -1;
+    }
+    slot.brick = brick;
+    slot.fill = v;
+    add_brick_counts(x, y, z, 1);
+    mark_dirty(slot);
+}
+
+// VoxelBrick
+
+VoxelBrick::VoxelBrick(unsigned char v)
+: refs(1), stamp(0), bits(1), colors(1)
+{
+    palette[0] = v;
+    data = new unsigned char[get_data_size()];
+    memset(data, 0, get_data_size());
+    memset(solid, v == VOXEL_AIR ? 0 : 0xFF, sizeof(solid));
+}
+
+VoxelBrick::VoxelBrick(const VoxelBrick & other)
+: refs(1), stamp(0), bits(other.bits), colors(other.colors)
+{
+    memcpy(palette, other.palette, sizeof(palette));
+    data = new unsigned char[get_data_size()];
+    memcpy(data, other.data, get_data_size());
+    memcpy(solid, other.solid, sizeof(solid));
+}
+
+VoxelBrick::~VoxelBrick()
+{
+    delete[] data;
+}
+
+// doubles the bits per voxel. local indices stay the same until 8 bits,
+// where they are replaced by the global ones.
+void VoxelBrick::widen()
+{
+    int old_bits = bits;
+    unsigned char * old_data = data;
+    int old_mask = (1 << old_bits) - 1;
+    bits *= 2;
+    data = new unsigned char[get_data_size()];
+    memset(data, 0, get_data_size());
+    for (int i = 0; i < BRICK_VOLUME; i++) {
+        int bit = i * old_bits;
+        int v = (old_data[bit >> 3] >> (bit & 7)) & old_mask;
+        if (bits == 8)
+            v = palette[v];
+        set_index(i, v);
+    }
+    delete[] old_data;
+}
+
+int VoxelBrick::add_color(unsigned char v)
+{
+    if (colors == 1 << bits) {
+        widen();
+        if (bits == 8)
+            return v;
+    }
+    palette[colors] = v;
+    return colors++;
+}
+
+void VoxelBrick::get_row(int x, int y, int z, int n, unsigned char * out)
+{
+    int i = ((y | (x << BRICK_SHIFT)) << BRICK_SHIFT) | z;
+    if (bits == 8) {
+        memcpy(out, data + i, n);
+        return;
+    }
+    for (int j = 0; j < n; j++)
+        out[j] = palette[get_index(i + j)];
+}
+
+void VoxelBrick::set_row(int x, int y, int z, int n,
+                         const unsigned char * in)
+{
+    int i = ((y | (x << BRICK_SHIFT)) << BRICK_SHIFT) | z;
+    // look up the colors first, since the brick may widen on the way
+    unsigned char local[BRICK_SIZE];
+    for (int j = 0; j < n && bits != 8; j++)
+        local[j] = (unsigned char)get_local(in[j]);
+    if (bits == 8)
+        memcpy(data + i, in, n);
+    else {
+        for (int j = 0; j < n; j++)
+            set_index(i + j, local[j]);
+    }
+    update_column(x, y);
+}
+
+void VoxelBrick::fill_row(int x, int y, int z, int n, unsigned char v)
+{
+    int i = ((y | (x << BRICK_SHIFT)) << BRICK_SHIFT) | z;
+    int local = get_local(v);
+    if (bits == 8)
+        memset(data + i, v, n);
+    else {
+        for (int j = 0; j < n; j++)
+            set_index(i + j, local);
+    }
+    update_column(x, y);
+}
+
+// BRICK_VOLUME voxels laid out like the packed data
+void VoxelBrick::unpack(unsigned char * out)
+{
+    for (int x = 0; x < BRICK_SIZE; x++)
+    for (int y = 0; y < BRICK_SIZE; y++) {
+        get_row(x, y, 0, BRICK_SIZE, out);
+        out += BRICK_SIZE;
+    }
+}
+
+// replaces the contents with the smallest encoding of the given voxels
+void VoxelBrick::pack(const unsigned char * in)
+{
+    // find the local palette first, so the data is only written once
+    short local[256];
+    memset(local, 0xFF, sizeof(local));
+    colors = 0;
+    for (int i = 0; i < BRICK_VOLUME && colors <= BRICK_MAX_COLORS; i++) {
+        if (local[in[i]] >= 0)
+            continue;
+        if (colors < BRICK_MAX_COLORS)
+            palette[colors] = in[i];
+        local[in[i]] = short(colors++);
+    }
+    if (colors <= 2)
+        bits = 1;
+    else if (colors <= 4)
+        bits = 2;
+    else if (colors <= BRICK_MAX_COLORS)
+        bits = 4;
+    else
+        bits = 8;
+    delete[] data;
+    data = new unsigned char[get_data_size()];
+    if (bits == 8)
+        memcpy(data, in, BRICK_VOLUME);
+    else {
+        int per_byte = 8 / bits;
+        int size = get_data_size();
+        for (int i = 0; i < size; i++) {
+            unsigned char c = 0;
+            for (int j = 0; j < per_byte; j++)
+                c |= local[*in++] << (j * bits);
+            data[i] = c;
+        }
+        in -= BRICK_VOLUME;
+    }
+    for (int i = 0; i < BRICK_SIZE * BRICK_SIZE; i++)
+        solid[i] = get_solid_mask(in + (i << BRICK_SHIFT));
+}
+
+bool VoxelBrick::is_uniform(const ivec3 & size, unsigned char & v)
+{
+    v = get(0, 0, 0);
+    unsigned char row[BRICK_SIZE];
+    for (int x = 0; x < size.x; x++)
+    for (int y = 0; y < size.y; y++) {
+        get_row(x, y, 0, size.z, row);
+        for (int z = 0; z < size.z; z++) {
+            if (row[z] != v)
+                return false;
+        }
+    }
+    return true;
+}
+
+void VoxelBrick::update_column(int x, int y)
+{
+    int row = y | (x << BRICK_SHIFT);
+    if (bits == 8) {
+        solid[row] = get_solid_mask(data + (row << BRICK_SHIFT));
+        return;
+    }
+    unsigned short mask = 0;
+    int i = row << BRICK_SHIFT;
+    for (int z = 0; z < BRICK_SIZE; z++) {
+        if (palette[get_index(i + z)] != VOXEL_AIR)
+            mask |= 1 << z;
+    }
+    solid[row] = mask;
+}
+
+void VoxelBrick::update_solid()
+{
+    for (int x = 0; x < BRICK_SIZE; x++)
+    for (int y = 0; y < BRICK_SIZE; y++)
+        update_column(x, y);
+}
+
+// turns a resident single-color brick into a tag, returns true if it did.
+// otherwise, the brick is repacked with as few bits as its colors need.
+bool VoxelFile::compact_brick(int x, int y, int z)
+{
+    BrickSlot & slot = get_slot(x, y, z);
+    VoxelBrick * brick = slot.brick;
+    if (brick == NULL)
+        return false;
+    ivec3 min, max;
+    get_brick_box(x, y, z, min, max);
+    unsigned char v;
+    if (!brick->is_uniform(max - min, v)) {
+        if (brick->bits > 1 && !brick->is_shared()) {
+            unsigned char data[BRICK_VOLUME];
+            brick->unpack(data);
+            brick->pack(data);
+        }
+        return false;
+    }
+    release_brick(slot.brick);
+    slot.brick = NULL;
+    slot.fill = v;
+    return true;
+}
+
+void VoxelFile::compact_bricks()
+{
+    for (int x = 0; x < x_bricks; x++)
+    for (int y = 0; y < y_bricks; y++)
+    for (int z = 0; z < z_bricks; z++)
+        compact_brick(x, y, z);
+}
+
+void VoxelFile::enable_paging(int64_t max_bytes)
+{
+    if (pager == NULL)
+        pager = new BrickPager(this, max_bytes);
+    else
+        pager->set_limit(max_bytes);
+}
+
+// lets a temporary file for a transform page like this one
+void VoxelFile::inherit_paging(VoxelFile & other)
+{
+    if (pager != NULL)
+        other.enable_paging(pager->max_bytes);
+    else if (other.get_volume() > memory_limit)
+        other.enable_paging(memory_limit);
+}
+
+VoxelBrick * VoxelFile::page_in(BrickSlot & slot)
+{
+    return pager->page_in(slot);
+}
+
+void VoxelFile::get_row(int x, int y, int z, int len, unsigned char * out)
+{
+    int bx = x >> BRICK_SHIFT;
+    int by = y >> BRICK_SHIFT;
+    x &= BRICK_MASK;
+    y &= BRICK_MASK;
+    int end = z + len;
+    while (z < end) {
+        int n = std::min(BRICK_SIZE - (z & BRICK_MASK), end - z);
+        BrickSlot & slot = get_slot(bx, by, z >> BRICK_SHIFT);
+        VoxelBrick * brick = get_brick(slot);
+        if (brick == NULL)
+            memset(out, slot.fill, n);
+        else
+            brick->get_row(x, y, z & BRICK_MASK, n, out);
+        out += n;
+        z += n;
+    }
+}
+
+void VoxelFile::set_row(int x, int y, int z, int len,
+                        const unsigned char * in)
+{
+    int bx = x >> BRICK_SHIFT;
+    int by = y >> BRICK_SHIFT;
+    int lx = x & BRICK_MASK;
+    int ly = y & BRICK_MASK;
+    int end = z + len;
+    while (z < end) {
+        int bz = z >> BRICK_SHIFT;
+        int lz = z & BRICK_MASK;
+        int n = std::min(BRICK_SIZE - lz, end - z);
+        BrickSlot & slot = get_slot(bx, by, bz);
+        VoxelBrick * brick = get_brick(slot);
+        if (brick == NULL && slot.page >= 0) {
+            in += n;
+            z += n;
+            continue;
+        }
+        unsigned char row[BRICK_SIZE];
+        if (brick == NULL)
+            memset(row, slot.fill, n);
+        else
+            brick->get_row(lx, ly, lz, n, row);
+        bool changed = false;
+        for (int i = 0; i < n; i++) {
+            if (row[i] == in[i])
+                continue;
+            update_counts(x, y, z + i, row[i], in[i]);
+            changed = true;
+        }
+        if (changed) {
+            if (brick == NULL)
+                brick = allocate_brick(bx, by, bz);
+            else if (brick->is_shared())
+                brick = unshare_brick(bx, by, bz);
+            brick->set_row(lx, ly, lz, n, in);
+            mark_dirty(slot);
+        }
+        in += n;
+        z += n;
+    }
+}
+
+// like set_row() with every voxel set to v
+void VoxelFile::fill_row(int x, int y, int z, int len, unsigned char v)
+{
+    int bx = x >> BRICK_SHIFT;
+    int by = y >> BRICK_SHIFT;
+    int lx = x & BRICK_MASK;
+    int ly = y & BRICK_MASK;
+    int end = z + len;
+    while (z < end) {
+        int bz = z >> BRICK_SHIFT;
+        int lz = z & BRICK_MASK;
+        int n = std::min(BRICK_SIZE - lz, end - z);
+        BrickSlot & slot = get_slot(bx, by, bz);
+        VoxelBrick * brick = get_brick(slot);
+        bool changed = false;
+        if (brick == NULL) {
+            if (slot.fill != v && slot.page < 0) {
+                ivec3 min(x, y, z);
+                ivec3 max(x + 1, y + 1, z + n);
+                add_box_counts(min, max, slot.fill, -1);
+                add_box_counts(min, max, v, 1);
+                brick = allocate_brick(bx, by, bz);
+                changed = true;
+            }
+        } else {
+            unsigned char row[BRICK_SIZE];
+            brick->get_row(lx, ly, lz, n, row);
+            for (int i = 0; i < n; i++) {
+                if (row[i] == v)
+                    continue;
+                update_counts(x, y, z + i, row[i], v);
+                changed = true;
+            }
+            if (changed && brick->is_shared())
+                brick = unshare_brick(bx, by, bz);
+        }
+        if (changed) {
+            brick->fill_row(lx, ly, lz, n, v);
+            mark_dirty(slot);
+        }
+        z += n;
+    }
+}
+
+void VoxelFile::fill(int x1, int y1, int z1, int x2, int y2, int z2,
+                     unsigned char v)
+{
+    ivec3 fill_min = glm::max(ivec3(x1, y1, z1), ivec3(0));
+    ivec3 fill_max = glm::min(ivec3(x2, y2, z2),
+                              ivec3(x_size, y_size, z_size));
+    if (fill_min.x >= fill_max.x || fill_min.y >= fill_max.y ||
+        fill_min.z >= fill_max.z)
+        return;
+    ivec3 b1 = fill_min >> BRICK_SHIFT;
+    ivec3 b2 = (fill_max - 1) >> BRICK_SHIFT;
+    ivec3 min, max;
+    for (int bx = b1.x; bx <= b2.x; bx++)
+    for (int by = b1.y; by <= b2.y; by++)
+    for (int bz = b1.z; bz <= b2.z; bz++) {
+        BrickSlot & slot = get_slot(bx, by, bz);
+        get_brick_box(bx, by, bz, min, max);
+        ivec3 c1 = glm::max(min, fill_min);
+        ivec3 c2 = glm::min(max, fill_max);
+        if (c1 == min && c2 == max) {
+            // whole brick is covered, so just tag it
+            add_brick_counts(bx, by, bz, -1);
+            release_brick(slot.brick);
+            slot.brick = NULL;
+            if (slot.page >= 0) {
+                pager->free_pages.push_back(slot.page);
+                slot.page = -1;
+            }
+            slot.fill = v;
+            add_box_counts(min, max, v, 1);
+            mark_dirty(slot);
+            continue;
+        }
+        VoxelBrick * brick = get_brick(slot);
+        if (brick == NULL) {
+            if (slot.fill == v || slot.page >= 0)
+                continue;
+            add_box_counts(c1, c2, slot.fill, -1);
+            add_box_counts(c1, c2, v, 1);
+            brick = allocate_brick(bx, by, bz);
+        } else {
+            for (int x = c1.x; x < c2.x; x++)
+            for (int y = c1.y; y < c2.y; y++)
+            for (int z = c1.z; z < c2.z; z++)
+                update_counts(x, y, z, brick->get(x & BRICK_MASK,
+                    y & BRICK_MASK, z & BRICK_MASK), v);
+            if (brick->is_shared())
+                brick = unshare_brick(bx, by, bz);
+        }
+        for (int x = c1.x & BRICK_MASK; x <= ((c2.x - 1) & BRICK_MASK); x++)
+        for (int y = c1.y & BRICK_MASK; y <= ((c2.y - 1) & BRICK_MASK); y++)
+            brick->fill_row(x, y, c1.z & BRICK_MASK, c2.z - c1.z, v);
+        mark_dirty(slot);
+    }
+}
+
+// flood fill
+
+// reads the part of a row that matches v around z, stopping at the region
+// bounds. returns false if the voxel at z does not match.
+static bool get_fill_span(VoxelFile * file, int x, int y, int z,
+                          unsigned char v, const ivec3 & min,
+                          const ivec3 & max, int & z1, int & z2)
+{
+    unsigned char row[BRICK_SIZE];
+    file->get_row(x, y, z, 1, row);
+    if (row[0] != v)
+        return false;
+    z1 = z;
+    while (z1 > min.z) {
+        int n = std::min(z1 - min.z, BRICK_SIZE);
+        file->get_row(x, y, z1 - n, n, row);
+        int i = n;
+        while (i > 0 && row[i - 1] == v)
+            i--;
+        z1 -= n - i;
+        if (i > 0)
+            break;
+    }
+    z2 = z + 1;
+    while (z2 < max.z) {
+        int n = std::min(max.z - z2, BRICK_SIZE);
+        file->get_row(x, y, z2, n, row);
+        int i = 0;
+        while (i < n && row[i] == v)
+            i++;
+        z2 += i;
+        if (i < n)
+            break;
+    }
+    return true;
 }
 
-void VoxelModel::update(bool force)
+// pushes one seed per run of v in [z1, z2) of a neighbouring row
+static void add_fill_seeds(VoxelFile * file, int x, int y, int z1, int z2,
+                           unsigned char v, const ivec3 & min,
+                           const ivec3 & max, std::deque<ivec3> & seeds)
 {
-    if (!force && value != 0)
+    if (x < min.x || x >= max.x || y < min.y || y >= max.y)
         return;
-    glNewList(value, GL_COMPILE);
-    draw_immediate();
-    glEndList();
+    unsigned char row[BRICK_SIZE];
+    bool in_run = false;
+    for (int z = z1; z < z2; z += BRICK_SIZE) {
+        int n = std::min(z2 - z, BRICK_SIZE);
+        file->get_row(x, y, z, n, row);
+        for (int i = 0; i < n; i++) {
+            bool match = row[i] == v;
+            if (match && !in_run)
+                seeds.push_back(ivec3(x, y, z + i));
+            in_run = match;
+        }
+    }
 }
 
-void VoxelModel::draw()
+// fills the voxels connected to (x, y, z) that share its color, limited to
+// [region_min, region_max). runs along z are filled at once and queue one
+// seed per neighbouring run. taking seeds in order keeps the queue to the
+// wavefront of the fill. filled voxels no longer match, which keeps them
+// from being visited twice. returns the number of voxels filled.
+int64_t VoxelFile::flood_fill(int x, int y, int z, unsigned char v,
+                              const ivec3 & region_min,
+                              const ivec3 & region_max)
 {
-    if (value == 0) {
-        value = glGenLists(1);
-        update();
+    ivec3 min = glm::max(region_min, ivec3(0));
+    ivec3 max = glm::min(region_max, ivec3(x_size, y_size, z_size));
+    ivec3 p(x, y, z);
+    if (glm::any(glm::lessThan(p, min)) ||
+        glm::any(glm::greaterThanEqual(p, max)))
+        return 0;
+    unsigned char old_v = get(x, y, z);
+    if (old_v == v)
+        return 0;
+    int64_t count = 0;
+    std::deque<ivec3> seeds;
+    seeds.push_back(p);
+    while (!seeds.empty()) {
+        p = seeds.front();
+        seeds.pop_front();
+        int z1, z2;
+        if (!get_fill_span(this, p.x, p.y, p.z, old_v, min, max, z1, z2))
+            continue;
+        fill(p.x, p.y, z1, p.x + 1, p.y + 1, z2, v);
+        count += z2 - z1;
+        add_fill_seeds(this, p.x - 1, p.y, z1, z2, old_v, min, max, seeds);
+        add_fill_seeds(this, p.x + 1, p.y, z1, z2, old_v, min, max, seeds);
+        add_fill_seeds(this, p.x, p.y - 1, z1, z2, old_v, min, max, seeds);
+        add_fill_seeds(this, p.x, p.y + 1, z1, z2, old_v, min, max, seeds);
     }
-    glDisable(GL_TEXTURE_2D);
-    glCallList(value);
+    return count;
 }
 
-VoxelModel::~VoxelModel()
+// replaces every old_v voxel in [region_min, region_max) with v. returns
+// the number of voxels replaced.
+int64_t VoxelFile::replace_color(unsigned char old_v, unsigned char v,
+                                 const ivec3 & region_min,
+                                 const ivec3 & region_max)
 {
-    glDeleteLists(value, 1);
+    ivec3 r1 = glm::max(region_min, ivec3(0));
+    ivec3 r2 = glm::min(region_max, ivec3(x_size, y_size, z_size));
+    if (old_v == v || glm::any(glm::lessThanEqual(r2, r1)))
+        return 0;
+    int64_t count = 0;
+    ivec3 b1 = r1 >> BRICK_SHIFT;
+    ivec3 b2 = (r2 - 1) >> BRICK_SHIFT;
+    ivec3 min, max;
+    for (int bx = b1.x; bx <= b2.x; bx++)
+    for (int by = b1.y; by <= b2.y; by++)
+    for (int bz = b1.z; bz <= b2.z; bz++) {
+        BrickSlot & slot = get_slot(bx, by, bz);
+        get_brick_box(bx, by, bz, min, max);
+        min = glm::max(min, r1);
+        max = glm::min(max, r2);
+        VoxelBrick * brick = get_brick(slot);
+        if (brick == NULL) {
+            if (slot.fill != old_v || slot.page >= 0)
+                continue;
+            ivec3 size = max - min;
+            count += int64_t(size.x) * size.y * size.z;
+            fill(min.x, min.y, min.z, max.x, max.y, max.z, v);
+            continue;
+        }
+        // the local palette tells if the brick has the color at all
+        if (brick->bits < 8) {
+            int i = 0;
+            while (i < brick->colors && brick->palette[i] != old_v)
+                i++;
+            if (i == brick->colors)
+                continue;
+        }
+        int n = max.z - min.z;
+        unsigned char row[BRICK_SIZE];
+        for (int x = min.x; x < max.x; x++)
+        for (int y = min.y; y < max.y; y++) {
+            get_row(x, y, min.z, n, row);
+            bool changed = false;
+            for (int z = 0; z < n; z++) {
+                if (row[z] != old_v)
+                    continue;
+                row[z] = v;
+                changed = true;
+                count++;
+            }
+            if (changed)
+                set_row(x, y, min.z, n, row);
+        }
+    }
+    return count;
 }
 
-ReferencePoint * VoxelModel::get_point(const QString & name)
+// palette remap
+
+// looks every byte of in up in table
+static void remap_bytes_scalar(const unsigned char * in, unsigned char * out,
+                               int n, const unsigned char * table)
 {
-    return file->get_point(name);
+    for (int i = 0; i < n; i++)
+        out[i] = table[in[i]];
 }
 
-// ReferencePoint
+#ifdef VOXIE_CPU_DISPATCH
 
-ReferencePoint::ReferencePoint(const QString & name,int x, int y, int z)
-: name(name), x(x), y(y), z(z)
+// splits the table into 16 rows of 16 bytes and shuffles every row with the
+// low nibbles. the high nibble picks the row: subtracting 16 per row moves
+// the bytes of that row to 0-15, and a saturating add of 0x70 sets bit 7 of
+// all others, which the shuffle turns into 0. there is no ssse3 version,
+// 16 shuffles per 16 bytes lose to the scalar loop.
+__attribute__((target("avx2")))
+static void remap_bytes_avx2(const unsigned char * in, unsigned char * out,
+                             int n, const unsigned char * table)
 {
-
+    __m256i rows[16];
+    for (int r = 0; r < 16; r++) {
+        __m128i row = _mm_loadu_si128((const __m128i*)(table + r * 16));
+        rows[r] = _mm256_broadcastsi128_si256(row);
+    }
+    __m256i step = _mm256_set1_epi8(16);
+    __m256i high = _mm256_set1_epi8(0x70);
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i ret = _mm256_setzero_si256();
+        for (int r = 0; r < 16; r++) {
+            __m256i index = _mm256_adds_epu8(v, high);
+            ret = _mm256_or_si256(ret, _mm256_shuffle_epi8(rows[r], index));
+            v = _mm256_sub_epi8(v, step);
+        }
+        _mm256_storeu_si256((__m256i*)(out + i), ret);
+    }
+    remap_bytes_scalar(in + i, out + i, n - i, table);
 }
-void ReferencePoint::translate()
+
+#endif
+
+typedef void (*RemapBytes)(const unsigned char * in, unsigned char * out,
+                           int n, const unsigned char * table);
+
+static RemapBytes get_remap_bytes()
 {
-    glTranslatef(float(x) + 0.01f, float(y) + 0.01f, float(z) + 0.01f);
+#ifdef VOXIE_CPU_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return remap_bytes_avx2;
+#endif
+    return remap_bytes_scalar;
 }
 
-// VoxelFile
-
-#define PALETTE_FILE "palette.dat"
+static RemapBytes remap_bytes = get_remap_bytes();
 
-void VoxelFile::load_palette()
+// replaces every voxel v with table[v]. air stays air, like the voxels of
+// bricks that lie outside the model. tags and packed bricks only change
+// their palettes, 8 bit bricks are looked up voxel by voxel.
+void VoxelFile::remap(const unsigned char * table)
 {
-    if (global_palette != NULL)
-        return;
-    global_palette = new RGBColor[256];
-    palette_names = new QString[256];
-    QFile fp(PALETTE_FILE);
-    if (!fp.open(QIODevice::ReadOnly))
+    unsigned char lut[256];
+    memcpy(lut, table, sizeof(lut));
+    lut[VOXEL_AIR] = VOXEL_AIR;
+    bool identity = true;
+    bool keep_solid = true;
+    bool merges = false;
+    bool used[256] = {false};
+    for (int i = 0; i < 256; i++) {
+        if (lut[i] != i)
+            identity = false;
+        if (i != VOXEL_AIR && lut[i] == VOXEL_AIR)
+            keep_solid = false;
+        merges = merges || used[lut[i]];
+        used[lut[i]] = true;
+    }
+    if (identity)
         return;
-    for (int i = 0; i < 256; i++)
-        fp.read((char*)&global_palette[i], sizeof(RGBColor));
-    QDataStream stream(&fp);
-    stream.setByteOrder(QDataStream::LittleEndian);
-    if (!fp.atEnd()) {
-        // read names
-        for (int i = 0; i < 256; i++) {
-            read_cstring(stream, palette_names[i]);
+
+    // voxels that turn into air change the slice counts, so those bricks
+    // are counted again. otherwise the color counts just move.
+    int64_t counts[256];
+    memcpy(counts, color_counts, sizeof(counts));
+    unsigned char data[BRICK_VOLUME];
+    for (int bx = 0; bx < x_bricks; bx++)
+    for (int by = 0; by < y_bricks; by++)
+    for (int bz = 0; bz < z_bricks; bz++) {
+        BrickSlot & slot = get_slot(bx, by, bz);
+        VoxelBrick * brick = get_brick(slot);
+        if (brick == NULL) {
+            if (lut[slot.fill] == slot.fill || slot.page >= 0)
+                continue;
+            if (!keep_solid)
+                add_brick_counts(bx, by, bz, -1);
+            slot.fill = lut[slot.fill];
+            if (!keep_solid)
+                add_brick_counts(bx, by, bz, 1);
+            mark_dirty(slot);
+            continue;
+        }
+        // bricks the table leaves as they are stay shared and clean
+        bool changed = false;
+        if (brick->bits < 8) {
+            for (int i = 0; i < brick->colors; i++)
+                changed = changed || lut[brick->palette[i]] !=
+                                     brick->palette[i];
+        } else {
+            remap_bytes(brick->data, data, BRICK_VOLUME, lut);
+            changed = memcmp(data, brick->data, BRICK_VOLUME) != 0;
+        }
+        if (!changed)
+            continue;
+        if (!keep_solid)
+            add_brick_counts(bx, by, bz, -1);
+        if (brick->is_shared())
+            brick = unshare_brick(bx, by, bz);
+        if (brick->bits == 8) {
+            memcpy(brick->data, data, BRICK_VOLUME);
+        } else {
+            for (int i = 0; i < brick->colors; i++)
+                brick->palette[i] = lut[brick->palette[i]];
+        }
+        if (!keep_solid) {
+            brick->update_solid();
+            add_brick_counts(bx, by, bz, 1);
         }
+        mark_dirty(slot);
+        // merged colors may need fewer bits, or just a tag
+        if (merges)
+            compact_brick(bx, by, bz);
     }
-    fp.close();
-}
 
-void VoxelFile::save_palette()
-{
-    if (global_palette == NULL)
-        return;
-    QFile fp(PALETTE_FILE);
-    if (!fp.open(QIODevice::WriteOnly))
+    if (!keep_solid)
         return;
+    memset(color_counts, 0, sizeof(counts));
     for (int i = 0; i < 256; i++)
-        fp.write((char*)&global_palette[i], sizeof(RGBColor));
-    QDataStream stream(&fp);
-    stream.setByteOrder(QDataStream::LittleEndian);
-    for (int i = 0; i < 256; i++)
-        write_cstring(stream, palette_names[i]);
-    fp.close();
+        color_counts[lut[i]] += counts[i];
 }
 
-unsigned char VoxelFile::get_closest_index(RGBColor c)
+// boolean operations
+
+// combines n voxels of two rows into out. every operation picks between
+// two sources depending on whether a test row is air.
+static void combine_row(const unsigned char * a, const unsigned char * b,
+                        unsigned char * out, int n, int op)
 {
-    load_palette();
-    vec3 color_vec(c.r, c.g, c.b);
-    bool is_set = false;
-    float dist;
-    unsigned char current_index = 0;
-    for (int i = 0; i < 256; i++) {
-        RGBColor & pal_color = global_palette[i];
-        vec3 new_vec(pal_color.r, pal_color.g, pal_color.b);
-        float new_dist = glm::distance(color_vec, new_vec);
-        if (is_set && new_dist >= dist)
+    const unsigned char * test = b;
+    const unsigned char * if_air = a;
+    const unsigned char * if_solid = NULL;
+    switch (op) {
+        case CSG_UNION:
+            test = a;
+            if_air = b;
+            if_solid = a;
+            break;
+        case CSG_REPLACE:
+            if_solid = b;
+            break;
+        case CSG_INTERSECT:
+            if_air = NULL;
+            if_solid = a;
+            break;
+    }
+    int i = 0;
+#ifdef VOXIE_SSE2
+    __m128i air = _mm_set1_epi8((char)VOXEL_AIR);
+    for (; i + 16 <= n; i += 16) {
+        __m128i t = _mm_loadu_si128((const __m128i*)(test + i));
+        __m128i is_air = _mm_cmpeq_epi8(t, air);
+        __m128i p = air;
+        __m128i q = air;
+        if (if_air != NULL)
+            p = _mm_loadu_si128((const __m128i*)(if_air + i));
+        if (if_solid != NULL)
+            q = _mm_loadu_si128((const __m128i*)(if_solid + i));
+        __m128i v = _mm_or_si128(_mm_and_si128(is_air, p),
+                                 _mm_andnot_si128(is_air, q));
+        _mm_storeu_si128((__m128i*)(out + i), v);
+    }
+#endif
+    for (; i < n; i++) {
+        if (test[i] == VOXEL_AIR)
+            out[i] = if_air != NULL ? if_air[i] : VOXEL_AIR;
+        else
+            out[i] = if_solid != NULL ? if_solid[i] : VOXEL_AIR;
+    }
+}
+
+// applies op to the box of this model that other overlaps. other is
+// placed by the offsets of both models.
+//
+// CSG_UNION: air takes the voxels of other, the model grows to fit it
+// CSG_SUBTRACT: voxels under solid voxels of other become air
+// CSG_INTERSECT: voxels outside the solid voxels of other become air
+// CSG_REPLACE: solid voxels of other are written over the model
+void VoxelFile::combine(VoxelFile & other, int op)
+{
+    ivec3 size(x_size, y_size, z_size);
+    ivec3 other_size(other.x_size, other.y_size, other.z_size);
+    ivec3 delta = ivec3(other.x_offset, other.y_offset, other.z_offset) -
+                  ivec3(x_offset, y_offset, z_offset);
+    if (op == CSG_UNION && other.color_counts[VOXEL_AIR] !=
+                           other.get_volume()) {
+        ivec3 min = glm::min(ivec3(0), delta);
+        ivec3 max = glm::max(size, delta + other_size);
+        if (min != ivec3(0) || max != size) {
+            ivec3 new_size = max - min;
+            resize(min.x, min.y, min.z, new_size.x, new_size.y,
+                   new_size.z);
+            size = new_size;
+            delta -= min;
+        }
+    }
+    ivec3 r1 = glm::max(ivec3(0), delta);
+    ivec3 r2 = glm::min(size, delta + other_size);
+    if (glm::any(glm::lessThanEqual(r2, r1))) {
+        if (op == CSG_INTERSECT)
+            fill(0, 0, 0, size.x, size.y, size.z, VOXEL_AIR);
+        return;
+    }
+    if (op == CSG_INTERSECT) {
+        // clear the slabs around the overlap
+        fill(0, 0, 0, r1.x, size.y, size.z, VOXEL_AIR);
+        fill(r2.x, 0, 0, size.x, size.y, size.z, VOXEL_AIR);
+        fill(r1.x, 0, 0, r2.x, r1.y, size.z, VOXEL_AIR);
+        fill(r1.x, r2.y, 0, r2.x, size.y, size.z, VOXEL_AIR);
+        fill(r1.x, r1.y, 0, r2.x, r2.y, r1.z, VOXEL_AIR);
+        fill(r1.x, r1.y, r2.z, r2.x, r2.y, size.z, VOXEL_AIR);
+    }
+
+    ivec3 b1 = r1 >> BRICK_SHIFT;
+    ivec3 b2 = (r2 - 1) >> BRICK_SHIFT;
+    std::vector<unsigned char> rows(BRICK_SIZE * 3);
+    unsigned char * a = &rows[0];
+    unsigned char * b = a + BRICK_SIZE;
+    unsigned char * out = b + BRICK_SIZE;
+    for (int bx = b1.x; bx <= b2.x; bx++)
+    for (int by = b1.y; by <= b2.y; by++)
+    for (int bz = b1.z; bz <= b2.z; bz++) {
+        ivec3 min, max;
+        get_brick_box(bx, by, bz, min, max);
+        min = glm::max(min, r1);
+        max = glm::min(max, r2);
+
+        // uniform boxes of either side mostly decide the result at once
+        int other_fill = other.get_uniform(min - delta, max - delta);
+        if (other_fill == VOXEL_AIR) {
+            if (op == CSG_INTERSECT)
+                fill(min.x, min.y, min.z, max.x, max.y, max.z, VOXEL_AIR);
             continue;
-        is_set = true;
-        dist = new_dist;
-        current_index = i;
+        }
+        int fill_v = get_uniform(min, max);
+        if (other_fill != -1) {
+            if (op == CSG_INTERSECT)
+                continue;
+            if (op == CSG_SUBTRACT || op == CSG_REPLACE ||
+                fill_v == VOXEL_AIR) {
+                unsigned char v = (unsigned char)other_fill;
+                if (op == CSG_SUBTRACT)
+                    v = VOXEL_AIR;
+                fill(min.x, min.y, min.z, max.x, max.y, max.z, v);
+                continue;
+            }
+        }
+        if (fill_v == VOXEL_AIR &&
+            (op == CSG_SUBTRACT || op == CSG_INTERSECT))
+            continue;
+        if (fill_v != -1 && fill_v != VOXEL_AIR && op == CSG_UNION)
+            continue;
+
+        int n = max.z - min.z;
+        for (int x = min.x; x < max.x; x++)
+        for (int y = min.y; y < max.y; y++) {
+            get_row(x, y, min.z, n, a);
+            other.get_row(x - delta.x, y - delta.y, min.z - delta.z, n, b);
+            combine_row(a, b, out, n, op);
+            if (memcmp(a, out, n) != 0)
+                set_row(x, y, min.z, n, out);
+        }
     }
-    return current_index;
 }
 
-VoxelFile::VoxelFile()
-: data(NULL), model(NULL), shape(NULL)
+// morphology. the structuring element is a cube, so radius is a distance
+// along each axis.
+
+// grows the model so the solid voxels have margin voxels of room around them
+void VoxelFile::fit_margin(int margin)
 {
-    load_palette();
+    ivec3 min, max;
+    if (!get_solid_bounds(min, max))
+        return;
+    ivec3 size(x_size, y_size, z_size);
+    min = glm::min(ivec3(0), min - margin);
+    max = glm::max(size, max + margin);
+    if (min == ivec3(0) && max == size)
+        return;
+    size = max - min;
+    resize(min.x, min.y, min.z, size.x, size.y, size.z);
 }
 
-VoxelFile::VoxelFile(QFile & fp)
-: data(NULL), model(NULL), shape(NULL)
+// air within radius of a solid voxel becomes v
+void VoxelFile::dilate(int radius, unsigned char v)
 {
-    load_palette();
-    load_fp(fp);
+    if (radius <= 0)
+        return;
+    fit_margin(radius);
+    VoxelMask solid;
+    solid.build(this);
+    VoxelMask mask = solid;
+    mask.dilate(radius);
+    mask.apply(this, solid, v);
 }
 
-VoxelFile::VoxelFile(const QString & filename)
-: data(NULL), model(NULL), shape(NULL)
+// solid voxels within radius of air or the model bounds become air
+void VoxelFile::erode(int radius)
 {
-    load_palette();
-    load(filename);
+    if (radius <= 0)
+        return;
+    VoxelMask solid;
+    solid.build(this);
+    VoxelMask mask = solid;
+    mask.erode(radius);
+    mask.apply(this, solid, VOXEL_AIR);
 }
 
-VoxelFile::VoxelFile(int x_size, int y_size, int z_size)
-: x_offset(0), y_offset(0), z_offset(0), data(NULL), model(NULL), shape(NULL)
+// removes the details that a cube of the radius does not fit in
+void VoxelFile::open(int radius)
 {
-    load_palette();
-    reset(x_size, y_size, z_size);
+    if (radius <= 0)
+        return;
+    VoxelMask solid;
+    solid.build(this);
+    VoxelMask mask = solid;
+    mask.erode(radius);
+    mask.dilate(radius);
+    mask.apply(this, solid, VOXEL_AIR);
 }
 
-VoxelFile::~VoxelFile()
+// fills the gaps and dents that a cube of the radius does not fit in
+void VoxelFile::close(int radius, unsigned char v)
 {
-    delete shape;
-    delete[] data;
+    if (radius <= 0)
+        return;
+    fit_margin(radius);
+    VoxelMask solid;
+    solid.build(this);
+    VoxelMask mask = solid;
+    mask.dilate(radius);
+    mask.erode(radius);
+    mask.apply(this, solid, v);
 }
 
-void VoxelFile::update_model()
+// keeps the outer thickness voxels of the solid parts
+void VoxelFile::hollow(int thickness)
 {
-    if (model == NULL)
+    if (thickness <= 0)
         return;
-    model->update();
+    VoxelMask solid;
+    solid.build(this);
+    VoxelMask inside = solid;
+    inside.erode(thickness);
+    VoxelMask mask = solid;
+    mask.subtract(inside);
+    mask.apply(this, solid, VOXEL_AIR);
 }
 
-void VoxelFile::reset(int x_size, int y_size, int z_size)
+// replaces the model with the layer of v that is thickness voxels thick
+// around it, i.e. its outline
+void VoxelFile::shell(int thickness, unsigned char v)
 {
-    this->x_size = x_size;
-    this->y_size = y_size;
-    this->z_size = z_size;
-    if (data != NULL)
-        delete[] data;
-    data = new unsigned char[x_size * y_size * z_size];
-    memset(data, 255, x_size * y_size * z_size);
-    points.clear();
-    reset_shape();
+    if (thickness <= 0)
+        return;
+    fit_margin(thickness);
+    VoxelMask solid;
+    solid.build(this);
+    VoxelMask mask = solid;
+    mask.dilate(thickness);
+    mask.subtract(solid);
+    mask.apply(this, solid, v);
 }
 
 void VoxelFile::add_point(const QString & name,
@@ -339,57 +2026,311 @@ void VoxelFile::resize(int x1, int y1, int z1, int new_x, int new_y, int new_z)
         x_size == new_x && y_size == new_y && z_size == new_z)
         return;
 
-    unsigned char * new_data = new unsigned char[new_x * new_y * new_z];
-    int nx, ny, nz;
-    for (int x = x1; x < x1 + new_x; x++)
-    for (int y = y1; y < y1 + new_y; y++)
-    for (int z = z1; z < z1 + new_z; z++) {
-        unsigned char c;
-        if (x < 0 || x >= x_size ||
-            y < 0 || y >= y_size ||
-            z < 0 ||z >= z_size)
-            c = VOXEL_AIR;
-        else
-            c = get(x, y, z);
-        nx = x - x1;
-        ny = y - y1;
-        nz = z - z1;
-        new_data[nz + ny * new_z + nx * new_z * new_y] = c;
+    // only populated bricks need to be copied, the rest stays air
+    VoxelFile new_file(new_x, new_y, new_z);
+    inherit_paging(new_file);
+    ivec3 start(x1, y1, z1);
+    ivec3 end = start + ivec3(new_x, new_y, new_z);
+    ivec3 min, max;
+    for (int bx = 0; bx < x_bricks; bx++)
+    for (int by = 0; by < y_bricks; by++)
+    for (int bz = 0; bz < z_bricks; bz++) {
+        BrickSlot & slot = get_slot(bx, by, bz);
+        if (slot.is_empty())
+            continue;
+        get_brick_box(bx, by, bz, min, max);
+        min = glm::max(min, start);
+        max = glm::min(max, end);
+        if (min.x >= max.x || min.y >= max.y || min.z >= max.z)
+            continue;
+        VoxelBrick * brick = get_brick(slot);
+        if (brick == NULL) {
+            ivec3 n1 = min - start;
+            ivec3 n2 = max - start;
+            new_file.fill(n1.x, n1.y, n1.z, n2.x, n2.y, n2.z, slot.fill);
+            continue;
+        }
+        unsigned char row[BRICK_SIZE];
+        int n = max.z - min.z;
+        for (int x = min.x; x < max.x; x++)
+        for (int y = min.y; y < max.y; y++) {
+            brick->get_row(x & BRICK_MASK, y & BRICK_MASK,
+                           min.z & BRICK_MASK, n, row);
+            new_file.set_row(x - x1, y - y1, min.z - z1, n, row);
+        }
     }
-    delete[] data;
-    data = new_data;
-    x_size = new_x;
-    y_size = new_y;
-    z_size = new_z;
+    swap_bricks(new_file);
+    compact_bricks();
     x_offset += x1;
     y_offset += y1;
     z_offset += z1;
 }
 
-void VoxelFile::scale(float sx, float sy, float sz)
+// source voxel range [start, end) of every destination voxel along one axis
+class ScaleAxis
 {
-    if (sx == 1.0f && sy == 1.0f && sz == 1.0f)
-        return;
+public:
+    std::vector<int> start, end;
+    // every destination voxel has exactly one source voxel
+    bool single;
+
+    void init(int size, int new_size, float s)
+    {
+        start.resize(new_size);
+        end.resize(new_size);
+        single = true;
+        for (int i = 0; i < new_size; i++) {
+            int a = std::min(size - 1, int(i / double(s)));
+            int b = std::min(size, int((i + 1) / double(s)));
+            // the last block picks up what truncating the size left over
+            if (i == new_size - 1 && s < 1.0f)
+                b = size;
+            b = std::max(a + 1, b);
+            start[i] = a;
+            end[i] = b;
+            if (b - a != 1)
+                single = false;
+        }
+    }
+};
 
-    int new_x = int(x_size * sx);
-    int new_y = int(y_size * sy);
-    int new_z = int(z_size * sz);
+// solid counts of one destination brick column, merged once all are done
+class ScaleCounts
+{
+public:
+    int64_t colors[256];
+    int64_t x[BRICK_SIZE], y[BRICK_SIZE];
+    std::vector<int64_t> z;
+
+    ScaleCounts()
+    {
+        memset(colors, 0, sizeof(colors));
+        memset(x, 0, sizeof(x));
+        memset(y, 0, sizeof(y));
+    }
+};
 
-    unsigned char * new_data = new unsigned char[new_x * new_y * new_z];
+// resamples one destination brick column per job piece. destination voxels
+// take the nearest source voxel, or the most common color of their source
+// block when scaling down.
+class ScaleJob : public ParallelJob
+{
+public:
+    VoxelFile * src;
+    VoxelFile * dst;
+    ScaleAxis axes[3];
+    bool prefer_solid;
+    std::vector<ScaleCounts> counts;
+
+    ScaleJob(VoxelFile * src, VoxelFile * dst, const vec3 & factors,
+             bool prefer_solid)
+    : src(src), dst(dst), prefer_solid(prefer_solid)
+    {
+        ivec3 size(src->x_size, src->y_size, src->z_size);
+        ivec3 new_size(dst->x_size, dst->y_size, dst->z_size);
+        for (int i = 0; i < 3; i++)
+            axes[i].init(size[i], new_size[i], factors[i]);
+        counts.resize(dst->x_bricks * dst->y_bricks);
+    }
 
-    for (int x = 0; x < new_x; x++)
-    for (int y = 0; y < new_y; y++)
-    for (int z = 0; z < new_z; z++) {
-        int x2 = int(x / sx);
-        int y2 = int(y / sy);
-        int z2 = int(z / sz);
-        new_data[z + y * new_z + x * new_z * new_y] = get(x2, y2, z2);
+    void run(int i)
+    {
+        int x = i / dst->y_bricks;
+        int y = i % dst->y_bricks;
+        ScaleCounts & c = counts[i];
+        c.z.assign(dst->z_size, 0);
+        std::vector<unsigned char> rows;
+        for (int z = 0; z < dst->z_bricks; z++)
+            scale_brick(ivec3(x, y, z), c, rows);
     }
-    delete[] data;
-    data = new_data;
-    x_size = new_x;
-    y_size = new_y;
-    z_size = new_z;
+
+    void scale_brick(const ivec3 & brick, ScaleCounts & c,
+                     std::vector<unsigned char> & rows)
+    {
+        ivec3 dst_min, dst_max;
+        dst->get_brick_box(brick.x, brick.y, brick.z, dst_min, dst_max);
+        ivec3 min, max;
+        for (int i = 0; i < 3; i++) {
+            min[i] = axes[i].start[dst_min[i]];
+            max[i] = axes[i].end[dst_max[i] - 1];
+        }
+        ivec3 size = dst_max - dst_min;
+        int fill = src->get_uniform(min, max);
+        if (fill == VOXEL_AIR)
+            return;
+        if (fill != -1) {
+            dst->get_slot(brick.x, brick.y, brick.z).fill =
+                (unsigned char)fill;
+            add_counts(c, dst_min, size, (unsigned char)fill);
+            return;
+        }
+
+        unsigned char data[BRICK_VOLUME];
+        memset(data, VOXEL_AIR, BRICK_VOLUME);
+        const ScaleAxis & ax = axes[0];
+        const int slab = BRICK_SIZE * BRICK_SIZE;
+        for (int x = 0; x < size.x; x++) {
+            unsigned char * out = &data[x * slab];
+            // upscaled slabs repeat their neighbour
+            int x1 = ax.start[dst_min.x + x];
+            if (x > 0 && ax.single && x1 == ax.start[dst_min.x + x - 1]) {
+                memcpy(out, out - slab, slab);
+                continue;
+            }
+            scale_slab(dst_min, size, min, max, x, out, rows);
+        }
+        dst->store_brick(brick.x, brick.y, brick.z, data);
+
+        for (int x = 0; x < size.x; x++)
+        for (int y = 0; y < size.y; y++) {
+            const unsigned char * row =
+                &data[(y | (x << BRICK_SHIFT)) << BRICK_SHIFT];
+            unsigned int mask = get_solid_mask(row);
+            int count = count_bits(mask);
+            c.x[x] += count;
+            c.y[y] += count;
+            while (mask != 0) {
+                int z = count_trailing_zeros(mask);
+                c.colors[row[z]]++;
+                c.z[dst_min.z + z]++;
+                mask &= mask - 1;
+            }
+        }
+    }
+
+    // fills the rows of one destination x slab of a brick
+    void scale_slab(const ivec3 & dst_min, const ivec3 & size,
+                    const ivec3 & min, const ivec3 & max, int x,
+                    unsigned char * out, std::vector<unsigned char> & rows)
+    {
+        const ScaleAxis & ax = axes[0];
+        const ScaleAxis & ay = axes[1];
+        const ScaleAxis & az = axes[2];
+        int len = max.z - min.z;
+        int x1 = ax.start[dst_min.x + x];
+        int x2 = ax.end[dst_min.x + x];
+        const int * z1 = &az.start[dst_min.z];
+        const int * z2 = &az.end[dst_min.z];
+        for (int y = 0; y < size.y; y++, out += BRICK_SIZE) {
+            int y1 = ay.start[dst_min.y + y];
+            int y2 = ay.end[dst_min.y + y];
+            if (y > 0 && ay.single && x2 - x1 == 1 &&
+                y1 == ay.start[dst_min.y + y - 1]) {
+                memcpy(out, out - BRICK_SIZE, size.z);
+                continue;
+            }
+            int count = (x2 - x1) * (y2 - y1);
+            rows.resize(size_t(count) * len);
+            unsigned char * row = &rows[0];
+            for (int sx = x1; sx < x2; sx++)
+            for (int sy = y1; sy < y2; sy++) {
+                src->get_row(sx, sy, min.z, len, row);
+                row += len;
+            }
+            if (count == 1 && az.single) {
+                for (int z = 0; z < size.z; z++)
+                    out[z] = rows[z1[z] - min.z];
+                continue;
+            }
+            for (int z = 0; z < size.z; z++)
+                out[z] = vote(&rows[0], count, len, z1[z] - min.z,
+                              z2[z] - min.z);
+        }
+    }
+
+    // most common color of [z1, z2) across count rows, earliest on ties
+    unsigned char vote(const unsigned char * rows, int count, int len,
+                       int z1, int z2)
+    {
+        int votes[256];
+        unsigned char seen[256];
+        int n = 0;
+        for (int i = 0; i < count; i++, rows += len)
+        for (int z = z1; z < z2; z++) {
+            unsigned char v = rows[z];
+            if (v == VOXEL_AIR && prefer_solid)
+                continue;
+            if (n == 0 || !has_vote(seen, n, v)) {
+                seen[n++] = v;
+                votes[v] = 0;
+            }
+            votes[v]++;
+        }
+        if (n == 0)
+            return VOXEL_AIR;
+        unsigned char best = seen[0];
+        for (int i = 1; i < n; i++) {
+            if (votes[seen[i]] > votes[best])
+                best = seen[i];
+        }
+        return best;
+    }
+
+    static bool has_vote(const unsigned char * seen, int n, unsigned char v)
+    {
+        for (int i = 0; i < n; i++) {
+            if (seen[i] == v)
+                return true;
+        }
+        return false;
+    }
+
+    void add_counts(ScaleCounts & c, const ivec3 & min, const ivec3 & size,
+                    unsigned char v)
+    {
+        c.colors[v] += int64_t(size.x) * size.y * size.z;
+        if (v == VOXEL_AIR)
+            return;
+        for (int x = 0; x < size.x; x++)
+            c.x[x] += size.y * size.z;
+        for (int y = 0; y < size.y; y++)
+            c.y[y] += size.x * size.z;
+        for (int z = min.z; z < min.z + size.z; z++)
+            c.z[z] += size.x * size.y;
+    }
+};
+
+// nearest neighbour when scaling up, per block mode voting when scaling
+// down. with prefer_solid, air only wins blocks that have nothing else.
+void VoxelFile::scale(float sx, float sy, float sz, bool prefer_solid)
+{
+    if (sx == 1.0f && sy == 1.0f && sz == 1.0f)
+        return;
+
+    int new_x = std::max(1, int(x_size * sx));
+    int new_y = std::max(1, int(y_size * sy));
+    int new_z = std::max(1, int(z_size * sz));
+
+    VoxelFile new_file(new_x, new_y, new_z);
+    inherit_paging(new_file);
+    ScaleJob job(this, &new_file, vec3(sx, sy, sz), prefer_solid);
+    bool threaded = pager == NULL && new_file.pager == NULL;
+    parallel_for(job, new_file.x_bricks * new_file.y_bricks, threaded);
+
+    // the untouched bricks are still counted as air
+    for (size_t i = 0; i < job.counts.size(); i++) {
+        ScaleCounts & c = job.counts[i];
+        int bx = int(i) / new_file.y_bricks;
+        int by = int(i) % new_file.y_bricks;
+        for (int v = 0; v < 256; v++) {
+            if (v == VOXEL_AIR)
+                continue;
+            new_file.color_counts[v] += c.colors[v];
+            new_file.color_counts[VOXEL_AIR] -= c.colors[v];
+        }
+        for (int j = 0; j < BRICK_SIZE; j++) {
+            int x = (bx << BRICK_SHIFT) + j;
+            int y = (by << BRICK_SHIFT) + j;
+            if (x < new_x)
+                new_file.x_counts[x] += c.x[j];
+            if (y < new_y)
+                new_file.y_counts[y] += c.y[j];
+        }
+        for (int z = 0; z < new_z; z++)
+            new_file.z_counts[z] += c.z[z];
+    }
+
+    swap_bricks(new_file);
     x_offset = int(x_offset * sx);
     y_offset = int(y_offset * sy);
     z_offset = int(z_offset * sz);
@@ -400,6 +2341,7 @@ void VoxelFile::set_offset(int new_x, int new_y, int new_z)
     x_offset = new_x;
     y_offset = new_y;
     z_offset = new_z;
+    mark_layout();
 }
 
 vec3 VoxelFile::get_min()
@@ -414,81 +2356,246 @@ vec3 VoxelFile::get_max()
 
 void VoxelFile::optimize()
 {
-    int x1, y1, z1, x2, y2, z2, x, y, z;
-
-    // min coordinates
-
-    for (x1 = 0; x1 < x_size; x1++)
-    for (y = 0; y < y_size; y++)
-    for (z = 0; z < z_size; z++)
-        if (is_solid_fast(x1, y, z))
-            goto x1_end;
-x1_end:
-
-    for (y1 = 0; y1 < y_size; y1++)
-    for (x = 0; x < x_size; x++)
-    for (z = 0; z < z_size; z++)
-        if (is_solid_fast(x, y1, z))
-            goto y1_end;
-y1_end:
-
-    for (z1 = 0; z1 < z_size; z1++)
-    for (x = 0; x < x_size; x++)
-    for (y = 0; y < y_size; y++)
-        if (is_solid_fast(x, y, z1))
-            goto z1_end;
-z1_end:
-
-    // max coordinates
-
-    for (x2 = x_size - 1; x2 >= x1; x2--)
-    for (y = y1; y < y_size; y++)
-    for (z = z1; z < z_size; z++)
-        if (is_solid_fast(x2, y, z))
-            goto x2_end;
-x2_end:
-
-    for (y2 = y_size - 1; y2 >= y1; y2--)
-    for (x = x1; x < x_size; x++)
-    for (z = z1; z < z_size; z++)
-        if (is_solid_fast(x, y2, z))
-            goto y2_end;
-y2_end:
-
-    for (z2 = z_size - 1; z2 >= z1; z2--)
-    for (x = x1; x < x_size; x++)
-    for (y = y1; y < y_size; y++)
-        if (is_solid_fast(x, y, z2))
-            goto z2_end;
-z2_end:
-
-    resize(x1, y1, z1, x2 - x1 + 1, y2 - y1 + 1, z2 - z1 + 1);
+    ivec3 min, max;
+    // nothing to optimize for an empty model
+    if (!get_solid_bounds(min, max))
+        return;
+    ivec3 size = max - min;
+    resize(min.x, min.y, min.z, size.x, size.y, size.z);
 }
 
 void VoxelFile::rotate()
 {
-    int new_x = y_size;
-    int new_y = x_size;
-    int new_z = z_size;
+    orient(VoxelOrientation::rotation(2));
+}
 
-    unsigned char * new_data = new unsigned char[new_x * new_y * new_z];
-    for (int x = 0; x < x_size; x++)
-    for (int y = 0; y < y_size; y++)
-    for (int z = 0; z < z_size; z++) {
-        int nx = y_size - y - 1;
-        int ny = x;
-        int nz = z;
-        new_data[nz + ny * new_z + nx * new_z * new_y] = get(x, y, z);
+// VoxelOrientation
+
+VoxelOrientation::VoxelOrientation()
+{
+    for (int i = 0; i < 3; i++) {
+        axes[i] = i;
+        flip[i] = false;
     }
-    delete[] data;
-    data = new_data;
-    int x_off = x_offset;
-    int y_off = y_offset;
-    x_offset = -y_off - y_size;
-    y_offset = x_off;
-    x_size = new_x;
-    y_size = new_y;
-    z_size = new_z;
+}
+
+// quarter turns about an axis, counterclockwise when looking down on it
+VoxelOrientation VoxelOrientation::rotation(int axis, int turns)
+{
+    VoxelOrientation turn;
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    turn.axes[u] = v;
+    turn.flip[u] = true;
+    turn.axes[v] = u;
+    VoxelOrientation ret;
+    for (int i = 0; i < (turns & 3); i++)
+        ret = turn * ret;
+    return ret;
+}
+
+VoxelOrientation VoxelOrientation::mirror(int axis)
+{
+    VoxelOrientation ret;
+    ret.flip[axis] = true;
+    return ret;
+}
+
+// applies other first, then this
+VoxelOrientation VoxelOrientation::operator*(
+    const VoxelOrientation & other) const
+{
+    VoxelOrientation ret;
+    for (int i = 0; i < 3; i++) {
+        ret.axes[i] = other.axes[axes[i]];
+        ret.flip[i] = flip[i] != other.flip[axes[i]];
+    }
+    return ret;
+}
+
+// true for the orientations that turn the model inside out
+bool VoxelOrientation::is_mirror() const
+{
+    // swapping two axes or reversing one both mirror the model
+    int count = int(axes[0] > axes[1]) + int(axes[0] > axes[2]) +
+                int(axes[1] > axes[2]);
+    for (int i = 0; i < 3; i++)
+        count += int(flip[i]);
+    return (count & 1) != 0;
+}
+
+ivec3 VoxelOrientation::get_size(const ivec3 & size) const
+{
+    return ivec3(size[axes[0]], size[axes[1]], size[axes[2]]);
+}
+
+// maps voxel p of a model of the given size
+ivec3 VoxelOrientation::apply(const ivec3 & p, const ivec3 & size) const
+{
+    ivec3 ret;
+    for (int i = 0; i < 3; i++) {
+        int a = axes[i];
+        ret[i] = flip[i] ? size[a] - 1 - p[a] : p[a];
+    }
+    return ret;
+}
+
+// orients one destination brick at a time, gathering the source box into
+// a 16^3 tile and transposing it in cache. jobs are brick columns along z.
+class OrientJob : public ParallelJob
+{
+public:
+    VoxelFile * src;
+    VoxelFile * dst;
+    const VoxelOrientation & orientation;
+
+    OrientJob(VoxelFile * src, VoxelFile * dst,
+              const VoxelOrientation & orientation)
+    : src(src), dst(dst), orientation(orientation)
+    {
+    }
+
+    void run(int i)
+    {
+        int x = i / dst->y_bricks;
+        int y = i % dst->y_bricks;
+        for (int z = 0; z < dst->z_bricks; z++)
+            orient_brick(ivec3(x, y, z));
+    }
+
+    void orient_brick(const ivec3 & brick)
+    {
+        ivec3 dst_min, dst_max;
+        dst->get_brick_box(brick.x, brick.y, brick.z, dst_min, dst_max);
+        ivec3 src_size(src->x_size, src->y_size, src->z_size);
+        ivec3 min, max;
+        for (int i = 0; i < 3; i++) {
+            int a = orientation.axes[i];
+            if (orientation.flip[i]) {
+                min[a] = src_size[a] - dst_max[i];
+                max[a] = src_size[a] - dst_min[i];
+            } else {
+                min[a] = dst_min[i];
+                max[a] = dst_max[i];
+            }
+        }
+        int fill = src->get_uniform(min, max);
+        if (fill == VOXEL_AIR)
+            return;
+        if (fill != -1) {
+            dst->get_slot(brick.x, brick.y, brick.z).fill =
+                (unsigned char)fill;
+            return;
+        }
+
+        // gather the source box, indexed like a brick
+        unsigned char tile[BRICK_VOLUME];
+        ivec3 size = max - min;
+        for (int x = 0; x < size.x; x++)
+        for (int y = 0; y < size.y; y++)
+            src->get_row(min.x + x, min.y + y, min.z, size.z,
+                         &tile[(y | (x << BRICK_SHIFT)) << BRICK_SHIFT]);
+
+        // walk the tile along the source axis of every destination axis
+        const int strides[3] = {BRICK_SIZE * BRICK_SIZE, BRICK_SIZE, 1};
+        int start = 0;
+        int step[3];
+        for (int i = 0; i < 3; i++) {
+            int a = orientation.axes[i];
+            step[i] = strides[a];
+            if (orientation.flip[i]) {
+                start += (size[a] - 1) * strides[a];
+                step[i] = -step[i];
+            }
+        }
+        unsigned char data[BRICK_VOLUME];
+        memset(data, VOXEL_AIR, BRICK_VOLUME);
+        ivec3 dst_size = dst_max - dst_min;
+        for (int x = 0; x < dst_size.x; x++)
+        for (int y = 0; y < dst_size.y; y++) {
+            unsigned char * out =
+                &data[(y | (x << BRICK_SHIFT)) << BRICK_SHIFT];
+            int in = start + x * step[0] + y * step[1];
+            for (int z = 0; z < dst_size.z; z++) {
+                out[z] = tile[in];
+                in += step[2];
+            }
+        }
+        dst->store_brick(brick.x, brick.y, brick.z, data);
+    }
+};
+
+void VoxelFile::orient(const VoxelOrientation & orientation)
+{
+    ivec3 size(x_size, y_size, z_size);
+    ivec3 new_size = orientation.get_size(size);
+    VoxelFile new_file(new_size.x, new_size.y, new_size.z);
+    inherit_paging(new_file);
+    OrientJob job(this, &new_file, orientation);
+    bool threaded = pager == NULL && new_file.pager == NULL;
+    parallel_for(job, new_file.x_bricks * new_file.y_bricks, threaded);
+
+    // the counts only move between slices
+    memcpy(new_file.color_counts, color_counts, sizeof(color_counts));
+    std::vector<int64_t> * counts[3] = {&x_counts, &y_counts, &z_counts};
+    std::vector<int64_t> * new_counts[3] = {&new_file.x_counts,
+                                            &new_file.y_counts,
+                                            &new_file.z_counts};
+    ivec3 offset(x_offset, y_offset, z_offset);
+    ivec3 new_offset;
+    for (int i = 0; i < 3; i++) {
+        int a = orientation.axes[i];
+        *new_counts[i] = *counts[a];
+        if (orientation.flip[i]) {
+            std::reverse(new_counts[i]->begin(), new_counts[i]->end());
+            new_offset[i] = -offset[a] - size[a];
+        } else
+            new_offset[i] = offset[a];
+    }
+    x_offset = new_offset.x;
+    y_offset = new_offset.y;
+    z_offset = new_offset.z;
+    swap_bricks(new_file);
+}
+
+// stores a whole unpacked brick, tagging it if it only has a single color.
+// counts and epochs are left to the caller, so while the file is not
+// paged, different bricks may be stored from different threads.
+void VoxelFile::store_brick(int x, int y, int z, const unsigned char * data)
+{
+    BrickSlot & slot = get_slot(x, y, z);
+    release_brick(slot.brick);
+    slot.brick = NULL;
+    if (slot.page >= 0) {
+        pager->free_pages.push_back(slot.page);
+        slot.page = -1;
+    }
+    ivec3 min, max;
+    get_brick_box(x, y, z, min, max);
+    ivec3 size = max - min;
+    unsigned char v = data[0];
+    bool uniform = true;
+    for (int i = 0; i < size.x && uniform; i++)
+    for (int j = 0; j < size.y && uniform; j++) {
+        const unsigned char * row =
+            &data[(j | (i << BRICK_SHIFT)) << BRICK_SHIFT];
+        for (int k = 0; k < size.z; k++) {
+            if (row[k] != v) {
+                uniform = false;
+                break;
+            }
+        }
+    }
+    if (uniform) {
+        slot.fill = v;
+        return;
+    }
+    if (pager != NULL)
+        pager->reserve();
+    VoxelBrick * brick = new VoxelBrick;
+    brick->pack(data);
+    brick->stamp = page_clock;
+    slot.brick = brick;
 }
 
 bool VoxelFile::load(const QString & filename)
@@ -501,6 +2608,12 @@ bool VoxelFile::load(const QString & filename)
     return true;
 }
 
+// number of z rows to read or write at once
+int VoxelFile::get_chunk_rows()
+{
+    return std::max(1, std::min(y_size, (1 << 24) / std::max(1, z_size)));
+}
+
 void VoxelFile::load_fp(QFile & fp)
 {
     QDataStream stream(&fp);
@@ -511,10 +2624,19 @@ void VoxelFile::load_fp(QFile & fp)
     stream >> x_offset;
     stream >> y_offset;
     stream >> z_offset;
-    if (data != NULL)
-        delete[] data;
-    data = new unsigned char[x_size * y_size * z_size];
-    stream.readRawData((char*)data, x_size * y_size * z_size);
+    reset(x_size, y_size, z_size);
+    if (get_volume() > memory_limit)
+        enable_paging(memory_limit);
+    int rows = get_chunk_rows();
+    std::vector<unsigned char> chunk(size_t(rows) * z_size);
+    for (int x = 0; x < x_size; x++)
+    for (int y = 0; y < y_size; y += rows) {
+        int n = std::min(rows, y_size - y);
+        stream.readRawData((char*)&chunk[0], n * z_size);
+        for (int i = 0; i < n; i++)
+            set_row(x, y + i, 0, z_size, &chunk[size_t(i) * z_size]);
+    }
+    compact_bricks();
     stream.skipRawData(256 * 3);
 
     // reference points
@@ -554,7 +2676,15 @@ void VoxelFile::save_fp(QFile & fp)
     stream << x_offset;
     stream << y_offset;
     stream << z_offset;
-    stream.writeRawData((char*)data, x_size * y_size * z_size);
+    int rows = get_chunk_rows();
+    std::vector<unsigned char> chunk(size_t(rows) * z_size);
+    for (int x = 0; x < x_size; x++)
+    for (int y = 0; y < y_size; y += rows) {
+        int n = std::min(rows, y_size - y);
+        for (int i = 0; i < n; i++)
+            get_row(x, y + i, 0, z_size, &chunk[size_t(i) * z_size]);
+        stream.writeRawData((char*)&chunk[0], n * z_size);
+    }
     stream.writeRawData((char*)global_palette, 256 * 3);
     stream << quint8(points.size());
     ReferencePoints::const_iterator it;
@@ -577,44 +2707,6 @@ VoxelModel * VoxelFile::get_model()
     return model;
 }
 
-btCompoundShape * VoxelFile::get_shape()
-{
-    if (shape != NULL)
-        return shape;
-    btCompoundShape * shape = new btCompoundShape(true);
-    const float s = 0.5f;
-    static btBoxShape * box_shape = new btBoxShape(btVector3(s, s, s));
-    btTransform transform;
-    for (int x = 0; x < x_size; x++)
-    for (int y = 0; y < y_size; y++)
-    for (int z = 0; z < z_size; z++) {
-        if (!is_solid(x, y, z))
-            continue;
-        // ignore if not an exposed block
-        if (is_solid(x + 1, y, z) &&
-            is_solid(x - 1, y, z) &&
-            is_solid(x, y + 1, z) &&
-            is_solid(x, y - 1, z) &&
-            is_solid(x, y, z + 1) &&
-            is_solid(x, y, z - 1))
-            continue;
-
-        transform.setIdentity();
-        transform.setOrigin(btVector3(x + x_offset + 0.5f,
-                                      y + y_offset + 0.5f,
-                                      z + z_offset + 0.5f));
-        shape->addChildShape(transform, box_shape);
-    }
-    this->shape = shape;
-    return shape;
-}
-
-void VoxelFile::reset_shape()
-{
-    delete shape;
-    shape = NULL;
-}
-
 void VoxelFile::clone(VoxelFile & other)
 {
     x_size = other.x_size;
@@ -624,8 +2716,37 @@ void VoxelFile::clone(VoxelFile & other)
     y_offset = other.y_offset;
     z_offset = other.z_offset;
     points = other.points;
-    delete[] data;
-    size_t size = x_size * y_size * z_size;
-    data = new unsigned char[size];
-    memcpy(data, other.data, size);
+    free_bricks();
+    x_bricks = other.x_bricks;
+    y_bricks = other.y_bricks;
+    z_bricks = other.z_bricks;
+    // share the bricks, they are copied once either file writes to them
+    bricks = other.bricks;
+    memcpy(color_counts, other.color_counts, sizeof(color_counts));
+    x_counts = other.x_counts;
+    y_counts = other.y_counts;
+    z_counts = other.z_counts;
+    if (other.pager != NULL)
+        enable_paging(other.pager->max_bytes);
+    BrickSlots::iterator it;
+    for (it = bricks.begin(); it != bricks.end(); it++) {
+        BrickSlot & slot = *it;
+        if (slot.brick != NULL)
+            slot.brick->refs.ref();
+        if (slot.page < 0)
+            continue;
+        // pages belong to the swap file of the other model
+        qint32 page = pager->copy_page(*other.pager, slot.page);
+        if (page >= 0) {
+            slot.page = page;
+            continue;
+        }
+        unsigned char data[BRICK_VOLUME];
+        if (!other.pager->read_page(slot.page, data))
+            memset(data, VOXEL_AIR, BRICK_VOLUME);
+        slot.brick = new VoxelBrick;
+        slot.brick->pack(data);
+        slot.page = -1;
+    }
+    mark_layout();
 }
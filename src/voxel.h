@@ -31,30 +31,52 @@ THE SOFTWARE.
 #include "color.h"
 #include "glm.h"
 #include "types.h"
+#include "mathcommon.h"
 #include <QString>
 #include <QFile>
+#include <QAtomicInt>
 
 #define VOXEL_AIR 255
 
+// voxels are stored in bricks of BRICK_SIZE^3, see VoxelFile::bricks
+#define BRICK_SHIFT 4
+#define BRICK_SIZE (1 << BRICK_SHIFT)
+#define BRICK_MASK (BRICK_SIZE - 1)
+#define BRICK_VOLUME (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE)
+
+// occupancy words hold 64 voxels along z, i.e. 4 bricks
+#define SOLID_WORD_SHIFT 6
+#define SOLID_WORD_BITS (1 << SOLID_WORD_SHIFT)
+#define SOLID_WORD_BRICKS (SOLID_WORD_BITS / BRICK_SIZE)
+
 extern RGBColor * global_palette;
 extern QString * palette_names;
 
+class QDataStream;
+void read_cstring(QDataStream & stream, QString & v);
+void write_cstring(QDataStream & stream, const QString & v);
+
 class VoxelFile;
 class ReferencePoint;
-class btCompoundShape;
+class BrickPager;
 
 class VoxelModel
 {
 public:
     VoxelFile * file;
+    // one display list per brick slot of the file, starting at value
     GLuint value;
-    bool changed;
+    GLsizei lists;
+    quint64 epoch;
 
     VoxelModel(VoxelFile * file);
     ~VoxelModel();
     vec3 get_ken_normal(int x, int y, int z);
     void draw();
     void draw_immediate(float alpha = 1.0f, bool offset = true);
+    void draw_region(const ivec3 & min, const ivec3 & max,
+                     unsigned char alpha, const ivec3 & offset);
+    void update_brick(int x, int y, int z);
     void update(bool force = true);
     ReferencePoint * get_point(const QString & name);
 };
@@ -71,16 +93,242 @@ public:
 
 typedef std::vector<ReferencePoint> ReferencePoints;
 
-class VoxelFile
+// returns one bit per solid voxel of a BRICK_SIZE long z row
+inline unsigned short get_solid_mask(const unsigned char * row)
+{
+#ifdef VOXIE_SSE2
+    __m128i v = _mm_loadu_si128((const __m128i*)row);
+    __m128i air = _mm_set1_epi8((char)VOXEL_AIR);
+    return (unsigned short)~_mm_movemask_epi8(_mm_cmpeq_epi8(v, air));
+#else
+    unsigned short mask = 0;
+    for (int z = 0; z < BRICK_SIZE; z++) {
+        if (row[z] != VOXEL_AIR)
+            mask |= 1 << z;
+    }
+    return mask;
+#endif
+}
+
+// voxels of a brick take 1, 2, 4 or 8 bits. below 8 bits, they index the
+// local palette, which maps to global palette indices.
+#define BRICK_MAX_COLORS 16
+
+class VoxelBrick
 {
 public:
+    // number of slots sharing this brick. shared bricks are copied before
+    // they are written to, see VoxelFile::unshare_brick().
+    QAtomicInt refs;
+    // last use of the brick, only kept up to date while paging
+    quint32 stamp;
+    int bits;
+    int colors;
+    unsigned char palette[BRICK_MAX_COLORS];
+    // bits * BRICK_SIZE bits for every z row, rows indexed like solid
     unsigned char * data;
+    // occupancy bits of every z row, indexed by y + x * BRICK_SIZE.
+    unsigned short solid[BRICK_SIZE * BRICK_SIZE];
+
+    VoxelBrick(unsigned char v = VOXEL_AIR);
+    VoxelBrick(const VoxelBrick & other);
+    ~VoxelBrick();
+    void widen();
+    int add_color(unsigned char v);
+    void get_row(int x, int y, int z, int n, unsigned char * out);
+    void set_row(int x, int y, int z, int n, const unsigned char * in);
+    void fill_row(int x, int y, int z, int n, unsigned char v);
+    void unpack(unsigned char * out);
+    void pack(const unsigned char * in);
+    bool is_uniform(const ivec3 & size, unsigned char & v);
+    void update_column(int x, int y);
+    void update_solid();
+
+    inline bool is_shared()
+    {
+        return refs.load() != 1;
+    }
+
+    inline int get_data_size()
+    {
+        return (BRICK_VOLUME * bits) >> 3;
+    }
+
+    // local palette index of v, or v itself for 8 bit bricks. may widen.
+    inline int get_local(unsigned char v)
+    {
+        if (bits == 8)
+            return v;
+        for (int i = 0; i < colors; i++) {
+            if (palette[i] == v)
+                return i;
+        }
+        return add_color(v);
+    }
+
+    inline int get_index(int i)
+    {
+        if (bits == 8)
+            return data[i];
+        int bit = i * bits;
+        return (data[bit >> 3] >> (bit & 7)) & ((1 << bits) - 1);
+    }
+
+    inline void set_index(int i, int v)
+    {
+        if (bits == 8) {
+            data[i] = (unsigned char)v;
+            return;
+        }
+        int bit = i * bits;
+        int shift = bit & 7;
+        unsigned char & c = data[bit >> 3];
+        c = (unsigned char)((c & ~(((1 << bits) - 1) << shift)) |
+                            (v << shift));
+    }
+
+    inline unsigned char get(int x, int y, int z)
+    {
+        int i = get_index(z | (y << BRICK_SHIFT) | (x << (BRICK_SHIFT * 2)));
+        if (bits == 8)
+            return (unsigned char)i;
+        return palette[i];
+    }
+
+    inline void set(int x, int y, int z, unsigned char v)
+    {
+        int local = get_local(v);
+        set_index(z | (y << BRICK_SHIFT) | (x << (BRICK_SHIFT * 2)), local);
+        unsigned short & mask = solid[y | (x << BRICK_SHIFT)];
+        if (v == VOXEL_AIR)
+            mask &= ~(1 << z);
+        else
+            mask |= 1 << z;
+    }
+};
+
+inline void release_brick(VoxelBrick * brick)
+{
+    if (brick != NULL && !brick->refs.deref())
+        delete brick;
+}
+
+// if brick is NULL, every voxel of the slot that lies inside the model has
+// the color 'fill', so all-air and single-color bricks are not allocated.
+// voxels of an allocated brick that lie outside the model are always air.
+// if page is not -1, the brick has been paged out, see BrickPager.
+class BrickSlot
+{
+public:
+    VoxelBrick * brick;
+    // epoch of the last write to the slot, see VoxelFile::get_changes()
+    quint64 epoch;
+    qint32 page;
+    unsigned char fill;
+
+    inline bool is_empty() const
+    {
+        return brick == NULL && page < 0 && fill == VOXEL_AIR;
+    }
+};
+
+typedef std::vector<BrickSlot> BrickSlots;
+
+// flags of a cell of the occupancy pyramid, see VoxelFile::occupancy
+#define OCCUPANCY_ANY 1
+#define OCCUPANCY_ALL 2
+
+class OccupancyLevel
+{
+public:
+    int x_size, y_size, z_size;
+    std::vector<unsigned char> cells;
+
+    inline size_t get_index(int x, int y, int z)
+    {
+        return z + (y + size_t(x) * y_size) * z_size;
+    }
+
+    // cells outside the level are empty
+    inline unsigned char get(int x, int y, int z)
+    {
+        if (x < 0 || y < 0 || z < 0 ||
+            x >= x_size || y >= y_size || z >= z_size)
+            return 0;
+        return cells[get_index(x, y, z)];
+    }
+};
+
+// bits of solid word w that lie in the z range [z1, z2)
+inline uint64_t get_word_range(int w, int z1, int z2)
+{
+    z1 -= w << SOLID_WORD_SHIFT;
+    z2 -= w << SOLID_WORD_SHIFT;
+    uint64_t mask = ~uint64_t(0);
+    if (z2 < SOLID_WORD_BITS)
+        mask = (uint64_t(1) << z2) - 1;
+    if (z1 > 0)
+        mask &= ~((uint64_t(1) << z1) - 1);
+    return mask;
+}
+
+// an axis-aligned orientation. axis i of the result is axis axes[i] of the
+// source, reversed if flip[i] is set. this covers the 24 rotations and
+// their mirror images.
+class VoxelOrientation
+{
+public:
+    int axes[3];
+    bool flip[3];
+
+    VoxelOrientation();
+    static VoxelOrientation rotation(int axis, int turns = 1);
+    static VoxelOrientation mirror(int axis);
+    VoxelOrientation operator*(const VoxelOrientation & other) const;
+    bool is_mirror() const;
+    ivec3 get_size(const ivec3 & size) const;
+    ivec3 apply(const ivec3 & p, const ivec3 & size) const;
+};
+
+// child octant k of a cell, as x << 2 | y << 1 | z
+inline ivec3 get_octant(int k)
+{
+    return ivec3((k >> 2) & 1, (k >> 1) & 1, k & 1);
+}
+
+// operations of VoxelFile::combine()
+#define CSG_UNION 0
+#define CSG_SUBTRACT 1
+#define CSG_INTERSECT 2
+#define CSG_REPLACE 3
+
+class VoxelFile
+{
+public:
+    BrickSlots bricks;
+    int x_bricks, y_bricks, z_bricks;
+    // writes are tagged with the current epoch. a layout change (size,
+    // offset or brick grid) invalidates everything before layout_epoch.
+    quint64 epoch, layout_epoch, change_epoch;
+    // NULL unless the bricks are paged out of core
+    BrickPager * pager;
+    quint32 page_clock;
+    // models larger than this many voxels are paged when loaded
+    static int64_t memory_limit;
     qint32 x_size, y_size, z_size;
     qint32 x_offset, y_offset, z_offset;
     QString name;
     ReferencePoints points;
-    btCompoundShape * shape;
     vec3 min, max;
+    // number of voxels with each palette index, and number of solid voxels
+    // in every x, y and z slice. kept up to date by all writes.
+    int64_t color_counts[256];
+    std::vector<int64_t> x_counts, y_counts, z_counts;
+    // occupancy pyramid for skipping empty and fully solid space. level 0
+    // has one cell per brick, and every level above halves the grid down
+    // to a single cell. brought up to date by update_occupancy().
+    std::vector<OccupancyLevel> occupancy;
+    quint64 occupancy_epoch;
 
     VoxelFile();
     VoxelFile(const QString & filename);
@@ -90,6 +338,7 @@ public:
     static void load_palette();
     static void save_palette();
     static unsigned char get_closest_index(RGBColor c);
+    int get_chunk_rows();
     void load_fp(QFile & fp);
     bool load(const QString & filename);
     void save(const QString & filename);
@@ -100,17 +349,174 @@ public:
     ReferencePoint * get_point(const QString & name);
     ReferencePoint * get_point(int i);
     void resize(int x1, int y1, int z1, int x_size, int y_size, int z_size);
-    void scale(float sx, float sy, float sz);
+    void scale(float sx, float sy, float sz, bool prefer_solid = true);
     void set_offset(int x, int y, int z);
     void optimize();
     void rotate();
+    void orient(const VoxelOrientation & orientation);
     void clone(VoxelFile & other);
     vec3 get_min();
     vec3 get_max();
+    void swap_bricks(VoxelFile & other);
+    void free_bricks();
+    VoxelBrick * allocate_brick(int x, int y, int z);
+    VoxelBrick * unshare_brick(int x, int y, int z);
+    void share_brick(int x, int y, int z, VoxelBrick * brick,
+                     unsigned char v);
+    void store_brick(int x, int y, int z, const unsigned char * data);
+    bool compact_brick(int x, int y, int z);
+    void compact_bricks();
+    void enable_paging(int64_t max_bytes);
+    void inherit_paging(VoxelFile & other);
+    VoxelBrick * page_in(BrickSlot & slot);
+    void get_row(int x, int y, int z, int len, unsigned char * out);
+    void set_row(int x, int y, int z, int len, const unsigned char * in);
+    void fill_row(int x, int y, int z, int len, unsigned char v);
+    void fill(int x1, int y1, int z1, int x2, int y2, int z2,
+              unsigned char v);
+    int64_t flood_fill(int x, int y, int z, unsigned char v,
+                       const ivec3 & region_min, const ivec3 & region_max);
+    int64_t replace_color(unsigned char old_v, unsigned char v,
+                          const ivec3 & region_min,
+                          const ivec3 & region_max);
+    void remap(const unsigned char * table);
+    void combine(VoxelFile & other, int op);
+    void fit_margin(int margin);
+    void dilate(int radius, unsigned char v);
+    void erode(int radius);
+    void open(int radius);
+    void close(int radius, unsigned char v);
+    void hollow(int thickness);
+    void shell(int thickness, unsigned char v);
+    void get_brick_box(int x, int y, int z, ivec3 & min, ivec3 & max);
+    int get_uniform(const ivec3 & min, const ivec3 & max);
+    void reset_counts();
+    void add_box_counts(const ivec3 & min, const ivec3 & max,
+                        unsigned char v, int64_t sign);
+    void add_brick_counts(int x, int y, int z, int64_t sign);
+    bool get_solid_bounds(ivec3 & min, ivec3 & max);
+    bool get_solid_bounds(const ivec3 & region_min, const ivec3 & region_max,
+                          ivec3 & min, ivec3 & max);
+    quint64 next_epoch();
+    void mark_layout();
+    bool get_changes(quint64 since, std::vector<ivec3> & out,
+                     bool neighbours = false);
+    void update_occupancy();
+    unsigned char get_brick_occupancy(int x, int y, int z);
+    bool update_occupancy_cell(int level, int x, int y, int z);
+    void get_cell_box(int level, int x, int y, int z, ivec3 & min,
+                      ivec3 & max);
+    bool is_brick_hidden(int x, int y, int z);
+    bool raycast(const vec3 & pos, const vec3 & dir, ivec3 & hit,
+                 ivec3 & normal);
+    bool raycast_cell(int level, const ivec3 & cell, const vec3 & pos,
+                      const vec3 & inv_dir, ivec3 & hit, int & axis);
+    bool raycast_brick(const ivec3 & brick, const vec3 & pos,
+                       const vec3 & inv_dir, ivec3 & hit, int & axis);
+
+    inline bool has_changes(quint64 since)
+    {
+        return change_epoch > since;
+    }
+
+    inline void mark_dirty(BrickSlot & slot)
+    {
+        slot.epoch = change_epoch = epoch;
+    }
 
-    inline unsigned char & get(int x, int y, int z)
+    inline int64_t get_volume()
     {
-        return data[z + y * z_size + x * z_size * y_size];
+        return int64_t(x_size) * int64_t(y_size) * int64_t(z_size);
+    }
+
+    inline void update_counts(int x, int y, int z, unsigned char old_v,
+                              unsigned char new_v)
+    {
+        color_counts[old_v]--;
+        color_counts[new_v]++;
+        int64_t d = int64_t(new_v != VOXEL_AIR) -
+                    int64_t(old_v != VOXEL_AIR);
+        if (d == 0)
+            return;
+        x_counts[x] += d;
+        y_counts[y] += d;
+        z_counts[z] += d;
+    }
+
+    // x, y, z are in brick coordinates
+    inline size_t get_slot_index(int x, int y, int z)
+    {
+        return z + (y + size_t(x) * y_bricks) * z_bricks;
+    }
+
+    inline BrickSlot & get_slot(int x, int y, int z)
+    {
+        return bricks[get_slot_index(x, y, z)];
+    }
+
+    // returns the brick of a slot, or NULL if it has a single color. while
+    // paging, the brick stays valid until another brick is paged in or
+    // allocated, which may evict anything but the bricks used since. a
+    // brick that cannot be paged in is also NULL, with slot.page still set:
+    // it reads as air, and writes to it are dropped.
+    inline VoxelBrick * get_brick(BrickSlot & slot)
+    {
+        VoxelBrick * brick = slot.brick;
+        if (brick == NULL) {
+            if (slot.page < 0)
+                return NULL;
+            return page_in(slot);
+        }
+        if (pager != NULL)
+            brick->stamp = page_clock;
+        return brick;
+    }
+
+    inline unsigned char get(int x, int y, int z)
+    {
+        BrickSlot & slot = get_slot(x >> BRICK_SHIFT, y >> BRICK_SHIFT,
+                                    z >> BRICK_SHIFT);
+        VoxelBrick * brick = get_brick(slot);
+        if (brick == NULL)
+            return slot.fill;
+        return brick->get(x & BRICK_MASK, y & BRICK_MASK, z & BRICK_MASK);
+    }
+
+    inline int get_solid_words()
+    {
+        return (z_size + SOLID_WORD_BITS - 1) >> SOLID_WORD_SHIFT;
+    }
+
+    // occupancy of the voxels (x, y, w * 64) to (x, y, w * 64 + 63), with
+    // bit i set if voxel z = w * 64 + i is solid. out of bounds is empty.
+    inline uint64_t get_solid_word(int x, int y, int w)
+    {
+        if (x < 0 || y < 0 || w < 0 ||
+            x >= x_size || y >= y_size || w >= get_solid_words())
+            return 0;
+        int bx = x >> BRICK_SHIFT;
+        int by = y >> BRICK_SHIFT;
+        int column = (y & BRICK_MASK) | ((x & BRICK_MASK) << BRICK_SHIFT);
+        int bz = w * SOLID_WORD_BRICKS;
+        int count = std::min(SOLID_WORD_BRICKS, z_bricks - bz);
+        BrickSlot * slot = &get_slot(bx, by, bz);
+        uint64_t word = 0;
+        for (int i = 0; i < count; i++) {
+            uint64_t bits;
+            VoxelBrick * brick = get_brick(slot[i]);
+            if (brick != NULL)
+                bits = brick->solid[column];
+            else if (slot[i].fill == VOXEL_AIR)
+                bits = 0;
+            else
+                bits = (1 << BRICK_SIZE) - 1;
+            word |= bits << (i * BRICK_SIZE);
+        }
+        // single-color bricks may hang over the end of the model
+        int end = z_size - (w << SOLID_WORD_SHIFT);
+        if (end < SOLID_WORD_BITS)
+            word &= (uint64_t(1) << end) - 1;
+        return word;
     }
 
     inline unsigned char get_safe(int x, int y, int z)
@@ -150,14 +556,42 @@ public:
         if (x < 0 || y < 0 || z < 0 ||
             x >= x_size || y >= y_size || z >= z_size)
             return;
-        get(x, y, z) = i;
+        set_fast(x, y, z, i);
+    }
+
+    inline void set_fast(int x, int y, int z, unsigned char i)
+    {
+        int bx = x >> BRICK_SHIFT;
+        int by = y >> BRICK_SHIFT;
+        int bz = z >> BRICK_SHIFT;
+        BrickSlot & slot = get_slot(bx, by, bz);
+        VoxelBrick * brick = get_brick(slot);
+        int lx = x & BRICK_MASK;
+        int ly = y & BRICK_MASK;
+        int lz = z & BRICK_MASK;
+        unsigned char old;
+        if (brick == NULL) {
+            if (slot.page >= 0)
+                return;
+            old = slot.fill;
+            if (old == i)
+                return;
+            brick = allocate_brick(bx, by, bz);
+        } else {
+            old = brick->get(lx, ly, lz);
+            if (old == i)
+                return;
+            if (brick->is_shared())
+                brick = unshare_brick(bx, by, bz);
+        }
+        brick->set(lx, ly, lz, i);
+        update_counts(x, y, z, old, i);
+        mark_dirty(slot);
     }
 
     VoxelModel * model;
     VoxelModel * get_model();
     void update_model();
-    btCompoundShape * get_shape();
-    void reset_shape();
 };
 
 #endif // VOXIE_VOXEL_H
@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// packs a library of .vxi frames into one sparse voxel DAG, so subtrees
+// shared between frames are only stored once. frames are named by their
+// path relative to the directory they were found in.
+//
+// usage: dagpack <output.vdag> <file or directory>...
+
+#include "svdag.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QStringList>
+#include <stdio.h>
+
+static void add_path(const QString & path, QStringList & files,
+                     QStringList & names)
+{
+    QFileInfo info(path);
+    if (!info.isDir()) {
+        files.append(path);
+        names.append(info.completeBaseName());
+        return;
+    }
+    QDir dir(path);
+    QStringList found;
+    QDirIterator it(path, QStringList() << "*.vxi", QDir::Files,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext())
+        found.append(it.next());
+    found.sort();
+    for (int i = 0; i < found.size(); i++) {
+        QString name = dir.relativeFilePath(found[i]);
+        files.append(found[i]);
+        names.append(name.left(name.size() - 4));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    if (args.size() < 3) {
+        fprintf(stderr,
+                "usage: dagpack <output.vdag> <file or directory>...\n");
+        return 1;
+    }
+
+    QStringList files, names;
+    for (int i = 2; i < args.size(); i++)
+        add_path(args[i], files, names);
+
+    VoxelDAG dag;
+    int64_t volume = 0;
+    for (int i = 0; i < files.size(); i++) {
+        VoxelFile file;
+        if (!file.load(files[i])) {
+            fprintf(stderr, "could not load %s\n", qPrintable(files[i]));
+            return 1;
+        }
+        volume += file.get_volume();
+        dag.add_frame(names[i], &file);
+    }
+    dag.save(args[1]);
+
+    printf("%d frames, %lld voxels, %lld leaves, %lld bytes\n",
+           int(dag.frames.size()), (long long)volume,
+           (long long)dag.leaves.size(), (long long)dag.get_memory());
+    return 0;
+}
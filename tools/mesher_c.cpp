@@ -87,11 +87,17 @@ public:
 
 #include <iostream>
 
+// occupancy words hold 64 voxels along z
+#define SOLID_WORD_SHIFT 6
+#define SOLID_WORD_BITS (1 << SOLID_WORD_SHIFT)
+
 class MesherModel
 {
 public:
     unsigned char * data;
     int x_size, y_size, z_size;
+    int z_words;
+    std::vector<uint64_t> solid;
 
     MesherModel()
     {
@@ -103,6 +109,44 @@ public:
         this->x_size = x_size;
         this->y_size = y_size;
         this->z_size = z_size;
+        z_words = (z_size + SOLID_WORD_BITS - 1) >> SOLID_WORD_SHIFT;
+        get_color_words(VOXEL_AIR, solid);
+        for (std::size_t i = 0; i < solid.size(); i++)
+            solid[i] = ~solid[i];
+        // padding past z_size is not solid
+        int end = z_size & (SOLID_WORD_BITS - 1);
+        if (end == 0)
+            return;
+        uint64_t mask = (uint64_t(1) << end) - 1;
+        for (std::size_t i = z_words - 1; i < solid.size(); i += z_words)
+            solid[i] &= mask;
+    }
+
+    // sets bit z & 63 of word (z >> 6) + (y + x * y_size) * z_words for
+    // every voxel with the color p
+    void get_color_words(unsigned char p, std::vector<uint64_t> & words)
+    {
+        words.assign(std::size_t(x_size) * y_size * z_words, 0);
+        const unsigned char * v = data;
+        uint64_t * word = &words[0];
+        for (int x = 0; x < x_size; x++)
+        for (int y = 0; y < y_size; y++) {
+            for (int z = 0; z < z_size; z++) {
+                if (v[z] == p)
+                    word[z >> SOLID_WORD_SHIFT] |= uint64_t(1) <<
+                        (z & (SOLID_WORD_BITS - 1));
+            }
+            v += z_size;
+            word += z_words;
+        }
+    }
+
+    inline uint64_t get_solid_word(int x, int y, int w)
+    {
+        if (x < 0 || y < 0 || w < 0 ||
+            x >= x_size || y >= y_size || w >= z_words)
+            return 0;
+        return solid[w + (y + std::size_t(x) * y_size) * z_words];
     }
 
     inline unsigned char get(int x, int y, int z)
@@ -110,7 +154,7 @@ public:
         if (x < 0 || y < 0 || z < 0 ||
             x >= x_size || y >= y_size || z >= z_size)
             return VOXEL_AIR;
-        return data[z + y * z_size + x * z_size * y_size];
+        return data[z + (y + std::size_t(x) * y_size) * z_size];
     }
 
     inline bool test(int x, int y, int z, unsigned char p)
@@ -121,8 +165,63 @@ public:
 
     inline bool is_solid(int x, int y, int z, unsigned char p)
     {
-        unsigned char r = get(x, y, z);
-        return r != VOXEL_AIR;
+        if (z < 0)
+            return false;
+        uint64_t word = get_solid_word(x, y, z >> SOLID_WORD_SHIFT);
+        return (word >> (z & (SOLID_WORD_BITS - 1))) & 1;
+    }
+};
+
+// direction indices for FaceMasks
+#define FACE_X_NEG 0
+#define FACE_X_POS 1
+#define FACE_Y_NEG 2
+#define FACE_Y_POS 3
+#define FACE_Z_NEG 4
+#define FACE_Z_POS 5
+
+// per direction, one bit for every voxel of a color with that face exposed,
+// laid out like MesherModel::solid
+class FaceMasks
+{
+public:
+    int y_size, z_words;
+    std::vector<uint64_t> faces[6];
+
+    void build(MesherModel * model, unsigned char p)
+    {
+        y_size = model->y_size;
+        z_words = model->z_words;
+        std::vector<uint64_t> color;
+        model->get_color_words(p, color);
+        for (int i = 0; i < 6; i++)
+            faces[i].assign(color.size(), 0);
+        std::size_t i = 0;
+        for (int x = 0; x < model->x_size; x++)
+        for (int y = 0; y < model->y_size; y++)
+        for (int w = 0; w < z_words; w++, i++) {
+            uint64_t c = color[i];
+            if (c == 0)
+                continue;
+            uint64_t s = model->get_solid_word(x, y, w);
+            uint64_t above = (s >> 1) |
+                             (model->get_solid_word(x, y, w + 1) << 63);
+            uint64_t below = (s << 1) |
+                             (model->get_solid_word(x, y, w - 1) >> 63);
+            faces[FACE_X_NEG][i] = c & ~model->get_solid_word(x - 1, y, w);
+            faces[FACE_X_POS][i] = c & ~model->get_solid_word(x + 1, y, w);
+            faces[FACE_Y_NEG][i] = c & ~model->get_solid_word(x, y - 1, w);
+            faces[FACE_Y_POS][i] = c & ~model->get_solid_word(x, y + 1, w);
+            faces[FACE_Z_NEG][i] = c & ~below;
+            faces[FACE_Z_POS][i] = c & ~above;
+        }
+    }
+
+    inline uint8_t test(int face, int x, int y, int z)
+    {
+        uint64_t word = faces[face][(z >> SOLID_WORD_SHIFT) +
+                                    (y + std::size_t(x) * y_size) * z_words];
+        return (word >> (z & (SOLID_WORD_BITS - 1))) & 1;
     }
 };
 
@@ -252,6 +351,9 @@ public:
         int h = model->y_size;
         int d = model->z_size;
 
+        FaceMasks masks;
+        masks.build(model, p);
+
         std::vector<uint8_t> slice;
 
         // x-slice
@@ -260,13 +362,7 @@ public:
         for (int x = 0; x < w; x++) {
             for (int y = 0; y < h; y++) {
                 for (int z = 0; z < d; z++) {
-                    uint8_t& s = slice[y * d + z];
-                    if (x == 0)
-                        s = model->test(x, y, z, p) ? 1 : 0;
-                    else
-                        s = (model->test(x, y, z, p) &&
-                             !model->is_solid(x - 1, y, z, p))
-                        ? 1 : 0;
+                    slice[y * d + z] = masks.test(FACE_X_NEG, x, y, z);
                 }
             }
             emit_slice(slice.data(), h, d,
@@ -278,13 +374,7 @@ public:
 
             for (int y = 0; y < h; y++) {
                 for (int z = 0; z < d; z++) {
-                    uint8_t& s = slice[y * d + z];
-                    if (x == w - 1)
-                        s = model->test(x, y, z, p) ? 1 : 0;
-                    else
-                        s = (model->test(x, y, z, p) &&
-                             !model->is_solid(x + 1, y, z, p))
-                        ? 1 : 0;
+                    slice[y * d + z] = masks.test(FACE_X_POS, x, y, z);
                 }
             }
             emit_slice(slice.data(), h, d,
@@ -301,13 +391,7 @@ public:
         for (int y = 0; y < h; y++) {
             for (int x = 0; x < w; x++) {
                 for (int z = 0; z < d; z++) {
-                    uint8_t& s = slice[x * d + z];
-                    if (y == 0)
-                        s = model->test(x, y, z, p) ? 1 : 0;
-                    else
-                        s = (model->test(x, y, z, p) &&
-                             !model->is_solid(x, y - 1, z, p))
-                        ? 1 : 0;
+                    slice[x * d + z] = masks.test(FACE_Y_NEG, x, y, z);
                 }
             }
             emit_slice(slice.data(), w, d,
@@ -319,13 +403,7 @@ public:
 
             for (int x = 0; x < w; x++) {
                 for (int z = 0; z < d; z++) {
-                    uint8_t& s = slice[x * d + z];
-                    if (y == h - 1)
-                        s = model->test(x, y, z, p) ? 1 : 0;
-                    else
-                        s = (model->test(x, y, z, p) &&
-                             !model->is_solid(x, y + 1, z, p))
-                        ? 1 : 0;
+                    slice[x * d + z] = masks.test(FACE_Y_POS, x, y, z);
                 }
             }
             emit_slice(slice.data(), w, d,
@@ -342,13 +420,7 @@ public:
         for (int z = 0; z < d; z++) {
             for (int x = 0; x < w; x++) {
                 for (int y = 0; y < h; y++) {
-                    uint8_t& s = slice[x * h + y];
-                    if (z == 0)
-                        s = model->test(x, y, z, p) ? 1 : 0;
-                    else
-                        s = (model->test(x, y, z, p) &&
-                             !model->is_solid(x, y, z - 1, p))
-                        ? 1 : 0;
+                    slice[x * h + y] = masks.test(FACE_Z_NEG, x, y, z);
                 }
             }
             emit_slice(slice.data(), w, h,
@@ -360,13 +432,7 @@ public:
 
             for (int x = 0; x < w; x++) {
                 for (int y = 0; y < h; y++) {
-                    uint8_t& s = slice[x * h + y];
-                    if (z == d - 1)
-                        s = model->test(x, y, z, p) ? 1 : 0;
-                    else
-                        s = (model->test(x, y, z, p) &&
-                             !model->is_solid(x, y, z + 1, p))
-                        ? 1 : 0;
+                    slice[x * h + y] = masks.test(FACE_Z_POS, x, y, z);
                 }
             }
             emit_slice(slice.data(), w, h,
@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// writes the signed distance field of .vxi models next to them, with the
+// .sdf extension. see DistanceField::save_fp() for the layout.
+//
+// usage: sdfexport [-half | -byte] [-padding n] <file.vxi>...
+
+#include "distance.h"
+
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QStringList>
+#include <stdio.h>
+
+static void print_usage()
+{
+    fprintf(stderr,
+            "usage: sdfexport [-half | -byte] [-padding n] <file.vxi>...\n");
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    int format = SDF_FLOAT;
+    int padding = 2;
+    QStringList files;
+    for (int i = 1; i < args.size(); i++) {
+        if (args[i] == "-half")
+            format = SDF_HALF;
+        else if (args[i] == "-byte")
+            format = SDF_BYTE;
+        else if (args[i] == "-padding" && i + 1 < args.size())
+            padding = args[++i].toInt();
+        else
+            files.append(args[i]);
+    }
+    if (files.isEmpty()) {
+        print_usage();
+        return 1;
+    }
+
+    for (int i = 0; i < files.size(); i++) {
+        VoxelFile file;
+        if (!file.load(files[i])) {
+            fprintf(stderr, "could not load %s\n", qPrintable(files[i]));
+            return 1;
+        }
+        DistanceField field;
+        field.build(&file, padding);
+        QFileInfo info(files[i]);
+        QString name = info.path() + "/" + info.completeBaseName() + ".sdf";
+        field.save(name, format);
+        printf("%s: %dx%dx%d, max distance %g\n", qPrintable(name),
+               field.x_size, field.y_size, field.z_size, field.get_max());
+    }
+    return 0;
+}
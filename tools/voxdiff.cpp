@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2013 Mathias Kaerlev
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// prints the voxels that changed between two .vxi models, and optionally
+// writes the change set, see VoxelDiff::save_fp() for the layout.
+//
+// usage: voxdiff <old.vxi> <new.vxi> [out.vxd]
+
+#include "diff.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <stdio.h>
+
+static void print_usage()
+{
+    fprintf(stderr, "usage: voxdiff <old.vxi> <new.vxi> [out.vxd]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    if (args.size() != 3 && args.size() != 4) {
+        print_usage();
+        return 1;
+    }
+
+    VoxelFile files[2];
+    for (int i = 0; i < 2; i++) {
+        if (!files[i].load(args[i + 1])) {
+            fprintf(stderr, "could not load %s\n", qPrintable(args[i + 1]));
+            return 1;
+        }
+    }
+    VoxelDiff diff;
+    diff.build(&files[0], &files[1]);
+    printf("%lld added, %lld removed, %lld recolored in %d runs\n",
+           (long long)diff.counts[DIFF_ADDED],
+           (long long)diff.counts[DIFF_REMOVED],
+           (long long)diff.counts[DIFF_RECOLORED], int(diff.runs.size()));
+    if (args.size() == 4)
+        diff.save(args[3]);
+    return 0;
+}